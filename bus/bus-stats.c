@@ -0,0 +1,111 @@
+// Shared memory segment for the per-region bus access statistics, see bus-stats.h.
+// The segment is left in place on exit so the final numbers can still be read,
+// it is recreated on the next start.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bus-stats.h"
+
+struct bus_stats *bus_stats;
+unsigned char bus_stats_region_map[256];
+double bus_stats_ns_per_tick = 1.0;
+
+static const char *region_names[BUS_REGION_NUM] = BUS_STATS_REGION_NAMES;
+
+static inline uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void set_regions(unsigned int first, unsigned int last, unsigned char region) {
+  for (unsigned int i = first; i <= last; i++)
+    bus_stats_region_map[i] = region;
+}
+
+// Regions by 64KB page of the 24-bit Amiga address space.
+static void build_region_map(void) {
+  set_regions(0x00, 0xFF, BUS_REGION_UNMAPPED);
+  set_regions(0x00, 0x1F, BUS_REGION_CHIP);
+  set_regions(0xA0, 0xBF, BUS_REGION_CIA_A);
+  set_regions(0xC0, 0xD7, BUS_REGION_SLOW);
+  set_regions(0xD8, 0xDE, BUS_REGION_GAYLE);
+  set_regions(0xDF, 0xDF, BUS_REGION_CUSTOM);
+  set_regions(0xE8, 0xEF, BUS_REGION_AUTOCONF);
+  set_regions(0xF0, 0xFF, BUS_REGION_ROM);
+}
+
+static void calibrate_ticks(void) {
+  uint64_t start_ns = get_time_ns(), start_ticks = bus_stats_ticks();
+
+  usleep(20000);
+  bus_stats_ns_per_tick = (double)(get_time_ns() - start_ns) / (bus_stats_ticks() - start_ticks);
+}
+
+int bus_stats_init(void) {
+  int fd = shm_open(BUS_STATS_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  struct bus_stats *stats;
+
+  if (fd == -1) {
+    printf("[BUS] Failed to create shared memory segment %s for bus statistics.\n", BUS_STATS_SHM_NAME);
+    return -1;
+  }
+  if (ftruncate(fd, sizeof(struct bus_stats)) == -1) {
+    printf("[BUS] Failed to size shared memory segment %s.\n", BUS_STATS_SHM_NAME);
+    close(fd);
+    return -1;
+  }
+
+  stats = mmap(NULL, sizeof(struct bus_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    printf("[BUS] Failed to map shared memory segment %s.\n", BUS_STATS_SHM_NAME);
+    return -1;
+  }
+
+  build_region_map();
+  calibrate_ticks();
+
+  memset(stats, 0x00, sizeof(struct bus_stats));
+  stats->magic = BUS_STATS_MAGIC;
+  stats->version = BUS_STATS_VERSION;
+  stats->start_ns = get_time_ns();
+  bus_stats = stats;
+
+  printf("[BUS] Bus access statistics in shared memory %s, %.2f ns per timer tick.\n", BUS_STATS_SHM_NAME,
+         bus_stats_ns_per_tick);
+  return 0;
+}
+
+void bus_stats_totals(uint64_t *count, uint64_t *time_ns) {
+  *count = *time_ns = 0;
+  for (int i = 0; bus_stats && i < BUS_REGION_NUM; i++) {
+    *count += bus_stats->regions[i].reads + bus_stats->regions[i].writes;
+    *time_ns += bus_stats->regions[i].time_ns;
+  }
+}
+
+void bus_stats_print(void) {
+  uint64_t total_count, total_ns;
+  double elapsed_ns;
+
+  if (!bus_stats)
+    return;
+
+  bus_stats_totals(&total_count, &total_ns);
+  elapsed_ns = get_time_ns() - bus_stats->start_ns;
+  printf("[BUS] %llu bus accesses, %.1f%% of the run time spent in them.\n", (unsigned long long)total_count,
+         total_ns * 100.0 / elapsed_ns);
+  printf("[BUS] %-12s %12s %12s %10s %10s\n", "Region", "Reads", "Writes", "Avg ns", "Time share");
+  for (int i = 0; i < BUS_REGION_NUM; i++) {
+    struct bus_stats_region *r = &bus_stats->regions[i];
+    uint64_t count = r->reads + r->writes;
+    if (!count)
+      continue;
+    printf("[BUS] %-12s %12llu %12llu %10.1f %9.1f%%\n", region_names[i], (unsigned long long)r->reads,
+           (unsigned long long)r->writes, (double)r->time_ns / count, total_ns ? r->time_ns * 100.0 / total_ns : 0);
+  }
+}
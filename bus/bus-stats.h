@@ -0,0 +1,123 @@
+#ifndef BUS_STATS_HEADER
+#define BUS_STATS_HEADER
+
+#include <stdint.h>
+#include <time.h>
+
+// Per-region bus access accounting. Counts and log2 latency histograms live in
+// a shared memory segment, so tools/busstats can read them while the emulator
+// runs. Only the CPU thread updates them, readers may see a count a step ahead
+// of its time. The main loop publishes its timeslice counters there as well, so the
+// interrupt rate and what the loopcycles controller does can be followed live too.
+
+#define BUS_STATS_SHM_NAME "/pistorm-busstats"
+#define BUS_STATS_MAGIC 0x50534253
+#define BUS_STATS_VERSION 2
+#define BUS_STATS_BUCKETS 24  // Bucket n counts accesses taking less than 2^n ns
+
+enum bus_stats_regions {
+  BUS_REGION_CHIP,
+  BUS_REGION_SLOW,
+  BUS_REGION_CUSTOM,
+  BUS_REGION_CIA_A,
+  BUS_REGION_CIA_B,
+  BUS_REGION_GAYLE,
+  BUS_REGION_AUTOCONF,
+  BUS_REGION_ROM,
+  BUS_REGION_UNMAPPED,
+  BUS_REGION_STATUS,
+  BUS_REGION_NUM,
+};
+
+#define BUS_STATS_REGION_NAMES \
+  { "Chip RAM", "Slow RAM", "Custom", "CIA-A", "CIA-B", "Gayle/IDE", "Autoconf", "ROM", "Unmapped", "CPLD status" }
+
+struct bus_stats_region {
+  uint64_t reads, writes, time_ns;
+  uint64_t hist[BUS_STATS_BUCKETS];
+};
+
+struct bus_stats_loop {
+  uint64_t slices, cycles, exec_ns, overhead_ns;
+  uint64_t irqs;         // Interrupts raised to the CPU
+  uint64_t loop_cycles;  // Current timeslice length, changes with loopcycles auto
+};
+
+struct bus_stats {
+  uint32_t magic, version;
+  uint64_t start_ns;  // CLOCK_MONOTONIC when counting started
+  struct bus_stats_region regions[BUS_REGION_NUM];
+  struct bus_stats_loop loop;
+};
+
+// NULL unless accounting is enabled.
+extern struct bus_stats *bus_stats;
+extern unsigned char bus_stats_region_map[256];
+extern double bus_stats_ns_per_tick;
+
+int bus_stats_init(void);
+void bus_stats_totals(uint64_t *count, uint64_t *time_ns);
+void bus_stats_print(void);
+
+// ARMv7 has no timer user space can read cheaply, its cycle counter is only readable once
+// the kernel allows it, so clock_gettime it is. That costs more than some accesses, so there
+// only every 16th access to a region is timed and counts for 16 in time_ns and the
+// histogram. Reads and writes are always counted exactly.
+#ifndef BUS_STATS_SAMPLE_SHIFT
+#if defined(__aarch64__) || defined(__x86_64__) || defined(__i386__)
+#define BUS_STATS_SAMPLE_SHIFT 0
+#else
+#define BUS_STATS_SAMPLE_SHIFT 4
+#endif
+#endif
+#define BUS_STATS_SAMPLE_MASK ((1ULL << BUS_STATS_SAMPLE_SHIFT) - 1)
+
+// The cheapest timestamp around, calibrated against CLOCK_MONOTONIC by bus_stats_init.
+static inline uint64_t bus_stats_ticks(void) {
+#if defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#elif defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// CIA-A sits on the odd, CIA-B on the even bytes of the same range.
+static inline unsigned int bus_stats_region(uint32_t address) {
+  unsigned int region = bus_stats_region_map[(address >> 16) & 0xFF];
+
+  if (region == BUS_REGION_CIA_A && !(address & 1))
+    region = BUS_REGION_CIA_B;
+  return region;
+}
+
+// Whether the next access to the region is to be timed.
+static inline int bus_stats_timed(unsigned int region) {
+  const struct bus_stats_region *r = &bus_stats->regions[region];
+  return !((r->reads + r->writes) & BUS_STATS_SAMPLE_MASK);
+}
+
+// Counts an access that is not timed.
+static inline void bus_stats_count(unsigned int region, int write) {
+  if (write)
+    bus_stats->regions[region].writes++;
+  else
+    bus_stats->regions[region].reads++;
+}
+
+static inline void bus_stats_account(unsigned int region, int write, uint64_t start_ticks) {
+  uint64_t ns = (uint64_t)((bus_stats_ticks() - start_ticks) * bus_stats_ns_per_tick);
+  struct bus_stats_region *r = &bus_stats->regions[region];
+  int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+  bus_stats_count(region, write);
+  r->time_ns += ns << BUS_STATS_SAMPLE_SHIFT;
+  r->hist[(bucket < BUS_STATS_BUCKETS) ? bucket : BUS_STATS_BUCKETS - 1] += 1 << BUS_STATS_SAMPLE_SHIFT;
+}
+
+#endif /* BUS_STATS_HEADER */
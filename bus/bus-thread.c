@@ -0,0 +1,213 @@
+// Runs the bus writes of the current backend on a thread of their own.
+//
+// The CPU thread queues writes in a single producer/single consumer ring and
+// carries on emulating, while the bus thread, pinned to another core, turns
+// them into bus transactions. Everything else first waits for the ring to
+// drain and then calls the backend directly on the CPU thread. The bus thread
+// only touches the backend while the ring is non-empty, so the two never run
+// a transaction at the same time and program order is kept.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../config_file/config_file.h"
+#include "bus.h"
+
+#define BUS_RING_SIZE 256  // Must be a power of two
+#define BUS_RING_MASK (BUS_RING_SIZE - 1)
+
+struct bus_write {
+  uint32_t address;
+  uint32_t data;
+  unsigned char type;
+};
+
+static struct bus_write ring[BUS_RING_SIZE];
+// ring_head is only written by the CPU thread, ring_tail by the bus thread.
+static atomic_uint ring_head, ring_tail;
+static atomic_int thread_running;
+static unsigned int cpu_head;
+
+static struct bus_backend *inner;
+static pthread_t bus_thread;
+
+static uint64_t queued_writes, full_stalls, drains, drain_stalls;
+
+static void *bus_thread_main(void *args) {
+  unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  (void)args;
+
+  while (atomic_load_explicit(&thread_running, memory_order_relaxed)) {
+    unsigned int head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    if (tail == head) {
+      cpu_relax();
+      continue;
+    }
+
+    while (tail != head) {
+      struct bus_write *w = &ring[tail & BUS_RING_MASK];
+      if (w->type == OP_TYPE_BYTE)
+        inner->write8(w->address, w->data);
+      else
+        inner->write16(w->address, w->data);
+      tail++;
+      // Publish each write as it completes, a drain waits for exactly this.
+      atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+  }
+
+  return NULL;
+}
+
+// Wait until the bus thread has run every queued write.
+static inline void bus_drain(void) {
+  drains++;
+  if (atomic_load_explicit(&ring_tail, memory_order_acquire) == cpu_head)
+    return;
+
+  drain_stalls++;
+  while (atomic_load_explicit(&ring_tail, memory_order_acquire) != cpu_head)
+    cpu_relax();
+}
+
+static inline void bus_queue_write(uint32_t address, uint32_t data, unsigned char type) {
+  struct bus_write *w;
+
+  if (cpu_head - atomic_load_explicit(&ring_tail, memory_order_acquire) == BUS_RING_SIZE) {
+    full_stalls++;
+    while (cpu_head - atomic_load_explicit(&ring_tail, memory_order_acquire) == BUS_RING_SIZE)
+      cpu_relax();
+  }
+
+  w = &ring[cpu_head & BUS_RING_MASK];
+  w->address = address;
+  w->data = data;
+  w->type = type;
+  cpu_head++;
+  queued_writes++;
+  atomic_store_explicit(&ring_head, cpu_head, memory_order_release);
+}
+
+static void thread_bus_write8(uint32_t address, uint32_t data) {
+  bus_queue_write(address, data, OP_TYPE_BYTE);
+}
+
+static void thread_bus_write16(uint32_t address, uint32_t data) {
+  bus_queue_write(address, data, OP_TYPE_WORD);
+}
+
+static uint32_t thread_bus_read8(uint32_t address) {
+  bus_drain();
+  return inner->read8(address);
+}
+
+static uint32_t thread_bus_read16(uint32_t address) {
+  bus_drain();
+  return inner->read16(address);
+}
+
+static uint16_t thread_bus_read_reg(void) {
+  bus_drain();
+  return inner->read_reg();
+}
+
+static void thread_bus_write_reg(unsigned int value) {
+  bus_drain();
+  inner->write_reg(value);
+}
+
+// The IPL state is only meaningful once earlier writes, such as an INTREQ
+// acknowledge, have reached the Amiga.
+static int thread_bus_irq_pending(void) {
+  bus_drain();
+  return inner->irq_pending();
+}
+
+// The bus thread only ever writes, sampling the pin can't get in its way.
+static int thread_bus_irq_line(void) {
+  return inner->irq_line();
+}
+
+static void thread_bus_print_stats(void) {
+  printf("[BUS] Bus thread: %llu queued writes, %llu ring full stalls, %llu of %llu drains waited on the bus thread.\n",
+         (unsigned long long)queued_writes, (unsigned long long)full_stalls,
+         (unsigned long long)drain_stalls, (unsigned long long)drains);
+  if (inner->print_stats)
+    inner->print_stats();
+}
+
+static void thread_bus_shutdown(void) {
+  bus_drain();
+  atomic_store(&thread_running, 0);
+  pthread_join(bus_thread, NULL);
+  bus = inner;
+  inner->shutdown();
+}
+
+static int thread_bus_setup(struct emulator_config *cfg, char *options) {
+  return inner->setup(cfg, options);
+}
+
+static struct bus_backend thread_bus_backend = {
+  .name = "thread",
+  .setup = thread_bus_setup,
+  .shutdown = thread_bus_shutdown,
+  .read8 = thread_bus_read8,
+  .read16 = thread_bus_read16,
+  .write8 = thread_bus_write8,
+  .write16 = thread_bus_write16,
+  .read_reg = thread_bus_read_reg,
+  .write_reg = thread_bus_write_reg,
+  .irq_pending = thread_bus_irq_pending,
+  .irq_line = thread_bus_irq_line,
+  .print_stats = thread_bus_print_stats,
+};
+
+// Move bus writes of the already set up backend to a thread on the given core.
+// With cpu set to -1, picks the core below the one the emulator runs on.
+int bus_start_thread(int cpu) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t cpus;
+  int err;
+
+  if (num_cpus < 2) {
+    printf("[BUS] Only one CPU core online, not starting a bus thread.\n");
+    return -1;
+  }
+  if (cpu < 0)
+    cpu = (sched_getcpu() + num_cpus - 1) % num_cpus;
+  if (cpu == sched_getcpu()) {
+    // Both threads spin, with SCHED_FIFO on one core they would never let the other run.
+    printf("[BUS] CPU %d is the one the emulator runs on, not starting a bus thread.\n", cpu);
+    return -1;
+  }
+
+  inner = bus;
+  atomic_store(&ring_head, 0);
+  atomic_store(&ring_tail, 0);
+  atomic_store(&thread_running, 1);
+  cpu_head = 0;
+
+  err = pthread_create(&bus_thread, NULL, bus_thread_main, NULL);
+  if (err != 0) {
+    printf("[BUS] Failed to create bus thread: %s\n", strerror(err));
+    return -1;
+  }
+  pthread_setname_np(bus_thread, "bus");
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  err = pthread_setaffinity_np(bus_thread, sizeof(cpus), &cpus);
+  if (err != 0)
+    printf("[BUS] Failed to pin bus thread to CPU %d: %s\n", cpu, strerror(err));
+  else
+    printf("[BUS] Bus thread running on CPU %d.\n", cpu);
+
+  bus = &thread_bus_backend;
+  return 0;
+}
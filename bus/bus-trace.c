@@ -0,0 +1,281 @@
+// Records every bus transaction of the current backend into a binary trace file.
+//
+// Each thread that runs transactions (the CPU thread, and the bus thread when
+// it is enabled) gets a single producer/single consumer ring of its own. A
+// flush thread empties the rings into the trace file every millisecond. When
+// a ring is full the record is dropped and counted, the bus is never held up
+// by the tracer. tools/bustrace.c summarizes the file.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../config_file/config_file.h"
+#include "bus.h"
+#include "bus-trace.h"
+
+#define TRACE_RING_SIZE 65536  // Must be a power of two
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_MAX_THREADS 4
+
+struct trace_ring {
+  struct bus_trace_record records[TRACE_RING_SIZE];
+  // head is only written by the tracing thread, tail by the flush thread.
+  atomic_uint head, tail;
+  uint64_t dropped;
+};
+
+static struct trace_ring *rings;
+static atomic_int num_rings;
+static _Thread_local struct trace_ring *thread_ring;
+static _Thread_local int thread_ring_index = -1;
+
+static struct bus_backend *inner;
+static unsigned int (*inner_spins)(void);
+static FILE *trace_file;
+static char *trace_filename;
+static pthread_t flush_thread;
+static atomic_int flush_running;
+static uint64_t trace_start_ns, records_written;
+
+static inline uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int no_spins(void) {
+  return 0;
+}
+
+static struct trace_ring *get_thread_ring(void) {
+  if (thread_ring_index == -1) {
+    thread_ring_index = atomic_fetch_add(&num_rings, 1);
+    if (thread_ring_index >= TRACE_MAX_THREADS) {
+      printf("[BUS] More than %d threads on the bus, not tracing this one.\n", TRACE_MAX_THREADS);
+      atomic_fetch_sub(&num_rings, 1);
+      thread_ring_index = TRACE_MAX_THREADS;
+    } else {
+      thread_ring = &rings[thread_ring_index];
+    }
+  }
+  return thread_ring;
+}
+
+static inline void trace_record(uint64_t start_ns, unsigned int start_spins, uint32_t address,
+                                uint32_t value, unsigned char size, unsigned char flags) {
+  uint64_t end_ns = get_time_ns();
+  unsigned int spins = inner_spins() - start_spins;
+  struct trace_ring *r = thread_ring ? thread_ring : get_thread_ring();
+  struct bus_trace_record *rec;
+  unsigned int head;
+
+  if (!r)
+    return;
+
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+    r->dropped++;
+    return;
+  }
+
+  rec = &r->records[head & TRACE_RING_MASK];
+  rec->time_ns = start_ns - trace_start_ns;
+  rec->address = address;
+  rec->value = value;
+  rec->duration_ns = end_ns - start_ns;
+  rec->wait_spins = (spins > 0xFFFF) ? 0xFFFF : spins;
+  rec->size = size;
+  rec->flags = flags | (thread_ring_index << BUS_TRACE_THREAD_SHIFT);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+#define TRACE_BEGIN \
+  uint64_t start_ns = get_time_ns(); \
+  unsigned int start_spins = inner_spins();
+
+static uint32_t trace_bus_read8(uint32_t address) {
+  TRACE_BEGIN
+  uint32_t value = inner->read8(address);
+  trace_record(start_ns, start_spins, address, value, 1, 0);
+  return value;
+}
+
+static uint32_t trace_bus_read16(uint32_t address) {
+  TRACE_BEGIN
+  uint32_t value = inner->read16(address);
+  trace_record(start_ns, start_spins, address, value, 2, 0);
+  return value;
+}
+
+static void trace_bus_write8(uint32_t address, uint32_t data) {
+  TRACE_BEGIN
+  inner->write8(address, data);
+  trace_record(start_ns, start_spins, address, data, 1, BUS_TRACE_WRITE);
+}
+
+static void trace_bus_write16(uint32_t address, uint32_t data) {
+  TRACE_BEGIN
+  inner->write16(address, data);
+  trace_record(start_ns, start_spins, address, data, 2, BUS_TRACE_WRITE);
+}
+
+static uint16_t trace_bus_read_reg(void) {
+  TRACE_BEGIN
+  uint16_t value = inner->read_reg();
+  trace_record(start_ns, start_spins, 0, value, 2, BUS_TRACE_REG);
+  return value;
+}
+
+static void trace_bus_write_reg(unsigned int value) {
+  TRACE_BEGIN
+  inner->write_reg(value);
+  trace_record(start_ns, start_spins, 0, value, 2, BUS_TRACE_REG | BUS_TRACE_WRITE);
+}
+
+// Interrupt line polls only sample a pin, tracing them would bury everything else.
+static int trace_bus_irq_pending(void) {
+  return inner->irq_pending();
+}
+
+static int trace_bus_irq_line(void) {
+  return inner->irq_line();
+}
+
+static unsigned int trace_bus_wait_spins(void) {
+  return inner_spins();
+}
+
+static void flush_rings(void) {
+  int count = atomic_load_explicit(&num_rings, memory_order_acquire);
+
+  for (int i = 0; i < count; i++) {
+    struct trace_ring *r = &rings[i];
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    while (tail != head) {
+      // Write up to the end of the ring in one go, wrapping around on the next pass.
+      unsigned int start = tail & TRACE_RING_MASK;
+      unsigned int n = head - tail;
+      if (n > TRACE_RING_SIZE - start)
+        n = TRACE_RING_SIZE - start;
+      if (fwrite(&r->records[start], sizeof(struct bus_trace_record), n, trace_file) != n) {
+        printf("[BUS] Failed to write to trace file %s, tracing stopped.\n", trace_filename);
+        fclose(trace_file);
+        trace_file = NULL;
+        return;
+      }
+      records_written += n;
+      tail += n;
+      atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+  }
+}
+
+static void *flush_thread_main(void *args) {
+  (void)args;
+
+  while (atomic_load_explicit(&flush_running, memory_order_relaxed) && trace_file) {
+    flush_rings();
+    usleep(1000);
+  }
+
+  return NULL;
+}
+
+static void trace_bus_print_stats(void) {
+  uint64_t dropped = 0;
+
+  for (int i = 0; i < atomic_load(&num_rings); i++)
+    dropped += rings[i].dropped;
+  printf("[BUS] Bus trace: %llu transactions written to %s, %llu dropped on full trace buffers.\n",
+         (unsigned long long)records_written, trace_filename, (unsigned long long)dropped);
+  if (inner->print_stats)
+    inner->print_stats();
+}
+
+static void trace_bus_shutdown(void) {
+  atomic_store(&flush_running, 0);
+  pthread_join(flush_thread, NULL);
+  if (trace_file) {
+    flush_rings();
+    if (trace_file)
+      fclose(trace_file);
+    trace_file = NULL;
+  }
+  bus = inner;
+  inner->shutdown();
+}
+
+static int trace_bus_setup(struct emulator_config *cfg, char *options) {
+  return inner->setup(cfg, options);
+}
+
+static struct bus_backend trace_bus_backend = {
+  .name = "trace",
+  .setup = trace_bus_setup,
+  .shutdown = trace_bus_shutdown,
+  .read8 = trace_bus_read8,
+  .read16 = trace_bus_read16,
+  .write8 = trace_bus_write8,
+  .write16 = trace_bus_write16,
+  .read_reg = trace_bus_read_reg,
+  .write_reg = trace_bus_write_reg,
+  .irq_pending = trace_bus_irq_pending,
+  .irq_line = trace_bus_irq_line,
+  .print_stats = trace_bus_print_stats,
+  .wait_spins = trace_bus_wait_spins,
+};
+
+// Trace the transactions of the already set up backend into filename.
+// Has to be started before the bus thread, so the writes it runs are traced on it.
+int bus_start_trace(char *filename) {
+  struct bus_trace_header header;
+  int err;
+
+  rings = (struct trace_ring *)calloc(TRACE_MAX_THREADS, sizeof(struct trace_ring));
+  if (!rings) {
+    printf("[BUS] Failed to allocate bus trace buffers.\n");
+    return -1;
+  }
+
+  trace_file = fopen(filename, "wb");
+  if (!trace_file) {
+    printf("[BUS] Failed to open trace file %s.\n", filename);
+    free(rings);
+    rings = NULL;
+    return -1;
+  }
+
+  memset(&header, 0x00, sizeof(header));
+  memcpy(header.magic, BUS_TRACE_MAGIC, sizeof(header.magic));
+  header.version = BUS_TRACE_VERSION;
+  header.record_size = sizeof(struct bus_trace_record);
+  fwrite(&header, sizeof(header), 1, trace_file);
+
+  inner = bus;
+  inner_spins = inner->wait_spins ? inner->wait_spins : no_spins;
+  trace_filename = filename;
+  trace_start_ns = get_time_ns();
+  atomic_store(&flush_running, 1);
+
+  err = pthread_create(&flush_thread, NULL, flush_thread_main, NULL);
+  if (err != 0) {
+    printf("[BUS] Failed to create trace flush thread: %s\n", strerror(err));
+    fclose(trace_file);
+    trace_file = NULL;
+    free(rings);
+    rings = NULL;
+    return -1;
+  }
+  pthread_setname_np(flush_thread, "bustrace");
+
+  printf("[BUS] Tracing bus transactions to %s.\n", filename);
+  bus = &trace_bus_backend;
+  return 0;
+}
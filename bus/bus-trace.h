@@ -0,0 +1,33 @@
+#ifndef BUS_TRACE_HEADER
+#define BUS_TRACE_HEADER
+
+#include <stdint.h>
+
+// Bus trace file layout, shared by the tracer and tools/bustrace.c.
+// A header followed by fixed size records. Records are written in per-thread
+// batches, so they are only in time order within one thread.
+
+#define BUS_TRACE_MAGIC "PSBTRACE"
+#define BUS_TRACE_VERSION 1
+
+#define BUS_TRACE_WRITE 0x01  // Otherwise a read
+#define BUS_TRACE_REG 0x02    // CPLD status register access, address is 0
+#define BUS_TRACE_THREAD_SHIFT 4
+
+struct bus_trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+struct bus_trace_record {
+  uint64_t time_ns;      // Start of the transaction, since the trace was started
+  uint32_t address;
+  uint32_t value;
+  uint32_t duration_ns;
+  uint16_t wait_spins;   // Status polls spent waiting on the CPLD
+  uint8_t size;          // 1 or 2 bytes
+  uint8_t flags;         // BUS_TRACE_* and the tracing thread in the upper nibble
+};
+
+#endif /* BUS_TRACE_HEADER */
@@ -0,0 +1,32 @@
+#include "bus.h"
+#include <stdio.h>
+#include <string.h>
+
+extern struct bus_backend gpio_bus_backend;
+extern struct bus_backend sim_bus_backend;
+
+static struct bus_backend *bus_backends[] = {
+  &gpio_bus_backend,
+  &sim_bus_backend,
+};
+
+#define NUM_BUS_BACKENDS (int)(sizeof(bus_backends) / sizeof(bus_backends[0]))
+
+struct bus_backend *bus = &gpio_bus_backend;
+
+struct bus_backend *get_bus_backend(char *name) {
+  if (!name || strlen(name) == 0)
+    return NULL;
+
+  for (int i = 0; i < NUM_BUS_BACKENDS; i++) {
+    if (strcmp(name, bus_backends[i]->name) == 0)
+      return bus_backends[i];
+  }
+
+  printf("No bus backend named \'%s\'. Available backends:", name);
+  for (int i = 0; i < NUM_BUS_BACKENDS; i++)
+    printf(" %s", bus_backends[i]->name);
+  printf("\n");
+
+  return NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef BUS_HEADER
+#define BUS_HEADER
+
+#include <stdint.h>
+
+struct emulator_config;
+
+// Everything that goes out to the Amiga goes through one of these.
+// "gpio" drives the CPLD through the Pi GPIO pins, "sim" runs the same pin
+// protocol against a software model of the CPLD and an Amiga address space,
+// so bus-heavy code can be run and measured without a PiStorm.
+struct bus_backend {
+  char *name;
+
+  int (*setup)(struct emulator_config *cfg, char *options);
+  void (*shutdown)(void);
+
+  uint32_t (*read8)(uint32_t address);
+  uint32_t (*read16)(uint32_t address);
+  void (*write8)(uint32_t address, uint32_t data);
+  void (*write16)(uint32_t address, uint32_t data);
+
+  uint16_t (*read_reg)(void);
+  void (*write_reg)(unsigned int value);
+  // Nonzero while the CPLD signals an interrupt (GPIO1 low).
+  int (*irq_pending)(void);
+  // Same as irq_pending, but only samples the pin, without waiting for earlier
+  // writes. Safe to call from another thread while transactions are running.
+  int (*irq_line)(void);
+
+  // Optional, NULL if the backend keeps no statistics.
+  void (*print_stats)(void);
+  // Optional, running count of status polls spent waiting for transactions to finish.
+  unsigned int (*wait_spins)(void);
+};
+
+extern struct bus_backend *bus;
+
+// bus->read16 with the same statistics accounting as the CPU's own bus accesses,
+// for reads made on its behalf elsewhere, like filling and verifying shadow pages.
+uint32_t bus_read16(uint32_t address);
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+struct bus_backend *get_bus_backend(char *name);
+int bus_start_thread(int cpu);
+int bus_start_trace(char *filename);
+
+#endif /* BUS_HEADER */
@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../config_file/config_file.h"
+#include "bus.h"
+
+//#define BCM2708_PERI_BASE        0x20000000  //pi0-1
+//#define BCM2708_PERI_BASE	0xFE000000     //pi4
+#define BCM2708_PERI_BASE 0x3F000000  // pi3
+#define BCM2708_PERI_SIZE 0x01000000
+#define GPIO_BASE (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
+#define GPCLK_BASE (BCM2708_PERI_BASE + 0x101000)
+#define GPIO_ADDR 0x200000 /* GPIO controller */
+#define GPCLK_ADDR 0x101000
+#define CLK_PASSWD 0x5a000000
+#define CLK_GP0_CTL 0x070
+#define CLK_GP0_DIV 0x074
+
+// I/O access
+static volatile unsigned int *gpio;
+static volatile unsigned int *gpclk;
+static void *gpio_map;
+
+#define GPIO_WRITE(reg, value) (*(gpio + (reg)) = (value))
+#define GPIO_READ(reg) (*(gpio + (reg)))
+
+#include "pistorm-protocol.h"
+
+#define SET_GPIO_ALT(g, a)  \
+  *(gpio + (((g) / 10))) |= \
+      (((a) <= 3 ? (a) + 4 : (a) == 4 ? 3 : 2) << (((g) % 10) * 3))
+
+//
+// Set up a memory regions to access GPIO
+//
+static void setup_io() {
+  int mem_fd;
+
+  /* open /dev/mem */
+  if ((mem_fd = open("/dev/mem", O_RDWR | O_SYNC)) < 0) {
+    printf("can't open /dev/mem \n");
+    exit(-1);
+  }
+
+  /* mmap GPIO */
+  gpio_map = mmap(
+      NULL,                    // Any adddress in our space will do
+      BCM2708_PERI_SIZE,       // Map length
+      PROT_READ | PROT_WRITE,  // Enable reading & writting to mapped memory
+      MAP_SHARED,              // Shared with other processes
+      mem_fd,                  // File to map
+      BCM2708_PERI_BASE        // Offset to GPIO peripheral
+  );
+
+  close(mem_fd);  // No need to keep mem_fd open after mmap
+
+  if (gpio_map == MAP_FAILED) {
+    printf("gpio mmap error %p\n", gpio_map);  // errno also set!
+    exit(-1);
+  }
+
+  gpio = ((volatile unsigned *)gpio_map) + GPIO_ADDR / 4;
+  gpclk = ((volatile unsigned *)gpio_map) + GPCLK_ADDR / 4;
+
+}  // setup_io
+
+static int gpio_bus_setup(struct emulator_config *cfg, char *options) {
+  (void)options;
+
+  setup_io();
+
+  // Enable 200MHz CLK output on GPIO4, adjust divider and pll source depending
+  // on pi model
+  printf("Enable 200MHz GPCLK0 on GPIO4\n");
+
+  *(gpclk + (CLK_GP0_CTL / 4)) = CLK_PASSWD | (1 << 5);
+  usleep(10);
+  while ((*(gpclk + (CLK_GP0_CTL / 4))) & (1 << 7))
+    ;
+  usleep(100);
+  *(gpclk + (CLK_GP0_DIV / 4)) =
+      CLK_PASSWD | (6 << 12);  // divider , 6=200MHz on pi3
+  usleep(10);
+  *(gpclk + (CLK_GP0_CTL / 4)) =
+      CLK_PASSWD | 5 | (1 << 4);  // pll? 6=plld, 5=pllc
+  usleep(10);
+  while (((*(gpclk + (CLK_GP0_CTL / 4))) & (1 << 7)) == 0)
+    ;
+  usleep(100);
+
+  SET_GPIO_ALT(4, 0);  // gpclk0
+
+  pistorm_setup_pins();
+  posted_writes = cfg->posted_writes;
+
+  return 0;
+}
+
+static void gpio_bus_shutdown(void) {
+  if (gpio_map && gpio_map != MAP_FAILED) {
+    pistorm_wait_write();
+    munmap(gpio_map, BCM2708_PERI_SIZE);
+  }
+  gpio_map = NULL;
+}
+
+struct bus_backend gpio_bus_backend = {
+  .name = "gpio",
+  .setup = gpio_bus_setup,
+  .shutdown = gpio_bus_shutdown,
+  .read8 = pistorm_read8,
+  .read16 = pistorm_read16,
+  .write8 = pistorm_write8,
+  .write16 = pistorm_write16,
+  .read_reg = pistorm_read_reg,
+  .write_reg = pistorm_write_reg,
+  .irq_pending = pistorm_irq_pending,
+  .irq_line = pistorm_irq_line,
+  .print_stats = NULL,
+  .wait_spins = pistorm_get_wait_spins,
+};
@@ -0,0 +1,312 @@
+// PiStorm CPLD bus protocol, as seen from the Pi GPIO pins.
+//
+// Included by the bus backends that speak it. The including file defines
+// GPIO_WRITE(reg, value) and GPIO_READ(reg) for its register accesses, with
+// reg being a 32-bit word index into the BCM283x GPIO register block.
+
+#ifndef PISTORM_PROTOCOL_HEADER
+#define PISTORM_PROTOCOL_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define GPFSEL0 0
+#define GPSET0 7
+#define GPCLR0 10
+#define GPLEV0 13
+
+// GPIO0 is the transaction status from the CPLD, GPIO1 is low while IPL is non-zero.
+#define PIN_TXN 0
+#define PIN_IPL 1
+// Read and write strobes, data/address on GPIO8-23, command on SA0-SA2.
+#define PIN_RD 6
+#define PIN_WR 7
+#define SA0 5
+#define SA1 3
+#define SA2 2
+
+// Command numbers as decoded by the CPLD, SA2:SA1:SA0.
+#define PISTORM_CMD_W16 0
+#define PISTORM_CMD_R16 1
+#define PISTORM_CMD_W8 2
+#define PISTORM_CMD_R8 3
+#define PISTORM_CMD_STATUS 4
+
+#define GPIO_SET(mask) GPIO_WRITE(GPSET0, mask)
+#define GPIO_CLR(mask) GPIO_WRITE(GPCLR0, mask)
+#define GET_GPIO(g) (GPIO_READ(GPLEV0) & (1 << (g)))  // 0 if LOW, (1<<g) if HIGH
+
+// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x)
+#define INP_GPIO(g) GPIO_WRITE((g) / 10, GPIO_READ((g) / 10) & ~(7 << (((g) % 10) * 3)))
+#define OUT_GPIO(g) GPIO_WRITE((g) / 10, GPIO_READ((g) / 10) | (1 << (((g) % 10) * 3)))
+
+// GPIO set and clear words putting each command on SA0-SA2, SA2:SA1:SA0 being the command number.
+#define PISTORM_CMD_SET(c) ((((c) & 1) << SA0) | ((((c) >> 1) & 1) << SA1) | ((((c) >> 2) & 1) << SA2))
+#define PISTORM_CMD_CLR(c) (PISTORM_CMD_SET(7) & ~PISTORM_CMD_SET(c))
+
+static const uint32_t cmd_set[PISTORM_CMD_STATUS + 1] = {
+  PISTORM_CMD_SET(PISTORM_CMD_W16),
+  PISTORM_CMD_SET(PISTORM_CMD_R16),
+  PISTORM_CMD_SET(PISTORM_CMD_W8),
+  PISTORM_CMD_SET(PISTORM_CMD_R8),
+  PISTORM_CMD_SET(PISTORM_CMD_STATUS),
+};
+
+static const uint32_t cmd_clr[PISTORM_CMD_STATUS + 1] = {
+  PISTORM_CMD_CLR(PISTORM_CMD_W16),
+  PISTORM_CMD_CLR(PISTORM_CMD_R16),
+  PISTORM_CMD_CLR(PISTORM_CMD_W8),
+  PISTORM_CMD_CLR(PISTORM_CMD_R8),
+  PISTORM_CMD_CLR(PISTORM_CMD_STATUS),
+};
+
+// Multiplier copying a byte to the data lane(s) write8 drives: both for UDS (A0=0), low for LDS.
+static const uint16_t byte_lanes[2] = { 0x0101, 0x0001 };
+
+// GPIO function select values with GPIO8-23 as inputs and as outputs.
+static unsigned int gpfsel0, gpfsel1, gpfsel2;
+static unsigned int gpfsel0_o, gpfsel1_o, gpfsel2_o;
+
+// What the pins were last set to, so transactions only touch what changes.
+// The CPLD only drives GPIO8-23 while the read strobe is low, so the Pi may
+// keep driving them between transactions. Reads switch to input first.
+static unsigned int cur_cmd;
+static unsigned char bus_driven;
+
+// With posted writes a write returns as soon as the data is strobed into the
+// CPLD, and the next transaction waits for that Amiga bus cycle to finish
+// first. The CPLD only ever has one cycle in flight, so ordering is unchanged.
+static int posted_writes;
+static int write_pending;
+
+// Polls of the transaction status pin spent waiting on the CPLD, for the bus tracer.
+static unsigned int pistorm_wait_spins;
+
+static inline void pistorm_wait_write(void) {
+  if (write_pending) {
+    while ((GET_GPIO(PIN_TXN)))
+      pistorm_wait_spins++;
+    write_pending = 0;
+  }
+}
+
+static inline void pistorm_finish_write(void) {
+  if (posted_writes) {
+    write_pending = 1;
+    return;
+  }
+  while ((GET_GPIO(PIN_TXN)))
+    pistorm_wait_spins++;
+}
+
+static inline void pistorm_command(unsigned int cmd) {
+  if (cmd == cur_cmd)
+    return;
+  if (cmd_set[cmd])
+    GPIO_WRITE(GPSET0, cmd_set[cmd]);
+  GPIO_WRITE(GPCLR0, cmd_clr[cmd]);
+  cur_cmd = cmd;
+}
+
+static inline void pistorm_bus_output(void) {
+  if (bus_driven)
+    return;
+  bus_driven = 1;
+  GPIO_WRITE(GPFSEL0, gpfsel0_o);
+  GPIO_WRITE(GPFSEL0 + 1, gpfsel1_o);
+  GPIO_WRITE(GPFSEL0 + 2, gpfsel2_o);
+}
+
+static inline void pistorm_bus_input(void) {
+  if (!bus_driven)
+    return;
+  bus_driven = 0;
+  GPIO_WRITE(GPFSEL0, gpfsel0);
+  GPIO_WRITE(GPFSEL0 + 1, gpfsel1);
+  GPIO_WRITE(GPFSEL0 + 2, gpfsel2);
+}
+
+// Strobe one 16-bit value over GPIO8-23 into the CPLD.
+static inline void pistorm_strobe(uint32_t value) {
+  GPIO_WRITE(GPSET0, (value & 0x0000ffff) << 8);
+  GPIO_WRITE(GPCLR0, (~value & 0x0000ffff) << 8);
+  GPIO_CLR(1 << PIN_WR);
+  GPIO_SET(1 << PIN_WR);
+}
+
+static void pistorm_setup_pins(void) {
+  int g;
+
+  // set SA to output
+  INP_GPIO(2);
+  OUT_GPIO(2);
+  INP_GPIO(3);
+  OUT_GPIO(3);
+  INP_GPIO(5);
+  OUT_GPIO(5);
+
+  // set gpio0 (aux0) and gpio1 (aux1) to input
+  INP_GPIO(0);
+  INP_GPIO(1);
+
+  // Set GPIO pins 6,7 and 8-23 to output
+  for (g = 6; g <= 23; g++) {
+    INP_GPIO(g);
+    OUT_GPIO(g);
+  }
+  printf("Precalculate GPIO8-23 as Output\n");
+  gpfsel0_o = GPIO_READ(GPFSEL0);  // store gpio ddr
+  printf("gpfsel0: %#x\n", gpfsel0_o);
+  gpfsel1_o = GPIO_READ(GPFSEL0 + 1);  // store gpio ddr
+  printf("gpfsel1: %#x\n", gpfsel1_o);
+  gpfsel2_o = GPIO_READ(GPFSEL0 + 2);  // store gpio ddr
+  printf("gpfsel2: %#x\n", gpfsel2_o);
+
+  // Set GPIO pins 8-23 to input
+  for (g = 8; g <= 23; g++) {
+    INP_GPIO(g);
+  }
+  printf("Precalculate GPIO8-23 as Input\n");
+  gpfsel0 = GPIO_READ(GPFSEL0);  // store gpio ddr
+  printf("gpfsel0: %#x\n", gpfsel0);
+  gpfsel1 = GPIO_READ(GPFSEL0 + 1);  // store gpio ddr
+  printf("gpfsel1: %#x\n", gpfsel1);
+  gpfsel2 = GPIO_READ(GPFSEL0 + 2);  // store gpio ddr
+  printf("gpfsel2: %#x\n", gpfsel2);
+
+  GPIO_CLR(1 << SA2);
+  GPIO_CLR(1 << SA1);
+  GPIO_SET(1 << SA0);
+  cur_cmd = PISTORM_CMD_R16;
+  bus_driven = 0;
+
+  GPIO_SET(1 << PIN_RD);
+  GPIO_SET(1 << PIN_WR);
+}
+
+// There are no longword transactions. The CPLD latches a full address for
+// every word through a fixed strobe sequence and the data pins carry both the
+// address and the data, so a longword is always two word transactions. The
+// command pins and the bus direction are already cached across calls, running
+// the two words back to back would not save a single GPIO write.
+static void pistorm_write16(uint32_t address, uint32_t data) {
+  pistorm_wait_write();
+  pistorm_command(PISTORM_CMD_W16);
+  pistorm_bus_output();
+
+  pistorm_strobe(address & 0xffff);
+  pistorm_strobe(address >> 16);
+
+  // write phase
+  pistorm_strobe(data);
+
+  pistorm_finish_write();
+}
+
+static void pistorm_write8(uint32_t address, uint32_t data) {
+  pistorm_wait_write();
+  data = (data & 0xff) * byte_lanes[address & 1];
+
+  pistorm_command(PISTORM_CMD_W8);
+  pistorm_bus_output();
+
+  pistorm_strobe(address & 0xffff);
+  pistorm_strobe(address >> 16);
+
+  // write phase
+  pistorm_strobe(data);
+
+  pistorm_finish_write();
+}
+
+static uint32_t pistorm_read16(uint32_t address) {
+  uint32_t val;
+
+  pistorm_wait_write();
+  pistorm_command(PISTORM_CMD_R16);
+  pistorm_bus_output();
+
+  pistorm_strobe(address & 0xffff);
+  pistorm_strobe(address >> 16);
+
+  // read phase
+  pistorm_bus_input();
+  GPIO_CLR(1 << PIN_RD);
+  while (!(GET_GPIO(PIN_TXN)))
+    pistorm_wait_spins++;
+  GPIO_CLR(1 << PIN_RD);
+  val = GPIO_READ(GPLEV0);
+  GPIO_SET(1 << PIN_RD);
+
+  return (val >> 8) & 0xffff;
+}
+
+static uint32_t pistorm_read8(uint32_t address) {
+  uint32_t val;
+
+  pistorm_wait_write();
+  pistorm_command(PISTORM_CMD_R8);
+  pistorm_bus_output();
+
+  pistorm_strobe(address & 0xffff);
+  pistorm_strobe(address >> 16);
+
+  // read phase
+  pistorm_bus_input();
+  GPIO_CLR(1 << PIN_RD);
+  while (!(GET_GPIO(PIN_TXN)))
+    pistorm_wait_spins++;
+  GPIO_CLR(1 << PIN_RD);
+  val = GPIO_READ(GPLEV0);
+  GPIO_SET(1 << PIN_RD);
+
+  // EVEN, A0=0,UDS on GPIO16-23, ODD, A0=1,LDS on GPIO8-15
+  return (val >> (8 + ((~address & 1) << 3))) & 0xff;
+}
+
+static void pistorm_write_reg(unsigned int value) {
+  pistorm_wait_write();
+  pistorm_command(PISTORM_CMD_STATUS);
+  pistorm_bus_output();
+  GPIO_WRITE(GPSET0, (value & 0xffff) << 8);
+  GPIO_WRITE(GPCLR0, (~value & 0xffff) << 8);
+  GPIO_CLR(1 << PIN_WR);
+  GPIO_CLR(1 << PIN_WR);  // delay
+  GPIO_SET(1 << PIN_WR);
+  GPIO_SET(1 << PIN_WR);
+}
+
+static uint16_t pistorm_read_reg(void) {
+  uint32_t val;
+
+  pistorm_wait_write();
+  pistorm_command(PISTORM_CMD_STATUS);
+  // Bus HIGH-Z
+  pistorm_bus_input();
+  GPIO_CLR(1 << PIN_RD);
+  GPIO_CLR(1 << PIN_RD);  // delay
+  GPIO_CLR(1 << PIN_RD);
+  GPIO_CLR(1 << PIN_RD);
+  val = GPIO_READ(GPLEV0);
+  GPIO_SET(1 << PIN_RD);
+
+  return (uint16_t)(val >> 8);
+}
+
+// Only samples the pin, safe to call from another thread.
+static int pistorm_irq_line(void) {
+  return GET_GPIO(PIN_IPL) == 0;
+}
+
+// A posted write, such as an INTREQ acknowledge, has to reach the Amiga
+// before the IPL state means anything.
+static int pistorm_irq_pending(void) {
+  pistorm_wait_write();
+  return pistorm_irq_line();
+}
+
+static unsigned int pistorm_get_wait_spins(void) {
+  return pistorm_wait_spins;
+}
+
+#endif /* PISTORM_PROTOCOL_HEADER */
@@ -0,0 +1,673 @@
+// Simulated PiStorm bus. The GPIO register accesses of the real protocol are
+// fed into a model of the CPLD state machine, which runs the transactions
+// against a small Amiga: Chip/Slow RAM, Kickstart ROM, the interrupt and beam
+// counter custom registers and CIA port/DDR registers.
+//
+// Time only advances with GPIO accesses and Amiga bus cycles, so the clock is
+// modelled bus time, not wall time. Every GPIO access costs a configurable
+// number of nanoseconds and every Amiga access a configurable number of
+// 7MHz clocks, polling loops spin until the modelled access is done.
+//
+// Options, appended to "bus sim" in the config file:
+//   chipram=<size>    Chip RAM at 0x0, up to 2MB (default 2M)
+//   slowram=<size>    Slow RAM at 0xC00000, up to 1.5MB (default 0)
+//   rom=<file>        Kickstart image at 0xF80000, also at 0x0 while OVL is set
+//   gpiowrite=<ns>    Cost of a GPIO register write (default 15)
+//   gpioread=<ns>     Cost of a GPIO register read (default 60)
+//   buscycles=<n>     7MHz clocks per Chip/Slow RAM, ROM and custom access (default 4)
+//   ciacycles=<n>     7MHz clocks per CIA access, E clock sync included (default 12)
+//   hosttime=1        Also advance the clock by the host time spent between
+//                     transactions, so emulation overlapping a posted write shows up
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../config_file/config_file.h"
+#include "bus.h"
+
+static inline void sim_gpio_write(unsigned int reg, uint32_t value);
+static inline uint32_t sim_gpio_read(unsigned int reg);
+
+#define GPIO_WRITE(reg, value) sim_gpio_write(reg, value)
+#define GPIO_READ(reg) sim_gpio_read(reg)
+
+#include "pistorm-protocol.h"
+
+#define AMIGA_CLOCK_PS 140968ULL  // PAL 7.09379MHz
+#define COLOR_CLOCKS_PER_LINE 227
+#define LINES_PER_FRAME 313
+
+#define CHIPRAM_MAX (2 * SIZE_MEGA)
+#define SLOWRAM_BASE 0xC00000
+#define SLOWRAM_MAX 0x180000
+#define ROM_BASE 0xF80000
+#define ROM_SIZE 0x80000
+
+enum sim_regions {
+  SIM_REGION_CHIP,
+  SIM_REGION_SLOW,
+  SIM_REGION_ROM,
+  SIM_REGION_CUSTOM,
+  SIM_REGION_CIA,
+  SIM_REGION_OTHER,
+  SIM_REGION_NUM,
+};
+
+static const char *sim_region_names[SIM_REGION_NUM] = {
+  "Chip RAM",
+  "Slow RAM",
+  "ROM",
+  "Custom",
+  "CIA",
+  "Other",
+};
+
+enum sim_transactions {
+  SIM_TXN_READ8,
+  SIM_TXN_READ16,
+  SIM_TXN_WRITE8,
+  SIM_TXN_WRITE16,
+  SIM_TXN_READ_REG,
+  SIM_TXN_WRITE_REG,
+  SIM_TXN_IRQ_POLL,
+  SIM_TXN_NUM,
+};
+
+static const char *sim_txn_names[SIM_TXN_NUM] = {
+  "read8",
+  "read16",
+  "write8",
+  "write16",
+  "read_reg",
+  "write_reg",
+  "irq poll",
+};
+
+struct sim_txn_stats {
+  uint64_t count;
+  uint64_t gpio_writes;
+  uint64_t gpio_reads;
+  uint64_t time_ps;
+};
+
+struct sim_region_stats {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t clocks;
+};
+
+// Modelled time and GPIO access counts
+static uint64_t sim_now_ps, sim_gpio_writes, sim_gpio_reads;
+static uint64_t gpio_write_ps = 15000, gpio_read_ps = 60000;
+static unsigned int bus_cycles = 4, cia_cycles = 12;
+static int host_time;
+static uint64_t host_ps;
+static struct timespec last_txn_end;
+
+// CPLD state
+static uint32_t sim_fsel[6], sim_out;
+static unsigned char sim_phase, sim_read_pending;
+static uint32_t sim_address, sim_read_data;
+static uint64_t sim_busy_until_ps;
+static uint64_t sim_protocol_errors;
+
+// Amiga state
+static unsigned char *chip_ram, *slow_ram, *rom;
+static unsigned int chip_size = CHIPRAM_MAX, slow_size;
+static unsigned char ovl = 1, amiga_reset;
+static uint16_t custom_regs[256];
+static unsigned char cia_regs[2][16];
+static uint64_t last_frame;
+// GPIO1 as seen from other threads, updated whenever the model changes it.
+static atomic_int sim_irq_line;
+
+static struct sim_txn_stats txn_stats[SIM_TXN_NUM];
+static struct sim_region_stats region_stats[SIM_REGION_NUM];
+
+#define CUSTOM_DMACONR 0x002
+#define CUSTOM_VPOSR 0x004
+#define CUSTOM_VHPOSR 0x006
+#define CUSTOM_ADKCONR 0x010
+#define CUSTOM_INTENAR 0x01C
+#define CUSTOM_INTREQR 0x01E
+#define CUSTOM_DMACON 0x096
+#define CUSTOM_INTENA 0x09A
+#define CUSTOM_INTREQ 0x09C
+#define CUSTOM_ADKCON 0x09E
+
+#define CIA_PRA 0x0
+#define CIA_PRB 0x1
+#define CIA_DDRA 0x2
+#define CIA_DDRB 0x3
+#define CIA_ICR 0xD
+
+// Highest pending and enabled INTREQ bit to 68k interrupt level
+static const unsigned char paula_ipl[14] = { 1, 1, 1, 2, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6 };
+
+static unsigned int sim_ipl(void) {
+  uint16_t pending = custom_regs[CUSTOM_INTENAR >> 1] & custom_regs[CUSTOM_INTREQR >> 1] & 0x3FFF;
+
+  if (!(custom_regs[CUSTOM_INTENAR >> 1] & 0x4000) || !pending)
+    return 0;
+
+  return paula_ipl[31 - __builtin_clz(pending)];
+}
+
+static inline void sim_update_irq_line(void) {
+  atomic_store_explicit(&sim_irq_line, sim_ipl() != 0, memory_order_relaxed);
+}
+
+// Raise VERTB once per modelled frame.
+static void sim_update_beam(void) {
+  uint64_t frame = sim_now_ps / (AMIGA_CLOCK_PS * 2 * COLOR_CLOCKS_PER_LINE * LINES_PER_FRAME);
+
+  if (frame != last_frame) {
+    last_frame = frame;
+    custom_regs[CUSTOM_INTREQR >> 1] |= 0x0020;
+    sim_update_irq_line();
+  }
+}
+
+static uint16_t sim_beam_position(unsigned int reg) {
+  uint64_t color_clocks = sim_now_ps / (AMIGA_CLOCK_PS * 2);
+  unsigned int line = (color_clocks / COLOR_CLOCKS_PER_LINE) % LINES_PER_FRAME;
+  unsigned int hpos = color_clocks % COLOR_CLOCKS_PER_LINE;
+
+  if (reg == CUSTOM_VPOSR)
+    return line >> 8;
+  return ((line & 0xFF) << 8) | (hpos >> 1);
+}
+
+static void sim_reset_amiga(void) {
+  ovl = 1;
+  memset(custom_regs, 0x00, sizeof(custom_regs));
+  memset(cia_regs, 0x00, sizeof(cia_regs));
+  sim_update_irq_line();
+}
+
+static int sim_get_region(uint32_t address) {
+  if (address < 0x200000) {
+    if (ovl && rom && address < ROM_SIZE)
+      return SIM_REGION_ROM;
+    return (address < chip_size) ? SIM_REGION_CHIP : SIM_REGION_OTHER;
+  }
+  if (address >= 0xA00000 && address < 0xC00000)
+    return SIM_REGION_CIA;
+  if (address >= SLOWRAM_BASE && address < SLOWRAM_BASE + slow_size)
+    return SIM_REGION_SLOW;
+  if (address >= 0xDFF000 && address < 0xE00000)
+    return SIM_REGION_CUSTOM;
+  if (address >= ROM_BASE && rom)
+    return SIM_REGION_ROM;
+  return SIM_REGION_OTHER;
+}
+
+static unsigned char sim_cia_read(int cia, unsigned int reg) {
+  unsigned char *regs = cia_regs[cia];
+  unsigned char value = regs[reg];
+
+  switch (reg) {
+    case CIA_PRA:
+      return (value & regs[CIA_DDRA]) | ~regs[CIA_DDRA];
+    case CIA_PRB:
+      return (value & regs[CIA_DDRB]) | ~regs[CIA_DDRB];
+    case CIA_ICR:
+      regs[CIA_ICR] = 0;
+      return value;
+    default:
+      return value;
+  }
+}
+
+static void sim_cia_write(int cia, unsigned int reg, unsigned char value) {
+  if (reg == CIA_ICR)
+    return;
+
+  cia_regs[cia][reg] = value;
+
+  // CIA-A PA0 is OVL, pulled up while it is an input.
+  if (cia == 0 && (reg == CIA_PRA || reg == CIA_DDRA))
+    ovl = !(cia_regs[0][CIA_DDRA] & 0x01) || (cia_regs[0][CIA_PRA] & 0x01);
+}
+
+static uint16_t sim_custom_read(unsigned int reg) {
+  switch (reg) {
+    case CUSTOM_VPOSR:
+    case CUSTOM_VHPOSR:
+      return sim_beam_position(reg);
+    default:
+      return custom_regs[reg >> 1];
+  }
+}
+
+static void sim_custom_write(unsigned int reg, uint16_t value) {
+  unsigned int set_clr = 0;
+
+  switch (reg) {
+    case CUSTOM_DMACON: set_clr = CUSTOM_DMACONR; break;
+    case CUSTOM_INTENA: set_clr = CUSTOM_INTENAR; break;
+    case CUSTOM_INTREQ: set_clr = CUSTOM_INTREQR; break;
+    case CUSTOM_ADKCON: set_clr = CUSTOM_ADKCONR; break;
+    default:
+      custom_regs[reg >> 1] = value;
+      return;
+  }
+
+  if (value & 0x8000)
+    custom_regs[set_clr >> 1] |= value & 0x7FFF;
+  else
+    custom_regs[set_clr >> 1] &= ~value;
+  if (set_clr == CUSTOM_INTENAR || set_clr == CUSTOM_INTREQR)
+    sim_update_irq_line();
+}
+
+// One Amiga bus cycle, always a full word. mask selects the byte lanes written.
+static uint16_t sim_amiga_access(uint32_t address, uint16_t value, uint16_t mask, int write) {
+  int region = sim_get_region(address & 0xFFFFFF);
+  unsigned int clocks = (region == SIM_REGION_CIA) ? cia_cycles : bus_cycles;
+  unsigned char *mem = NULL;
+  uint32_t offset = 0;
+  uint16_t data = 0;
+
+  address &= 0xFFFFFE;
+
+  if (write)
+    region_stats[region].writes++;
+  else
+    region_stats[region].reads++;
+  region_stats[region].clocks += clocks;
+  sim_busy_until_ps = sim_now_ps + clocks * AMIGA_CLOCK_PS;
+
+  switch (region) {
+    case SIM_REGION_CHIP: mem = chip_ram; offset = address; break;
+    case SIM_REGION_SLOW: mem = slow_ram; offset = address - SLOWRAM_BASE; break;
+    case SIM_REGION_ROM:
+      if (write)
+        return 0;
+      mem = rom;
+      offset = address & (ROM_SIZE - 1);
+      break;
+    case SIM_REGION_CUSTOM:
+      if (write) {
+        sim_custom_write(address & 0x1FE, (value & mask) | (custom_regs[(address & 0x1FE) >> 1] & ~mask));
+        return 0;
+      }
+      return sim_custom_read(address & 0x1FE);
+    case SIM_REGION_CIA: {
+      unsigned int reg = (address >> 8) & 0xF;
+      // CIA-A is selected by A12 low and sits on the low byte, CIA-B by A13 low on the high byte.
+      if (write) {
+        if (!(address & 0x1000) && (mask & 0x00FF))
+          sim_cia_write(0, reg, value & 0xFF);
+        if (!(address & 0x2000) && (mask & 0xFF00))
+          sim_cia_write(1, reg, value >> 8);
+        return 0;
+      }
+      data = 0xFFFF;
+      if (!(address & 0x1000))
+        data = (data & 0xFF00) | sim_cia_read(0, reg);
+      if (!(address & 0x2000))
+        data = (data & 0x00FF) | (sim_cia_read(1, reg) << 8);
+      return data;
+    }
+    default:
+      return 0xFFFF;
+  }
+
+  if (write) {
+    if (mask & 0xFF00)
+      mem[offset] = value >> 8;
+    if (mask & 0x00FF)
+      mem[offset + 1] = value & 0xFF;
+    return 0;
+  }
+  return (mem[offset] << 8) | mem[offset + 1];
+}
+
+static void sim_status_write(uint16_t value) {
+  // Bit 0 resets the CPLD state machine, bit 1 low holds the Amiga in reset.
+  if (value & 0x01) {
+    sim_phase = 0;
+    sim_read_pending = 0;
+    sim_busy_until_ps = sim_now_ps;
+  }
+  if (!(value & 0x02)) {
+    if (!amiga_reset)
+      sim_reset_amiga();
+    amiga_reset = 1;
+  } else {
+    amiga_reset = 0;
+  }
+}
+
+static inline unsigned int sim_command(uint32_t pins) {
+  return (((pins >> SA2) & 1) << 2) | (((pins >> SA1) & 1) << 1) | ((pins >> SA0) & 1);
+}
+
+// A value was strobed into the CPLD with a rising edge on the write strobe.
+static void sim_strobe(unsigned int cmd, uint16_t value) {
+  if (sim_now_ps < sim_busy_until_ps) {
+    // The real CPLD would lose this, stall the model so it stays consistent.
+    sim_protocol_errors++;
+    sim_now_ps = sim_busy_until_ps;
+  }
+
+  if (cmd == PISTORM_CMD_STATUS) {
+    sim_status_write(value);
+    return;
+  }
+  if (cmd > PISTORM_CMD_R8)
+    return;
+
+  switch (sim_phase) {
+    case 0:
+      sim_address = value;
+      sim_phase = 1;
+      break;
+    case 1:
+      sim_address |= (uint32_t)value << 16;
+      if (cmd == PISTORM_CMD_R16 || cmd == PISTORM_CMD_R8) {
+        sim_read_data = sim_amiga_access(sim_address, 0, 0xFFFF, 0);
+        sim_read_pending = 1;
+        sim_phase = 0;
+      } else {
+        sim_phase = 2;
+      }
+      break;
+    case 2: {
+      uint16_t mask = 0xFFFF;
+      if (cmd == PISTORM_CMD_W8)
+        mask = (sim_address & 1) ? 0x00FF : 0xFF00;
+      sim_amiga_access(sim_address, value, mask, 1);
+      sim_phase = 0;
+      break;
+    }
+  }
+}
+
+static void sim_pins_changed(uint32_t old, uint32_t pins) {
+  unsigned int cmd = sim_command(pins);
+
+  if (cmd != sim_command(old)) {
+    sim_phase = 0;
+    sim_read_pending = 0;
+  }
+  if (!(old & (1 << PIN_WR)) && (pins & (1 << PIN_WR)))
+    sim_strobe(cmd, (pins >> 8) & 0xFFFF);
+  if (!(old & (1 << PIN_RD)) && (pins & (1 << PIN_RD)) && sim_now_ps >= sim_busy_until_ps)
+    sim_read_pending = 0;
+}
+
+static inline void sim_gpio_write(unsigned int reg, uint32_t value) {
+  uint32_t old = sim_out;
+
+  sim_gpio_writes++;
+  sim_now_ps += gpio_write_ps;
+
+  switch (reg) {
+    case GPSET0:
+      sim_out |= value;
+      break;
+    case GPCLR0:
+      sim_out &= ~value;
+      break;
+    default:
+      if (reg < 6)
+        sim_fsel[reg] = value;
+      return;
+  }
+
+  sim_pins_changed(old, sim_out);
+}
+
+static inline uint32_t sim_gpio_read(unsigned int reg) {
+  uint32_t lev;
+  int done;
+
+  sim_gpio_reads++;
+  sim_now_ps += gpio_read_ps;
+
+  if (reg < 6)
+    return sim_fsel[reg];
+  if (reg != GPLEV0)
+    return 0;
+
+  sim_update_beam();
+  done = (sim_now_ps >= sim_busy_until_ps);
+
+  lev = sim_out & ((1 << SA0) | (1 << SA1) | (1 << SA2) | (1 << PIN_RD) | (1 << PIN_WR));
+  // GPIO0 is "data valid" while a read is pending, "busy" otherwise.
+  if (sim_read_pending ? done : !done)
+    lev |= 1 << PIN_TXN;
+  if (!sim_ipl())
+    lev |= 1 << PIN_IPL;
+
+  // GPIO8 function select decides which way the data bus is driven.
+  if ((sim_fsel[0] >> 24) & 7) {
+    lev |= sim_out & 0x00FFFF00;
+  } else if (!(sim_out & (1 << PIN_RD))) {
+    if (sim_command(sim_out) == PISTORM_CMD_STATUS)
+      lev |= (sim_ipl() << 13) << 8;
+    else if (sim_read_pending && done)
+      lev |= sim_read_data << 8;
+  }
+
+  return lev;
+}
+
+static void sim_add_host_time(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (last_txn_end.tv_sec) {
+    uint64_t ps = ((now.tv_sec - last_txn_end.tv_sec) * 1000000000ULL + now.tv_nsec - last_txn_end.tv_nsec) * 1000;
+    sim_now_ps += ps;
+    host_ps += ps;
+  }
+}
+
+#define SIM_TXN_BEGIN                                           \
+  if (host_time)                                                \
+    sim_add_host_time();                                        \
+  uint64_t start_ps = sim_now_ps, start_writes = sim_gpio_writes, start_reads = sim_gpio_reads;
+#define SIM_TXN_END(txn)                                        \
+  txn_stats[txn].count++;                                       \
+  txn_stats[txn].gpio_writes += sim_gpio_writes - start_writes; \
+  txn_stats[txn].gpio_reads += sim_gpio_reads - start_reads;    \
+  txn_stats[txn].time_ps += sim_now_ps - start_ps;              \
+  if (host_time)                                                \
+    clock_gettime(CLOCK_MONOTONIC, &last_txn_end);
+
+static uint32_t sim_bus_read8(uint32_t address) {
+  SIM_TXN_BEGIN
+  uint32_t value = pistorm_read8(address);
+  SIM_TXN_END(SIM_TXN_READ8)
+  return value;
+}
+
+static uint32_t sim_bus_read16(uint32_t address) {
+  SIM_TXN_BEGIN
+  uint32_t value = pistorm_read16(address);
+  SIM_TXN_END(SIM_TXN_READ16)
+  return value;
+}
+
+static void sim_bus_write8(uint32_t address, uint32_t data) {
+  SIM_TXN_BEGIN
+  pistorm_write8(address, data);
+  SIM_TXN_END(SIM_TXN_WRITE8)
+}
+
+static void sim_bus_write16(uint32_t address, uint32_t data) {
+  SIM_TXN_BEGIN
+  pistorm_write16(address, data);
+  SIM_TXN_END(SIM_TXN_WRITE16)
+}
+
+static uint16_t sim_bus_read_reg(void) {
+  SIM_TXN_BEGIN
+  uint16_t value = pistorm_read_reg();
+  SIM_TXN_END(SIM_TXN_READ_REG)
+  return value;
+}
+
+static void sim_bus_write_reg(unsigned int value) {
+  SIM_TXN_BEGIN
+  pistorm_write_reg(value);
+  SIM_TXN_END(SIM_TXN_WRITE_REG)
+}
+
+static int sim_bus_irq_pending(void) {
+  SIM_TXN_BEGIN
+  int pending = pistorm_irq_pending();
+  SIM_TXN_END(SIM_TXN_IRQ_POLL)
+  return pending;
+}
+
+// Called from the IPL thread, so this stays out of the model and its statistics.
+static int sim_bus_irq_line(void) {
+  return atomic_load_explicit(&sim_irq_line, memory_order_relaxed);
+}
+
+static void sim_bus_print_stats(void) {
+  uint64_t total_clocks = 0, total_cycles = 0;
+
+  printf("[BUS] Simulated bus, %.3f ms of modelled bus time, %llu GPIO writes, %llu GPIO reads.\n",
+         sim_now_ps / 1e9, (unsigned long long)sim_gpio_writes, (unsigned long long)sim_gpio_reads);
+  if (host_time)
+    printf("[BUS] %.3f ms of it spent on the host between transactions.\n", host_ps / 1e9);
+  printf("[BUS] %-10s %12s %12s %12s %10s\n", "Access", "Count", "GPIO wr/acc", "GPIO rd/acc", "Avg ns");
+  for (int i = 0; i < SIM_TXN_NUM; i++) {
+    struct sim_txn_stats *s = &txn_stats[i];
+    if (!s->count)
+      continue;
+    printf("[BUS] %-10s %12llu %12.2f %12.2f %10.1f\n", sim_txn_names[i], (unsigned long long)s->count,
+           (double)s->gpio_writes / s->count, (double)s->gpio_reads / s->count, s->time_ps / 1000.0 / s->count);
+  }
+
+  printf("[BUS] %-10s %12s %12s %12s\n", "Region", "Reads", "Writes", "7MHz clocks");
+  for (int i = 0; i < SIM_REGION_NUM; i++) {
+    struct sim_region_stats *s = &region_stats[i];
+    total_cycles += s->reads + s->writes;
+    total_clocks += s->clocks;
+    if (!s->reads && !s->writes)
+      continue;
+    printf("[BUS] %-10s %12llu %12llu %12llu\n", sim_region_names[i], (unsigned long long)s->reads,
+           (unsigned long long)s->writes, (unsigned long long)s->clocks);
+  }
+  printf("[BUS] %llu Amiga bus cycles, %llu 7MHz clocks, %llu protocol errors.\n",
+         (unsigned long long)total_cycles, (unsigned long long)total_clocks, (unsigned long long)sim_protocol_errors);
+}
+
+static int load_sim_rom(char *filename) {
+  FILE *in = fopen(filename, "rb");
+  long size;
+
+  if (!in) {
+    printf("[BUS] Failed to open ROM file %s.\n", filename);
+    return -1;
+  }
+
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  if (size != ROM_SIZE && size != ROM_SIZE / 2) {
+    printf("[BUS] ROM file %s is not 256KB or 512KB.\n", filename);
+    fclose(in);
+    return -1;
+  }
+
+  rom = (unsigned char *)malloc(ROM_SIZE);
+  if (!rom || fread(rom, size, 1, in) != 1) {
+    printf("[BUS] Failed to read ROM file %s.\n", filename);
+    fclose(in);
+    return -1;
+  }
+  if (size != ROM_SIZE)
+    memcpy(rom + size, rom, size);
+
+  fclose(in);
+  printf("[BUS] Loaded %ldKB ROM from %s.\n", size / 1024, filename);
+  return 0;
+}
+
+static int sim_bus_setup(struct emulator_config *cfg, char *options) {
+  char cur_cmd[128], cur_val[128];
+  int str_pos = 0;
+
+  while (options && str_pos < (int)strlen(options)) {
+    memset(cur_cmd, 0x00, 128);
+    memset(cur_val, 0x00, 128);
+    get_next_string(options, cur_cmd, &str_pos, '=');
+    get_next_string(options, cur_val, &str_pos, ' ');
+
+    if (strcmp(cur_cmd, "chipram") == 0) {
+      chip_size = get_int(cur_val);
+    } else if (strcmp(cur_cmd, "slowram") == 0) {
+      slow_size = get_int(cur_val);
+    } else if (strcmp(cur_cmd, "rom") == 0) {
+      if (load_sim_rom(cur_val) == -1)
+        return -1;
+    } else if (strcmp(cur_cmd, "gpiowrite") == 0) {
+      gpio_write_ps = get_int(cur_val) * 1000ULL;
+    } else if (strcmp(cur_cmd, "gpioread") == 0) {
+      gpio_read_ps = get_int(cur_val) * 1000ULL;
+    } else if (strcmp(cur_cmd, "buscycles") == 0) {
+      bus_cycles = get_int(cur_val);
+    } else if (strcmp(cur_cmd, "ciacycles") == 0) {
+      cia_cycles = get_int(cur_val);
+    } else if (strcmp(cur_cmd, "hosttime") == 0) {
+      host_time = get_int(cur_val);
+    } else {
+      printf("[BUS] Unknown simulated bus option %s.\n", cur_cmd);
+    }
+  }
+
+  if (chip_size > CHIPRAM_MAX)
+    chip_size = CHIPRAM_MAX;
+  if (slow_size > SLOWRAM_MAX)
+    slow_size = SLOWRAM_MAX;
+
+  chip_ram = (unsigned char *)calloc(1, chip_size + 1);
+  slow_ram = (unsigned char *)calloc(1, slow_size + 1);
+  if (!chip_ram || !slow_ram) {
+    printf("[BUS] Failed to allocate memory for simulated Amiga RAM.\n");
+    return -1;
+  }
+
+  printf("[BUS] Simulated bus: %dKB Chip RAM, %dKB Slow RAM, %s, GPIO write/read %llu/%llu ns, %u/%u clocks per bus/CIA access.\n",
+         chip_size / 1024, slow_size / 1024, rom ? "ROM loaded" : "no ROM",
+         (unsigned long long)(gpio_write_ps / 1000), (unsigned long long)(gpio_read_ps / 1000), bus_cycles, cia_cycles);
+
+  sim_reset_amiga();
+  pistorm_setup_pins();
+  posted_writes = cfg->posted_writes;
+
+  return 0;
+}
+
+static void sim_bus_shutdown(void) {
+  pistorm_wait_write();
+  free(chip_ram);
+  free(slow_ram);
+  free(rom);
+  chip_ram = slow_ram = rom = NULL;
+}
+
+struct bus_backend sim_bus_backend = {
+  .name = "sim",
+  .setup = sim_bus_setup,
+  .shutdown = sim_bus_shutdown,
+  .read8 = sim_bus_read8,
+  .read16 = sim_bus_read16,
+  .write8 = sim_bus_write8,
+  .write16 = sim_bus_write16,
+  .read_reg = sim_bus_read_reg,
+  .write_reg = sim_bus_write_reg,
+  .irq_pending = sim_bus_irq_pending,
+  .irq_line = sim_bus_irq_line,
+  .print_stats = sim_bus_print_stats,
+  .wait_spins = pistorm_get_wait_spins,
+};
@@ -1,7 +1,11 @@
 #include "../platforms/platforms.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define M68K_CPU_TYPES M68K_CPU_TYPE_SCC68070
 
@@ -23,6 +27,7 @@ const char *map_type_names[MAPTYPE_NUM] = {
   "rom",
   "ram",
   "register",
+  "shadow",
 };
 
 const char *config_item_names[CONFITEM_NUM] = {
@@ -34,6 +39,17 @@ const char *config_item_names[CONFITEM_NUM] = {
   "keyboard",
   "platform",
   "setvar",
+  "blockcache",
+  "jit",
+  "shadowrom",
+  "bus",
+  "postedwrites",
+  "busthread",
+  "iplthread",
+  "loopstats",
+  "bustrace",
+  "busstats",
+  "pairprofile",
 };
 
 const char *mapcmd_names[MAPCMD_NUM] = {
@@ -45,6 +61,15 @@ const char *mapcmd_names[MAPCMD_NUM] = {
   "file",
   "ovl",
   "id",
+  "policy",
+  "hugepages",
+  "verify",
+};
+
+const char *map_policy_names[MAPPOLICY_NUM] = {
+  "lazy",
+  "prefault",
+  "locked",
 };
 
 int get_config_item_type(char *cmd) {
@@ -79,6 +104,28 @@ unsigned int get_map_cmd(char *name) {
   return MAPCMD_UNKNOWN;
 }
 
+unsigned int get_map_policy(char *name) {
+  for (int i = 0; i < MAPPOLICY_NUM; i++) {
+    if (strcmp(name, map_policy_names[i]) == 0) {
+      return i;
+    }
+  }
+
+  printf("Unknown RAM map policy %s, using %s.\n", name, map_policy_names[MAPPOLICY_LAZY]);
+  return MAPPOLICY_LAZY;
+}
+
+unsigned int get_map_hugepages(char *name) {
+  if (strcmp(name, "thp") == 0)
+    return MAPHUGE_THP;
+  if (strcmp(name, "hugetlb") == 0 || strcmp(name, "explicit") == 0)
+    return MAPHUGE_HUGETLB;
+  if (strcmp(name, "off") != 0)
+    printf("Unknown hugepages setting %s, using off.\n", name);
+
+  return MAPHUGE_NONE;
+}
+
 unsigned int get_map_type(char *name) {
   for (int i = 1; i < MAPTYPE_NUM; i++) {
     if (strcmp(name, map_type_names[i]) == 0) {
@@ -168,9 +215,154 @@ void get_next_string(char *str, char *str_out, int *strpos, char separator) {
   }
 }
 
-void add_mapping(struct emulator_config *cfg, unsigned int type, unsigned int addr, unsigned int size, int mirr_addr, char *filename, char *map_id) {
+void free_mapping_data(struct emulator_config *cfg, int index) {
+  switch (cfg->map_backing[index]) {
+    case MAPBACKING_MALLOC:
+      free(cfg->map_data[index]);
+      break;
+    case MAPBACKING_MMAP:
+      munmap(cfg->map_data[index], cfg->map_alloc_size[index]);
+      break;
+    default:
+      break;
+  }
+  cfg->map_data[index] = NULL;
+  cfg->map_backing[index] = MAPBACKING_NONE;
+  cfg->map_alloc_size[index] = 0;
+  free(cfg->map_shadow_valid[index]);
+  cfg->map_shadow_valid[index] = NULL;
+}
+
+// Map a ROM file read-only and copy-on-write, so identical images are shared through the page cache.
+// Reads wrap at rom_size, but a longword read at the very end may still touch up to three bytes past it,
+// so an extra zero page is reserved behind the file.
+static unsigned char *map_rom_file(int fd, unsigned int rom_size, unsigned int *alloc_size) {
+  unsigned int page_size = sysconf(_SC_PAGESIZE);
+  unsigned int file_pages = (rom_size + page_size - 1) & ~(page_size - 1);
+  unsigned char *data;
+
+  *alloc_size = file_pages + page_size;
+  data = mmap(NULL, *alloc_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  if (mmap(data, rom_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(data, *alloc_size);
+    return NULL;
+  }
+
+  return data;
+}
+
+// Back a RAM map with anonymous memory, which the kernel zero-fills as pages are first touched.
+// Depending on the map policy, all pages are faulted in (and locked) right away instead.
+// Explicit hugepages come from the pool reserved in /proc/sys/vm/nr_hugepages. Without MAP_NORESERVE
+// the mmap fails right away if the pool is too small, rather than with SIGBUS on a later page fault.
+static unsigned char *alloc_hugetlb_ram(unsigned int size, int flags, unsigned int *alloc_size) {
+#ifdef MAP_HUGETLB
+  unsigned char *data;
+
+  *alloc_size = (size + MAP_HUGEPAGE_SIZE - 1) & ~(MAP_HUGEPAGE_SIZE - 1);
+  data = mmap(NULL, *alloc_size, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+  return (data == MAP_FAILED) ? NULL : data;
+#else
+  (void)size;
+  (void)flags;
+  (void)alloc_size;
+  return NULL;
+#endif
+}
+
+// Transparent hugepages can only back hugepage aligned parts of a mapping, so over-allocate and trim.
+static unsigned char *alloc_thp_ram(unsigned int size, int flags, unsigned int *alloc_size, unsigned char *hugepages) {
+  unsigned char *data, *aligned;
+  unsigned long head;
+
+  *alloc_size = (size + MAP_HUGEPAGE_SIZE - 1) & ~(MAP_HUGEPAGE_SIZE - 1);
+  data = mmap(NULL, *alloc_size + MAP_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, flags & ~MAP_POPULATE, -1, 0);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  aligned = (unsigned char *)(((unsigned long)data + MAP_HUGEPAGE_SIZE - 1) & ~(unsigned long)(MAP_HUGEPAGE_SIZE - 1));
+  head = aligned - data;
+  if (head)
+    munmap(data, head);
+  munmap(aligned + *alloc_size, MAP_HUGEPAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+  if (madvise(aligned, *alloc_size, MADV_HUGEPAGE) == 0)
+    *hugepages = MAPHUGE_THP;
+#endif
+
+  // Populate after the madvise, so prefaulted memory already uses hugepages
+  if (flags & MAP_POPULATE) {
+    for (unsigned int i = 0; i < *alloc_size; i += 4096)
+      ((volatile unsigned char *)aligned)[i] = 0;
+  }
+
+  return aligned;
+}
+
+// Like map_rom_file, reserve a page behind the map: handle_mapped_read/write do a word or longword at
+// the very end of the last page in one go, touching up to three bytes past map_size. With hugepages
+// that page only costs an extra hugepage if map_size is a multiple of the hugepage size.
+int alloc_mapping_ram(struct emulator_config *cfg, int index) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  unsigned char requested = cfg->map_hugepages[index];
+  unsigned int page_size = sysconf(_SC_PAGESIZE);
+  unsigned int size = ((cfg->map_size[index] + page_size - 1) & ~(page_size - 1)) + page_size;
+
+  if (cfg->map_policy[index] != MAPPOLICY_LAZY)
+    flags |= MAP_POPULATE;
+
+  cfg->map_data[index] = NULL;
+  cfg->map_hugepages[index] = MAPHUGE_NONE;
+  if (requested == MAPHUGE_HUGETLB) {
+    cfg->map_data[index] = alloc_hugetlb_ram(size, flags, &cfg->map_alloc_size[index]);
+    if (cfg->map_data[index])
+      cfg->map_hugepages[index] = MAPHUGE_HUGETLB;
+    else
+      printf("No explicit hugepages available for RAM mapping %d, trying transparent hugepages.\n", index);
+  }
+  if (!cfg->map_data[index] && requested != MAPHUGE_NONE)
+    cfg->map_data[index] = alloc_thp_ram(size, flags, &cfg->map_alloc_size[index], &cfg->map_hugepages[index]);
+  if (!cfg->map_data[index]) {
+    cfg->map_alloc_size[index] = size;
+    cfg->map_data[index] = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  }
+
+  if (cfg->map_data[index] == MAP_FAILED) {
+    cfg->map_data[index] = NULL;
+    return -1;
+  }
+  cfg->map_backing[index] = MAPBACKING_MMAP;
+
+  if (cfg->map_policy[index] == MAPPOLICY_LOCKED && mlock(cfg->map_data[index], cfg->map_size[index]) == -1)
+    printf("Failed to lock RAM mapping %d in memory, check RLIMIT_MEMLOCK.\n", index);
+
+  return 0;
+}
+
+const char *get_mapping_backing_name(struct emulator_config *cfg, int index) {
+  if (cfg->map_type[index] == MAPTYPE_ROM)
+    return (cfg->map_backing[index] == MAPBACKING_MMAP) ? "mapped file" : "memory";
+  if (cfg->map_type[index] != MAPTYPE_RAM && cfg->map_type[index] != MAPTYPE_SHADOW)
+    return "none";
+
+  switch (cfg->map_hugepages[index]) {
+    case MAPHUGE_HUGETLB:
+      return "hugetlb pages";
+    case MAPHUGE_THP:
+      return "transparent hugepages";
+    default:
+      return "4K pages";
+  }
+}
+
+void add_mapping(struct emulator_config *cfg, unsigned int type, unsigned int addr, unsigned int size, int mirr_addr, char *filename, char *map_id, unsigned int policy, unsigned int hugepages, unsigned int verify) {
   unsigned int index = 0, file_size = 0;
-  FILE *in = NULL;
+  int fd = -1;
+  struct stat file_stat;
 
   while (index < MAX_NUM_MAPPED_ITEMS) {
     if (cfg->map_type[index] == MAPTYPE_NONE)
@@ -186,6 +378,9 @@ void add_mapping(struct emulator_config *cfg, unsigned int type, unsigned int ad
   cfg->map_offset[index] = addr;
   cfg->map_size[index] = size;
   cfg->map_mirror[index] = mirr_addr;
+  cfg->map_policy[index] = policy;
+  cfg->map_hugepages[index] = hugepages;
+  cfg->map_verify[index] = verify;
   if (strlen(map_id)) {
     cfg->map_id[index] = (char *)malloc(strlen(map_id) + 1);
     strcpy(cfg->map_id[index], map_id);
@@ -193,35 +388,47 @@ void add_mapping(struct emulator_config *cfg, unsigned int type, unsigned int ad
 
   switch(type) {
     case MAPTYPE_RAM:
-      printf("Allocating %d bytes for RAM mapping (%d MB)...\n", size, size / 1024 / 1024);
-      cfg->map_data[index] = (unsigned char *)malloc(size);
-      if (!cfg->map_data[index]) {
+      printf("Allocating %d bytes for RAM mapping (%d MB, %s)...\n", size, size / 1024 / 1024, map_policy_names[policy]);
+      if (alloc_mapping_ram(cfg, index) == -1) {
         printf("ERROR: Unable to allocate memory for mapped RAM!\n");
         goto mapping_failed;
       }
-      memset(cfg->map_data[index], 0x00, size);
+      break;
+    case MAPTYPE_SHADOW:
+      // Filled from the bus a page at a time, the first time the CPU reads from it.
+      printf("Allocating %d bytes for chip RAM shadow (%d KB, %s)...\n", size, size / 1024, verify ? "verified" : "not verified");
+      cfg->map_shadow_valid[index] = (unsigned char *)calloc(1, (size + MAP_PAGE_SIZE - 1) >> MAP_PAGE_SHIFT);
+      if (!cfg->map_shadow_valid[index] || alloc_mapping_ram(cfg, index) == -1) {
+        printf("ERROR: Unable to allocate memory for chip RAM shadow!\n");
+        goto mapping_failed;
+      }
+      if ((addr & MAP_PAGE_MASK) || (size & MAP_PAGE_MASK))
+        printf("Chip RAM shadow %.8X-%.8X is not %d KB aligned, partially covered pages go to the bus.\n",
+               addr, addr + size - 1, MAP_PAGE_SIZE / 1024);
       break;
     case MAPTYPE_ROM:
-      in = fopen(filename, "rb");
-      if (!in) {
+      fd = open(filename, O_RDONLY);
+      if (fd == -1) {
         printf("Failed to open file %s for ROM mapping.\n", filename);
         goto mapping_failed;
       }
-      fseek(in, 0, SEEK_END);
-      file_size = (int)ftell(in);
+      if (fstat(fd, &file_stat) == -1 || file_stat.st_size == 0) {
+        printf("Failed to get the size of file %s for ROM mapping.\n", filename);
+        goto mapping_failed;
+      }
+      file_size = (unsigned int)file_stat.st_size;
       if (size == 0) {
         cfg->map_size[index] = file_size;
       }
-      fseek(in, 0, SEEK_SET);
-      cfg->map_data[index] = (unsigned char *)calloc(1, cfg->map_size[index]);
+      // Only the part of the file that is visible needs mapping, the rest of the range wraps around.
       cfg->rom_size[index] = (cfg->map_size[index] <= file_size) ? cfg->map_size[index] : file_size;
+      cfg->map_data[index] = map_rom_file(fd, cfg->rom_size[index], &cfg->map_alloc_size[index]);
       if (!cfg->map_data[index]) {
-        printf("ERROR: Unable to allocate memory for mapped ROM!\n");
+        printf("ERROR: Unable to map file %s for mapped ROM!\n", filename);
         goto mapping_failed;
       }
-      memset(cfg->map_data[index], 0x00, cfg->map_size[index]);
-      fread(cfg->map_data[index], cfg->rom_size[index], 1, in);
-      fclose(in);
+      cfg->map_backing[index] = MAPBACKING_MMAP;
+      close(fd);
       break;
     case MAPTYPE_REGISTER:
     default:
@@ -229,14 +436,45 @@ void add_mapping(struct emulator_config *cfg, unsigned int type, unsigned int ad
       break;
   }
 
-  printf("[MAP %d] Added %s mapping for range %.8lX-%.8lX ID: %s\n", index, map_type_names[type], cfg->map_offset[index], cfg->map_offset[index] + cfg->map_size[index] - 1, cfg->map_id[index] ? cfg->map_id[index] : "None");
+  printf("[MAP %d] Added %s mapping for range %.8lX-%.8lX ID: %s Backing: %s\n", index, map_type_names[type], cfg->map_offset[index], cfg->map_offset[index] + cfg->map_size[index] - 1, cfg->map_id[index] ? cfg->map_id[index] : "None", get_mapping_backing_name(cfg, index));
 
   return;
 
   mapping_failed:;
+  free_mapping_data(cfg, index);
   cfg->map_type[index] = MAPTYPE_NONE;
-  if (in)
-    fclose(in);
+  if (fd != -1)
+    close(fd);
+}
+
+// Map a ROM from data that is already in memory. The config takes ownership of data, which needs
+// MAP_TAIL_SIZE spare bytes behind size.
+int add_rom_data_mapping(struct emulator_config *cfg, unsigned int addr, unsigned int size, int mirr_addr, unsigned char *data, char *map_id) {
+  unsigned int index = 0;
+
+  while (index < MAX_NUM_MAPPED_ITEMS) {
+    if (cfg->map_type[index] == MAPTYPE_NONE)
+      break;
+    index++;
+  }
+  if (index == MAX_NUM_MAPPED_ITEMS) {
+    printf("Unable to map item, only %d items can be mapped with current binary.\n", MAX_NUM_MAPPED_ITEMS);
+    return -1;
+  }
+
+  cfg->map_type[index] = MAPTYPE_ROM;
+  cfg->map_offset[index] = addr;
+  cfg->map_size[index] = size;
+  cfg->rom_size[index] = size;
+  cfg->map_mirror[index] = mirr_addr;
+  cfg->map_data[index] = data;
+  cfg->map_backing[index] = MAPBACKING_MALLOC;
+  cfg->map_id[index] = (char *)malloc(strlen(map_id) + 1);
+  strcpy(cfg->map_id[index], map_id);
+
+  printf("[MAP %d] Added %s mapping for range %.8lX-%.8lX ID: %s Backing: %s\n", index, map_type_names[MAPTYPE_ROM], cfg->map_offset[index], cfg->map_offset[index] + cfg->map_size[index] - 1, cfg->map_id[index], get_mapping_backing_name(cfg, index));
+
+  return index;
 }
 
 struct emulator_config *load_config_file(char *filename) {
@@ -282,7 +520,7 @@ struct emulator_config *load_config_file(char *filename) {
         cfg->cpu_type = get_m68k_cpu_type(parse_line + str_pos);
         break;
       case CONFITEM_MAP: {
-        unsigned int maptype = 0, mapsize = 0, mapaddr = 0;
+        unsigned int maptype = 0, mapsize = 0, mapaddr = 0, mappolicy = MAPPOLICY_LAZY, maphuge = MAPHUGE_NONE, mapverify = 0;
         int mirraddr = -1;
         char mapfile[128], mapid[128];
         memset(mapfile, 0x00, 128);
@@ -327,17 +565,56 @@ struct emulator_config *load_config_file(char *filename) {
               get_next_string(parse_line, cur_cmd, &str_pos, ' ');
               mirraddr = get_int(cur_cmd);
               break;
+            case MAPCMD_POLICY:
+              get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+              mappolicy = get_map_policy(cur_cmd);
+              break;
+            case MAPCMD_HUGEPAGES:
+              get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+              maphuge = get_map_hugepages(cur_cmd);
+              break;
+            case MAPCMD_VERIFY:
+              get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+              mapverify = get_int(cur_cmd);
+              break;
             default:
               printf("Unknown/unhandled map argument %s on line %d.\n", cur_cmd, cur_line);
               break;
           }
         }
-        add_mapping(cfg, maptype, mapaddr, mapsize, mirraddr, mapfile, mapid);
+        add_mapping(cfg, maptype, mapaddr, mapsize, mirraddr, mapfile, mapid, mappolicy, maphuge, mapverify);
 
         break;
       }
       case CONFITEM_LOOPCYCLES:
-        cfg->loop_cycles = get_int(parse_line + str_pos);
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        if (strcmp(cur_cmd, "auto") == 0) {
+          cfg->loop_auto = cfg->loop_stats = 1;
+          cfg->loop_latency_us = 50;
+          cfg->loop_min_cycles = 50;
+          cfg->loop_max_cycles = 50000;
+          memset(cur_cmd, 0x00, 128);
+          get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+          if (strlen(cur_cmd))
+            cfg->loop_latency_us = get_int(cur_cmd);
+          memset(cur_cmd, 0x00, 128);
+          get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+          if (strlen(cur_cmd))
+            cfg->loop_min_cycles = get_int(cur_cmd);
+          memset(cur_cmd, 0x00, 128);
+          get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+          if (strlen(cur_cmd))
+            cfg->loop_max_cycles = get_int(cur_cmd);
+          if (cfg->loop_min_cycles < 1)
+            cfg->loop_min_cycles = 1;
+          if (cfg->loop_max_cycles < cfg->loop_min_cycles)
+            cfg->loop_max_cycles = cfg->loop_min_cycles;
+          printf("Set CPU loop cycles to adapt between %d and %d for a %d us latency target.\n",
+                 cfg->loop_min_cycles, cfg->loop_max_cycles, cfg->loop_latency_us);
+          break;
+        }
+        cfg->loop_cycles = get_int(cur_cmd);
         printf("Set CPU loop cycles to %d.\n", cfg->loop_cycles);
         break;
       case CONFITEM_MOUSE:
@@ -382,6 +659,98 @@ struct emulator_config *load_config_file(char *filename) {
 
         break;
       }
+      case CONFITEM_BLOCKCACHE:
+        cfg->block_cache = 1;
+        printf("Enabled CPU block cache.\n");
+        break;
+      case CONFITEM_JIT:
+        cfg->block_cache = 1;
+        cfg->jit = 1;
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        if (strcmp(cur_cmd, "perfmap") == 0)
+          cfg->jit_perf_map = 1;
+        printf("Enabled CPU block cache and JIT%s.\n", cfg->jit_perf_map ? " with a perf map" : "");
+        break;
+      case CONFITEM_SHADOWROM:
+        cfg->shadow_rom = 1;
+        while (1) {
+          memset(cur_cmd, 0x00, 128);
+          get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+          if (!strlen(cur_cmd))
+            break;
+          if (strcmp(cur_cmd, "verify") == 0) {
+            cfg->shadow_rom_verify = 1;
+          } else {
+            cfg->shadow_rom_file = (char *)calloc(1, strlen(cur_cmd) + 1);
+            strcpy(cfg->shadow_rom_file, cur_cmd);
+          }
+        }
+        printf("Enabled Kickstart ROM shadowing%s, cache file: %s.\n", cfg->shadow_rom_verify ? " with checksum verification" : "", cfg->shadow_rom_file ? cfg->shadow_rom_file : "None");
+        break;
+      case CONFITEM_BUS:
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        cfg->bus_name = (char *)calloc(1, strlen(cur_cmd) + 1);
+        strcpy(cfg->bus_name, cur_cmd);
+        cfg->bus_options = (char *)calloc(1, strlen(parse_line + str_pos) + 1);
+        strcpy(cfg->bus_options, parse_line + str_pos);
+        printf("Set bus backend to %s.\n", cfg->bus_name);
+        break;
+      case CONFITEM_POSTEDWRITES:
+        cfg->posted_writes = 1;
+        printf("Enabled posted bus writes.\n");
+        break;
+      case CONFITEM_BUSTHREAD:
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        cfg->bus_thread = 1;
+        cfg->bus_thread_cpu = strlen(cur_cmd) ? (int)get_int(cur_cmd) : -1;
+        if (cfg->bus_thread_cpu == -1)
+          printf("Enabled bus thread.\n");
+        else
+          printf("Enabled bus thread on CPU %d.\n", cfg->bus_thread_cpu);
+        break;
+      case CONFITEM_IPLTHREAD:
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        cfg->ipl_thread = 1;
+        cfg->ipl_thread_cpu = strlen(cur_cmd) ? (int)get_int(cur_cmd) : -1;
+        if (cfg->ipl_thread_cpu == -1)
+          printf("Enabled IPL thread.\n");
+        else
+          printf("Enabled IPL thread on CPU %d.\n", cfg->ipl_thread_cpu);
+        break;
+      case CONFITEM_LOOPSTATS:
+        cfg->loop_stats = 1;
+        printf("Enabled CPU loop statistics.\n");
+        break;
+      case CONFITEM_BUSTRACE:
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        if (!strlen(cur_cmd)) {
+          printf("No file name given for bus trace on line %d.\n", cur_line);
+          break;
+        }
+        cfg->bus_trace_file = (char *)calloc(1, strlen(cur_cmd) + 1);
+        strcpy(cfg->bus_trace_file, cur_cmd);
+        printf("Enabled bus tracing to %s.\n", cfg->bus_trace_file);
+        break;
+      case CONFITEM_BUSSTATS:
+        cfg->bus_stats = 1;
+        printf("Enabled bus access statistics.\n");
+        break;
+      case CONFITEM_PAIRPROFILE:
+        memset(cur_cmd, 0x00, 128);
+        get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+        if (!strlen(cur_cmd)) {
+          printf("No file name given for opcode pair profile on line %d.\n", cur_line);
+          break;
+        }
+        cfg->pair_profile_file = (char *)calloc(1, strlen(cur_cmd) + 1);
+        strcpy(cfg->pair_profile_file, cur_cmd);
+        printf("Writing opcode pair profile to %s on exit.\n", cfg->pair_profile_file);
+        break;
       case CONFITEM_NONE:
       default:
         printf("Unknown config item %s on line %d.\n", cur_cmd, cur_line);
@@ -396,9 +765,7 @@ struct emulator_config *load_config_file(char *filename) {
   load_failed:;
   if (cfg) {
     for (int i = 0; i < MAX_NUM_MAPPED_ITEMS; i++) {
-      if (cfg->map_data[i])
-        free(cfg->map_data[i]);
-      cfg->map_data[i] = NULL;
+      free_mapping_data(cfg, i);
     }
     free(cfg);
     cfg = NULL;
@@ -1,18 +1,67 @@
 #include "../m68k.h"
 
 #define MAX_NUM_MAPPED_ITEMS 8
+#define MAX_NUM_CUSTOM_RANGES 8
 #define SIZE_KILO 1024
 #define SIZE_MEGA (1024 * 1024)
 #define SIZE_GIGA (1024 * 1024 * 1024)
 
+// The mapped items are compiled into a page table covering the full 32-bit
+// address space, so a lookup is a single index instead of a scan of all items.
+// Uses the same page size as the CPU core, so RAM and ROM pages can be handed
+// straight to m68k_set_host_pages().
+#define MAP_PAGE_SHIFT M68K_HOST_PAGE_SHIFT
+#define MAP_PAGE_SIZE (1 << MAP_PAGE_SHIFT)
+#define MAP_PAGE_MASK (MAP_PAGE_SIZE - 1)
+#define MAP_NUM_PAGES (1 << (32 - MAP_PAGE_SHIFT))
+// Mapped RAM and ROM data has this many spare bytes behind its end, for a word
+// or longword access at the very end of the last page.
+#define MAP_TAIL_SIZE 4
+
 typedef enum {
   MAPTYPE_NONE,
   MAPTYPE_ROM,
   MAPTYPE_RAM,
   MAPTYPE_REGISTER,
+  MAPTYPE_SHADOW,
   MAPTYPE_NUM,
 } map_types;
 
+typedef enum {
+  MAPBACKING_NONE,
+  MAPBACKING_MALLOC,
+  MAPBACKING_MMAP,
+  MAPBACKING_NUM,
+} map_backings;
+
+typedef enum {
+  MAPPOLICY_LAZY,
+  MAPPOLICY_PREFAULT,
+  MAPPOLICY_LOCKED,
+  MAPPOLICY_NUM,
+} map_policies;
+
+typedef enum {
+  MAPHUGE_NONE,
+  MAPHUGE_THP,
+  MAPHUGE_HUGETLB,
+  MAPHUGE_NUM,
+} map_hugepage_types;
+
+#define MAP_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+typedef enum {
+  PAGETYPE_PASSTHROUGH,
+  PAGETYPE_RAM,
+  PAGETYPE_ROM,
+  PAGETYPE_REGISTER,
+  PAGETYPE_SCAN,
+  PAGETYPE_CUSTOM,
+  PAGETYPE_SHADOW,
+  PAGETYPE_SHADOW_FILL,
+  PAGETYPE_NUM,
+} page_types;
+
 typedef enum {
   MAPCMD_UNKNOWN,
   MAPCMD_TYPE,
@@ -22,6 +71,9 @@ typedef enum {
   MAPCMD_FILENAME,
   MAPCMD_OVL_REMAP,
   MAPCMD_MAP_ID,
+  MAPCMD_POLICY,
+  MAPCMD_HUGEPAGES,
+  MAPCMD_VERIFY,
   MAPCMD_NUM,
 } map_cmds;
 
@@ -34,6 +86,17 @@ typedef enum {
   CONFITEM_KEYBOARD,
   CONFITEM_PLATFORM,
   CONFITEM_SETVAR,
+  CONFITEM_BLOCKCACHE,
+  CONFITEM_JIT,
+  CONFITEM_SHADOWROM,
+  CONFITEM_BUS,
+  CONFITEM_POSTEDWRITES,
+  CONFITEM_BUSTHREAD,
+  CONFITEM_IPLTHREAD,
+  CONFITEM_LOOPSTATS,
+  CONFITEM_BUSTRACE,
+  CONFITEM_BUSSTATS,
+  CONFITEM_PAIRPROFILE,
   CONFITEM_NUM,
 } config_items;
 
@@ -41,7 +104,7 @@ typedef enum {
   OP_TYPE_BYTE,
   OP_TYPE_WORD,
   OP_TYPE_LONGWORD,
-  OP_TYPE_MEM,
+  OP_TYPE_MEM,  // Block transfers only, see handle_mapped_block_read
   OP_TYPE_NUM,
 } map_op_types;
 
@@ -53,8 +116,22 @@ struct emulator_config {
   unsigned int map_size[MAX_NUM_MAPPED_ITEMS];
   unsigned int rom_size[MAX_NUM_MAPPED_ITEMS];
   unsigned char *map_data[MAX_NUM_MAPPED_ITEMS];
+  unsigned char map_backing[MAX_NUM_MAPPED_ITEMS];
+  unsigned int map_alloc_size[MAX_NUM_MAPPED_ITEMS];
+  unsigned char map_policy[MAX_NUM_MAPPED_ITEMS];
+  unsigned char map_hugepages[MAX_NUM_MAPPED_ITEMS];
   int map_mirror[MAX_NUM_MAPPED_ITEMS];
   char *map_id[MAX_NUM_MAPPED_ITEMS];
+  // Shadow mappings: which pages hold a copy of the bus contents yet, and whether to check them.
+  unsigned char *map_shadow_valid[MAX_NUM_MAPPED_ITEMS];
+  unsigned char map_verify[MAX_NUM_MAPPED_ITEMS];
+
+  unsigned char *page_type;
+  unsigned char **page_data;
+
+  // Address ranges the platform custom_read/custom_write hooks are called for
+  unsigned int custom_range_addr[MAX_NUM_CUSTOM_RANGES];
+  unsigned int custom_range_size[MAX_NUM_CUSTOM_RANGES];
 
   struct platform_config *platform;
 
@@ -64,11 +141,29 @@ struct emulator_config {
   unsigned char mouse_enabled, keyboard_enabled;
 
   unsigned int loop_cycles;
+  unsigned char loop_auto, loop_stats;
+  unsigned int loop_latency_us, loop_min_cycles, loop_max_cycles;
+  unsigned char block_cache;
+  unsigned char jit, jit_perf_map;
+
+  unsigned char shadow_rom, shadow_rom_verify;
+  char *shadow_rom_file;
+
+  char *bus_name, *bus_options;
+  unsigned char posted_writes;
+  unsigned char bus_thread;
+  int bus_thread_cpu;
+  char *bus_trace_file;
+  unsigned char bus_stats;
+  char *pair_profile_file;
+  unsigned char ipl_thread;
+  int ipl_thread_cpu;
 };
 
 struct platform_config {
   char *subsys;
 
+  // Only called for ranges added with add_custom_range, on the 64KB pages they touch.
   int (*custom_read)(struct emulator_config *cfg, unsigned int addr, unsigned int *val, unsigned char type);
   int (*custom_write)(struct emulator_config *cfg, unsigned int addr, unsigned int val, unsigned char type);
 
@@ -81,8 +176,20 @@ struct platform_config {
 
 unsigned int get_m68k_cpu_type(char *name);
 struct emulator_config *load_config_file(char *filename);
+void free_mapping_data(struct emulator_config *cfg, int index);
+int alloc_mapping_ram(struct emulator_config *cfg, int index);
+const char *get_mapping_backing_name(struct emulator_config *cfg, int index);
+int add_rom_data_mapping(struct emulator_config *cfg, unsigned int addr, unsigned int size, int mirr_addr, unsigned char *data, char *map_id);
 
 int handle_mapped_read(struct emulator_config *cfg, unsigned int addr, unsigned int *val, unsigned char type, unsigned char mirror);
 int handle_mapped_write(struct emulator_config *cfg, unsigned int addr, unsigned int value, unsigned char type, unsigned char mirror);
+int handle_mapped_block_read(struct emulator_config *cfg, unsigned int addr, unsigned char *buf, unsigned int size, unsigned char type);
+int handle_mapped_block_write(struct emulator_config *cfg, unsigned int addr, const unsigned char *buf, unsigned int size, unsigned char type);
+int handle_mapped_block_copy(struct emulator_config *cfg, unsigned int dst, unsigned int src, unsigned int size, unsigned char type);
+void build_page_table(struct emulator_config *cfg);
+void verify_shadow_mappings(struct emulator_config *cfg);
+int add_custom_range(struct emulator_config *cfg, unsigned int addr, unsigned int size);
+void remove_custom_range(struct emulator_config *cfg, unsigned int addr);
 int get_named_mapped_item(struct emulator_config *cfg, char *name);
 unsigned int get_int(char *str);
+void get_next_string(char *str, char *str_out, int *strpos, char separator);
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <dirent.h>
 #include <endian.h>
@@ -5,6 +7,7 @@
 #include <pthread.h>
 #include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,43 +23,8 @@
 #include "main.h"
 #include "platforms/platforms.h"
 #include "input/input.h"
-
-//#define BCM2708_PERI_BASE        0x20000000  //pi0-1
-//#define BCM2708_PERI_BASE	0xFE000000     //pi4
-#define BCM2708_PERI_BASE 0x3F000000  // pi3
-#define BCM2708_PERI_SIZE 0x01000000
-#define GPIO_BASE (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
-#define GPCLK_BASE (BCM2708_PERI_BASE + 0x101000)
-#define GPIO_ADDR 0x200000 /* GPIO controller */
-#define GPCLK_ADDR 0x101000
-#define CLK_PASSWD 0x5a000000
-#define CLK_GP0_CTL 0x070
-#define CLK_GP0_DIV 0x074
-
-#define SA0 5
-#define SA1 3
-#define SA2 2
-
-#define STATUSREGADDR  \
-  GPIO_CLR = 1 << SA0; \
-  GPIO_CLR = 1 << SA1; \
-  GPIO_SET = 1 << SA2;
-#define W16            \
-  GPIO_CLR = 1 << SA0; \
-  GPIO_CLR = 1 << SA1; \
-  GPIO_CLR = 1 << SA2;
-#define R16            \
-  GPIO_SET = 1 << SA0; \
-  GPIO_CLR = 1 << SA1; \
-  GPIO_CLR = 1 << SA2;
-#define W8             \
-  GPIO_CLR = 1 << SA0; \
-  GPIO_SET = 1 << SA1; \
-  GPIO_CLR = 1 << SA2;
-#define R8             \
-  GPIO_SET = 1 << SA0; \
-  GPIO_SET = 1 << SA1; \
-  GPIO_CLR = 1 << SA2;
+#include "bus/bus.h"
+#include "bus/bus-stats.h"
 
 #define PAGE_SIZE (4 * 1024)
 #define BLOCK_SIZE (4 * 1024)
@@ -89,11 +57,8 @@ char mouse_buttons = 0;
 #define KICKBASE 0xF80000
 #define KICKSIZE 0x7FFFF
 
-int mem_fd, mouse_fd = -1, keyboard_fd = -1;
-int mem_fd_gpclk;
+int mouse_fd = -1, keyboard_fd = -1;
 int gayle_emulation_enabled = 1;
-void *gpio_map;
-void *gpclk_map;
 
 // Configurable emulator options
 unsigned int cpu_type = M68K_CPU_TYPE_68000;
@@ -101,47 +66,74 @@ unsigned int loop_cycles = 300;
 struct emulator_config *cfg = NULL;
 char keyboard_file[256] = "/dev/input/event0";
 
-// I/O access
-volatile unsigned int *gpio;
-volatile unsigned int *gpclk;
-volatile unsigned int gpfsel0;
-volatile unsigned int gpfsel1;
-volatile unsigned int gpfsel2;
-volatile unsigned int gpfsel0_o;
-volatile unsigned int gpfsel1_o;
-volatile unsigned int gpfsel2_o;
-
-// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) or
-// SET_GPIO_ALT(x,y)
-#define INP_GPIO(g) *(gpio + ((g) / 10)) &= ~(7 << (((g) % 10) * 3))
-#define OUT_GPIO(g) *(gpio + ((g) / 10)) |= (1 << (((g) % 10) * 3))
-#define SET_GPIO_ALT(g, a)  \
-  *(gpio + (((g) / 10))) |= \
-      (((a) <= 3 ? (a) + 4 : (a) == 4 ? 3 : 2) << (((g) % 10) * 3))
+// With "busstats", every bus access is accounted to its region in shared memory
+// and timed, or every 16th of them on ARMv7, see bus-stats.h. Otherwise, while loop statistics are on, every 64th access is
+// timed to estimate the fraction of each timeslice spent waiting on the bus.
+#define BUS_SAMPLE_MASK 63
+static int loop_stats;
+static uint64_t bus_accesses, bus_samples, bus_sample_ns, bus_sample_overhead_ns;
+
+static inline uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-#define GPIO_SET \
-  *(gpio + 7)  // sets   bits which are 1 ignores bits which are 0
-#define GPIO_CLR \
-  *(gpio + 10)  // clears bits which are 1 ignores bits which are 0
+#define BUS_ACCESS(call, region, write)                             \
+  do {                                                              \
+    if (bus_stats) {                                                \
+      unsigned int stats_region = region;                           \
+      if (bus_stats_timed(stats_region)) {                          \
+        uint64_t start_ticks = bus_stats_ticks();                   \
+        call;                                                       \
+        bus_stats_account(stats_region, write, start_ticks);        \
+      } else {                                                      \
+        call;                                                       \
+        bus_stats_count(stats_region, write);                       \
+      }                                                             \
+    } else if (loop_stats && !(++bus_accesses & BUS_SAMPLE_MASK)) { \
+      uint64_t start_ns = get_time_ns();                            \
+      call;                                                         \
+      bus_sample_ns += get_time_ns() - start_ns;                    \
+      bus_samples++;                                                \
+    } else {                                                        \
+      call;                                                         \
+    }                                                               \
+  } while (0)
 
-#define GET_GPIO(g) (*(gpio + 13) & (1 << g))  // 0 if LOW, (1<<g) if HIGH
+static inline uint32_t read8(uint32_t address) {
+  uint32_t value;
+  BUS_ACCESS(value = bus->read8(address), bus_stats_region(address), 0);
+  return value;
+}
 
-#define GPIO_PULL *(gpio + 37)      // Pull up/pull down
-#define GPIO_PULLCLK0 *(gpio + 38)  // Pull up/pull down clock
+static inline void write8(uint32_t address, uint32_t data) {
+  BUS_ACCESS(bus->write8(address, data), bus_stats_region(address), 1);
+}
 
-void setup_io();
+static inline uint32_t read16(uint32_t address) {
+  uint32_t value;
+  BUS_ACCESS(value = bus->read16(address), bus_stats_region(address), 0);
+  return value;
+}
 
-uint32_t read8(uint32_t address);
-void write8(uint32_t address, uint32_t data);
+static inline void write16(uint32_t address, uint32_t data) {
+  BUS_ACCESS(bus->write16(address, data), bus_stats_region(address), 1);
+}
 
-uint32_t read16(uint32_t address);
-void write16(uint32_t address, uint32_t data);
+uint32_t bus_read16(uint32_t address) {
+  return read16(address);
+}
 
-void write32(uint32_t address, uint32_t data);
-uint32_t read32(uint32_t address);
+static inline uint16_t read_reg(void) {
+  uint16_t value;
+  BUS_ACCESS(value = bus->read_reg(), BUS_REGION_STATUS, 0);
+  return value;
+}
 
-uint16_t read_reg(void);
-void write_reg(unsigned int value);
+static inline void write_reg(unsigned int value) {
+  BUS_ACCESS(bus->write_reg(value), BUS_REGION_STATUS, 1);
+}
 
 volatile uint16_t srdata;
 volatile uint32_t srdata2;
@@ -149,44 +141,362 @@ volatile uint32_t srdata2_old;
 
 //unsigned char g_kick[524288];
 //unsigned char g_ram[FASTSIZE + 1]; /* RAM */
-unsigned char toggle;
 static volatile unsigned char ovl;
 static volatile unsigned char maprom;
 
+#define KICKSTART_ADDR 0xF80000
+#define KICKSTART_SIZE 0x80000
+
+// Kickstart ROMs are built so that the 32-bit sum with end-around carry is 0xFFFFFFFF.
+// A 256KB ROM mirrored twice over the 512KB range sums up to the same value.
+static int kickstart_checksum_ok(unsigned char *data, unsigned int size) {
+  uint32_t sum = 0;
+
+  for (unsigned int i = 0; i < size; i += 4) {
+    uint32_t value = be32toh(*(uint32_t *)(data + i));
+    sum += value;
+    if (sum < value)
+      sum++;
+  }
+
+  return sum == 0xFFFFFFFF;
+}
+
+static unsigned char *load_shadow_rom_cache(char *filename) {
+  FILE *in = fopen(filename, "rb");
+  unsigned char *data = NULL;
+
+  if (!in)
+    return NULL;
+
+  data = (unsigned char *)calloc(1, KICKSTART_SIZE + MAP_TAIL_SIZE);
+  if (!data || fread(data, KICKSTART_SIZE, 1, in) != 1) {
+    printf("Kickstart cache file %s is unreadable or too short, ignoring it.\n", filename);
+    free(data);
+    data = NULL;
+  }
+
+  fclose(in);
+  return data;
+}
+
+// Copy the motherboard Kickstart ROM into host memory, so it runs at mapped ROM speed.
+// Needs the bus to be up and the Amiga held in its post-reset (OVL) state.
+static void shadow_kickstart_rom(void) {
+  unsigned char *data = NULL;
+
+  for (int i = 0; i < MAX_NUM_MAPPED_ITEMS; i++) {
+    if (cfg->map_type[i] == MAPTYPE_ROM && cfg->map_offset[i] <= KICKSTART_ADDR &&
+        cfg->map_offset[i] + cfg->map_size[i] > KICKSTART_ADDR) {
+      printf("Kickstart area is already mapped, not shadowing the motherboard ROM.\n");
+      return;
+    }
+  }
+
+  if (cfg->shadow_rom_file) {
+    data = load_shadow_rom_cache(cfg->shadow_rom_file);
+    if (data && cfg->shadow_rom_verify && !kickstart_checksum_ok(data, KICKSTART_SIZE)) {
+      printf("Kickstart cache file %s has a bad checksum, ignoring it.\n", cfg->shadow_rom_file);
+      free(data);
+      data = NULL;
+    }
+    if (data)
+      printf("Loaded shadowed Kickstart ROM from %s.\n", cfg->shadow_rom_file);
+  }
+
+  if (!data) {
+    data = (unsigned char *)calloc(1, KICKSTART_SIZE + MAP_TAIL_SIZE);
+    if (!data) {
+      printf("Failed to allocate memory for the shadowed Kickstart ROM.\n");
+      return;
+    }
+
+    printf("Reading Kickstart ROM from the motherboard...\n");
+    handle_mapped_block_read(cfg, KICKSTART_ADDR, data, KICKSTART_SIZE, OP_TYPE_MEM);
+
+    if (cfg->shadow_rom_verify && !kickstart_checksum_ok(data, KICKSTART_SIZE)) {
+      printf("Kickstart ROM read from the motherboard has a bad checksum, not shadowing it.\n");
+      free(data);
+      return;
+    }
+
+    if (cfg->shadow_rom_file) {
+      FILE *out = fopen(cfg->shadow_rom_file, "wb");
+      if (!out || fwrite(data, KICKSTART_SIZE, 1, out) != 1)
+        printf("Failed to write Kickstart cache file %s.\n", cfg->shadow_rom_file);
+      if (out)
+        fclose(out);
+    }
+  }
+
+  // Mirror at 0 like a ROM mapped with ovl=0, so it shows up there while OVL is set.
+  if (add_rom_data_mapping(cfg, KICKSTART_ADDR, KICKSTART_SIZE, 0, data, "shadow_rom") == -1) {
+    free(data);
+    return;
+  }
+  build_page_table(cfg);
+}
+
+// Timeslice statistics and the adaptive loop_cycles controller. Each slice is
+// timed, the time between slices is the main loop overhead. With loopcycles
+// auto, loop_cycles is sized from the measured time per CPU cycle so a slice
+// plus the overhead after it stays within the latency target: it shrinks at
+// once when a slice overruns and grows gradually once per window of slices.
+#define LOOP_WINDOW_SLICES 64
+#define LOOP_HIST_BUCKETS 16
+// A stopped CPU returns its whole slice almost at once, faster than any emulation could run it.
+#define LOOP_MAX_CYCLES_PER_NS 8
+
+struct loop_window {
+  uint64_t slices, cycles, exec_ns, overhead_ns;
+};
+
+static struct loop_window loop_window;
+static uint64_t loop_slices, loop_cycles_run, loop_exec_ns, loop_overhead_ns, loop_irqs;
+static uint64_t loop_cycles_sum, loop_adjustments;
+static uint64_t loop_start_ns, loop_last_end_ns;
+static unsigned int loop_cycles_min_seen = ~0U, loop_cycles_max_seen;
+static uint64_t loop_hist[LOOP_HIST_BUCKETS];  // Slice + overhead time, log2 microseconds
+static int loop_last_irq;
+
+static inline unsigned int clamp_loop_cycles(uint64_t cycles) {
+  if (cycles < cfg->loop_min_cycles)
+    return cfg->loop_min_cycles;
+  if (cycles > cfg->loop_max_cycles)
+    return cfg->loop_max_cycles;
+  return cycles;
+}
+
+static void adapt_loop_cycles(uint64_t exec_ns, uint64_t overhead_ns, int cycles) {
+  uint64_t target_ns = cfg->loop_latency_us * 1000ULL;
+  struct loop_window *w = &loop_window;
+
+  // A stopped CPU says nothing about the time per cycle.
+  if (cycles <= 0 || exec_ns * LOOP_MAX_CYCLES_PER_NS < (uint64_t)cycles)
+    return;
+
+  if (exec_ns > target_ns * 2) {
+    loop_cycles = clamp_loop_cycles((uint64_t)loop_cycles * target_ns / exec_ns);
+    loop_adjustments++;
+    memset(w, 0x00, sizeof(*w));
+    return;
+  }
+
+  w->slices++;
+  w->cycles += cycles;
+  w->exec_ns += exec_ns;
+  w->overhead_ns += overhead_ns;
+  if (w->slices < LOOP_WINDOW_SLICES)
+    return;
+
+  overhead_ns = w->overhead_ns / w->slices;
+  uint64_t budget_ns = (target_ns > overhead_ns) ? target_ns - overhead_ns : target_ns / 2;
+  uint64_t wanted = (w->exec_ns) ? budget_ns * w->cycles / w->exec_ns : cfg->loop_max_cycles;
+  unsigned int next = (wanted > loop_cycles) ? loop_cycles + (wanted - loop_cycles + 3) / 4 : wanted;
+
+  next = clamp_loop_cycles(next);
+  if (next != loop_cycles) {
+    loop_cycles = next;
+    loop_adjustments++;
+  }
+  memset(w, 0x00, sizeof(*w));
+}
+
+static inline void loop_slice_begin(void) {
+  loop_start_ns = get_time_ns();
+}
+
+static inline void loop_slice_end(int cycles) {
+  uint64_t end_ns = get_time_ns();
+  uint64_t exec_ns = end_ns - loop_start_ns;
+  uint64_t overhead_ns = loop_last_end_ns ? loop_start_ns - loop_last_end_ns : 0;
+  uint64_t us = (exec_ns + overhead_ns) / 1000;
+  int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+  loop_hist[(bucket < LOOP_HIST_BUCKETS) ? bucket : LOOP_HIST_BUCKETS - 1]++;
+  loop_slices++;
+  loop_cycles_sum += loop_cycles;
+  if (cycles > 0)
+    loop_cycles_run += cycles;
+  loop_exec_ns += exec_ns;
+  loop_overhead_ns += overhead_ns;
+  if (loop_cycles < loop_cycles_min_seen)
+    loop_cycles_min_seen = loop_cycles;
+  if (loop_cycles > loop_cycles_max_seen)
+    loop_cycles_max_seen = loop_cycles;
+
+  if (cfg->loop_auto)
+    adapt_loop_cycles(exec_ns, overhead_ns, cycles);
+  loop_last_end_ns = end_ns;
+
+  if (bus_stats) {
+    struct bus_stats_loop *l = &bus_stats->loop;
+    l->slices = loop_slices;
+    l->cycles = loop_cycles_run;
+    l->exec_ns = loop_exec_ns;
+    l->overhead_ns = loop_overhead_ns;
+    l->irqs = loop_irqs;
+    l->loop_cycles = loop_cycles;
+  }
+}
+
+// Counts interrupts as they are raised to the CPU, not every slice they stay pending.
+static inline void loop_set_irq(int level) {
+  if (loop_stats && level && level != loop_last_irq)
+    loop_irqs++;
+  loop_last_irq = level;
+  m68k_set_irq(level);
+}
+
+// The cheapest back to back pair of clock reads, taken off every timed bus access.
+static void calibrate_bus_sampling(void) {
+  bus_sample_overhead_ns = ~0ULL;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start_ns = get_time_ns();
+    uint64_t ns = get_time_ns() - start_ns;
+    if (ns < bus_sample_overhead_ns)
+      bus_sample_overhead_ns = ns;
+  }
+}
+
+static void print_loop_stats(void) {
+  uint64_t total_ns = loop_exec_ns + loop_overhead_ns;
+  double bus_ns = bus_samples ? (double)bus_sample_ns / bus_samples - bus_sample_overhead_ns : 0;
+
+  if (bus_stats) {
+    uint64_t bus_total_ns;
+    bus_stats_totals(&bus_accesses, &bus_total_ns);
+    bus_ns = bus_accesses ? (double)bus_total_ns / bus_accesses : 0;
+  }
+
+  if (!loop_stats || !loop_slices || !total_ns)
+    return;
+
+  printf("[LOOP] %llu timeslices, loop cycles %u to %u (average %.0f, %llu adjustments), %.0f cycles run per slice.\n",
+         (unsigned long long)loop_slices, loop_cycles_min_seen, loop_cycles_max_seen,
+         (double)loop_cycles_sum / loop_slices, (unsigned long long)loop_adjustments,
+         (double)loop_cycles_run / loop_slices);
+  printf("[LOOP] %.2f us per slice, %.2f us main loop overhead (%.1f%% of the time).\n",
+         loop_exec_ns / 1000.0 / loop_slices, loop_overhead_ns / 1000.0 / loop_slices,
+         loop_overhead_ns * 100.0 / total_ns);
+  printf("[LOOP] %llu interrupts, %.1f per second. %llu bus accesses, %.1f ns average, %.1f%% of the time waiting on the bus.\n",
+         (unsigned long long)loop_irqs, loop_irqs * 1e9 / total_ns, (unsigned long long)bus_accesses,
+         bus_ns, bus_accesses * bus_ns * 100.0 / total_ns);
+  printf("[LOOP] Slice + overhead time:");
+  for (int i = 0; i < LOOP_HIST_BUCKETS; i++) {
+    if (loop_hist[i])
+      printf(" <%uus:%llu", 1U << i, (unsigned long long)loop_hist[i]);
+  }
+  printf("\n");
+}
+
+// The IPL thread watches GPIO1 on its own core, publishes it in ipl_pending and
+// ends the running timeslice whenever it changes. The main loop then only reads
+// the interrupt level from the status register while the line is asserted.
+// A level change while the line stays asserted is still only picked up at the
+// end of a timeslice.
+static atomic_int ipl_pending;
+static atomic_int ipl_thread_running;
+static pthread_t ipl_thread;
+static struct bus_backend *ipl_bus;
+static uint64_t ipl_changes, ipl_polls;
+
+static void *ipl_thread_main(void *args) {
+  int pending = 0;
+  (void)args;
+
+  while (atomic_load_explicit(&ipl_thread_running, memory_order_relaxed)) {
+    ipl_polls++;
+    if (ipl_bus->irq_line() != pending) {
+      pending = !pending;
+      ipl_changes++;
+      atomic_store_explicit(&ipl_pending, pending, memory_order_relaxed);
+      // Only sets a flag the CPU thread checks between instructions, the CPU
+      // thread owns the rest of the timeslice state.
+      m68k_end_timeslice_async();
+    }
+    cpu_relax();
+  }
+
+  return NULL;
+}
+
+// Same core choice rules as the bus thread, with cpu set to -1 the core above
+// the one the emulator runs on is used.
+static int start_ipl_thread(int cpu) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t cpus;
+  int err;
+
+  if (num_cpus < 2) {
+    printf("Only one CPU core online, not starting an IPL thread.\n");
+    return -1;
+  }
+  if (cpu < 0)
+    cpu = (sched_getcpu() + 1) % num_cpus;
+  if (cpu == sched_getcpu()) {
+    printf("CPU %d is the one the emulator runs on, not starting an IPL thread.\n", cpu);
+    return -1;
+  }
+
+  ipl_bus = bus;
+  atomic_store(&ipl_pending, ipl_bus->irq_line());
+  atomic_store(&ipl_thread_running, 1);
+
+  err = pthread_create(&ipl_thread, NULL, ipl_thread_main, NULL);
+  if (err != 0) {
+    printf("Failed to create IPL thread: %s\n", strerror(err));
+    atomic_store(&ipl_thread_running, 0);
+    return -1;
+  }
+  pthread_setname_np(ipl_thread, "ipl");
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  err = pthread_setaffinity_np(ipl_thread, sizeof(cpus), &cpus);
+  if (err != 0)
+    printf("Failed to pin IPL thread to CPU %d: %s\n", cpu, strerror(err));
+  else
+    printf("IPL thread running on CPU %d.\n", cpu);
+
+  return 0;
+}
+
+static void stop_ipl_thread(void) {
+  if (!atomic_load(&ipl_thread_running))
+    return;
+
+  atomic_store(&ipl_thread_running, 0);
+  pthread_join(ipl_thread, NULL);
+  printf("IPL thread: %llu interrupt line changes in %llu polls.\n",
+         (unsigned long long)ipl_changes, (unsigned long long)ipl_polls);
+}
+
 void sigint_handler(int sig_num) {
   //if (sig_num) { }
   //cpu_emulation_running = 0;
 
   //return;
   printf("Received sigint %d, exiting.\n", sig_num);
+  stop_ipl_thread();
+  print_loop_stats();
+  bus_stats_print();
+  if (cfg->pair_profile_file)
+    m68k_write_pair_profile(cfg->pair_profile_file);
+  m68k_set_jit_perf_map(0);
   if (mouse_fd != -1)
     close(mouse_fd);
-  if (mem_fd)
-    close(mem_fd);
+  if (bus->print_stats)
+    bus->print_stats();
+  bus->shutdown();
 
   exit(0);
 }
 
-void *iplThread(void *args) {
-  printf("IPL thread running/n");
-
-  while (42) {
-
-    if (GET_GPIO(1) == 0) {
-      toggle = 1;
-      m68k_end_timeslice();
-   //printf("thread!/n");
-    } else {
-      toggle = 0;
-    };
-    usleep(1);
-  }
-
-}
-
 int main(int argc, char *argv[]) {
   int g;
   const struct sched_param priority = {99};
+  char *bus_name = NULL;
 
   // Some command line switch stuffles
   for (g = 1; g < argc; g++) {
@@ -209,6 +519,14 @@ int main(int argc, char *argv[]) {
         cfg = load_config_file(argv[g]);
       }
     }
+    else if (strcmp(argv[g], "--bus") == 0) {
+      if (g + 1 >= argc) {
+        printf("%s switch found, but no bus backend specified.\n", argv[g]);
+      } else {
+        g++;
+        bus_name = argv[g];
+      }
+    }
     else if (strcmp(argv[g], "--keyboard-file") == 0 || strcmp(argv[g], "--kbfile") == 0) {
       if (g + 1 >= argc) {
         printf("%s switch found, but no keyboard device path specified.\n", argv[g]);
@@ -236,11 +554,25 @@ int main(int argc, char *argv[]) {
   if (cfg) {
     if (cfg->cpu_type) cpu_type = cfg->cpu_type;
     if (cfg->loop_cycles) loop_cycles = cfg->loop_cycles;
+    if (cfg->loop_auto) loop_cycles = clamp_loop_cycles(loop_cycles);
+    // The bus statistics include the timeslice counters.
+    loop_stats = cfg->loop_stats || cfg->bus_stats;
+    if (loop_stats)
+      calibrate_bus_sampling();
+    if (!bus_name) bus_name = cfg->bus_name;
 
     if (!cfg->platform)
       cfg->platform = make_platform_config("none", "generic");
     cfg->platform->platform_initial_setup(cfg);
+    build_page_table(cfg);
+  }
+
+  if (bus_name) {
+    bus = get_bus_backend(bus_name);
+    if (!bus)
+      return 1;
   }
+  printf("Using %s bus backend.\n", bus->name);
 
   if (cfg->mouse_enabled) {
     mouse_fd = open(cfg->mouse_file, O_RDONLY | O_NONBLOCK);
@@ -256,80 +588,29 @@ int main(int argc, char *argv[]) {
   }
 
   sched_setscheduler(0, SCHED_FIFO, &priority);
-  mlockall(MCL_CURRENT);  // lock in memory to keep us from paging out
+  // lock in memory to keep us from paging out
+#ifdef MCL_ONFAULT
+  // Lazily backed RAM maps only get locked as the Amiga touches them
+  if (mlockall(MCL_CURRENT | MCL_ONFAULT) == -1)
+#endif
+    mlockall(MCL_CURRENT);
 
   InitGayle();
 
   signal(SIGINT, sigint_handler);
-  setup_io();
+  if (bus->setup(cfg, cfg->bus_options) == -1) {
+    printf("Failed to set up the %s bus backend.\n", bus->name);
+    return 1;
+  }
+  if (cfg->bus_stats && bus_stats_init() == -1)
+    printf("Bus accesses will not be accounted.\n");
+  if (cfg->bus_trace_file && bus_start_trace(cfg->bus_trace_file) == -1)
+    printf("Bus transactions will not be traced.\n");
+  if (cfg->bus_thread && bus_start_thread(cfg->bus_thread_cpu) == -1)
+    printf("Bus writes will be run on the CPU thread.\n");
 
   //goto skip_everything;
 
-  // Enable 200MHz CLK output on GPIO4, adjust divider and pll source depending
-  // on pi model
-  printf("Enable 200MHz GPCLK0 on GPIO4\n");
-
-  *(gpclk + (CLK_GP0_CTL / 4)) = CLK_PASSWD | (1 << 5);
-  usleep(10);
-  while ((*(gpclk + (CLK_GP0_CTL / 4))) & (1 << 7))
-    ;
-  usleep(100);
-  *(gpclk + (CLK_GP0_DIV / 4)) =
-      CLK_PASSWD | (6 << 12);  // divider , 6=200MHz on pi3
-  usleep(10);
-  *(gpclk + (CLK_GP0_CTL / 4)) =
-      CLK_PASSWD | 5 | (1 << 4);  // pll? 6=plld, 5=pllc
-  usleep(10);
-  while (((*(gpclk + (CLK_GP0_CTL / 4))) & (1 << 7)) == 0)
-    ;
-  usleep(100);
-
-  SET_GPIO_ALT(4, 0);  // gpclk0
-
-  // set SA to output
-  INP_GPIO(2);
-  OUT_GPIO(2);
-  INP_GPIO(3);
-  OUT_GPIO(3);
-  INP_GPIO(5);
-  OUT_GPIO(5);
-
-  // set gpio0 (aux0) and gpio1 (aux1) to input
-  INP_GPIO(0);
-  INP_GPIO(1);
-
-  // Set GPIO pins 6,7 and 8-23 to output
-  for (g = 6; g <= 23; g++) {
-    INP_GPIO(g);
-    OUT_GPIO(g);
-  }
-  printf("Precalculate GPIO8-23 as Output\n");
-  gpfsel0_o = *(gpio);  // store gpio ddr
-  printf("gpfsel0: %#x\n", gpfsel0_o);
-  gpfsel1_o = *(gpio + 1);  // store gpio ddr
-  printf("gpfsel1: %#x\n", gpfsel1_o);
-  gpfsel2_o = *(gpio + 2);  // store gpio ddr
-  printf("gpfsel2: %#x\n", gpfsel2_o);
-
-  // Set GPIO pins 8-23 to input
-  for (g = 8; g <= 23; g++) {
-    INP_GPIO(g);
-  }
-  printf("Precalculate GPIO8-23 as Input\n");
-  gpfsel0 = *(gpio);  // store gpio ddr
-  printf("gpfsel0: %#x\n", gpfsel0);
-  gpfsel1 = *(gpio + 1);  // store gpio ddr
-  printf("gpfsel1: %#x\n", gpfsel1);
-  gpfsel2 = *(gpio + 2);  // store gpio ddr
-  printf("gpfsel2: %#x\n", gpfsel2);
-
-  GPIO_CLR = 1 << 2;
-  GPIO_CLR = 1 << 3;
-  GPIO_SET = 1 << 5;
-
-  GPIO_SET = 1 << 6;
-  GPIO_SET = 1 << 7;
-
   // reset cpld statemachine first
 
   write_reg(0x01);
@@ -347,9 +628,18 @@ int main(int argc, char *argv[]) {
 
   usleep(1500);
 
+  if (cfg->shadow_rom)
+    shadow_kickstart_rom();
+
   m68k_init();
   printf("Setting CPU type to %d.\n", cpu_type);
   m68k_set_cpu_type(cpu_type);
+  if (cfg && cfg->block_cache)
+    m68k_set_block_cache(1);
+  if (cfg && cfg->jit)
+    m68k_set_jit(1);
+  if (cfg && cfg->jit_perf_map)
+    m68k_set_jit_perf_map(1);
   m68k_pulse_reset();
 
   if (maprom == 1) {
@@ -358,15 +648,9 @@ int main(int argc, char *argv[]) {
     m68k_set_reg(M68K_REG_PC, 0x0);
   }
 
-/*
-          pthread_t id;
-          int err;
-          err = pthread_create(&id, NULL, &iplThread, NULL);
-          if (err != 0)
-              printf("\ncan't create IPL thread :[%s]", strerror(err));
-          else
-              printf("\n IPL Thread created successfully\n");
-*/
+  if (cfg->ipl_thread && start_ipl_thread(cfg->ipl_thread_cpu) == -1)
+    printf("Interrupts will be polled from the main loop.\n");
+
   char c = 0;
 
   m68k_pulse_reset();
@@ -377,8 +661,15 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    if (cpu_emulation_running)
-      m68k_execute(loop_cycles);
+    if (cpu_emulation_running) {
+      verify_shadow_mappings(cfg);
+      if (loop_stats) {
+        loop_slice_begin();
+        loop_slice_end(m68k_execute(loop_cycles));
+      } else {
+        m68k_execute(loop_cycles);
+      }
+    }
     
     // FIXME: Rework this to use keyboard events instead.
     while (get_key_char(&c)) {
@@ -411,37 +702,33 @@ int main(int argc, char *argv[]) {
         }
       }
     }
-/*
-    if (toggle == 1){
+    if (ipl_bus ? atomic_load_explicit(&ipl_pending, memory_order_relaxed) : bus->irq_pending()) {
       srdata = read_reg();
-      m68k_set_irq((srdata >> 13) & 0xff);
-    } else {
-         m68k_set_irq(0);
-    };
-    usleep(1);
-*/
-
-
-    if (GET_GPIO(1) == 0) {
-      srdata = read_reg();
-      m68k_set_irq((srdata >> 13) & 0xff);
+      loop_set_irq((srdata >> 13) & 0xff);
     } else {
       if (CheckIrq() == 1) {
         write16(0xdff09c, 0x8008);
-        m68k_set_irq(2);
+        loop_set_irq(2);
       }
       else
-         m68k_set_irq(0);
+         loop_set_irq(0);
     };
 
   }
 
   stop_cpu_emulation:;
 
+  stop_ipl_thread();
+  print_loop_stats();
+  bus_stats_print();
+  if (cfg->pair_profile_file)
+    m68k_write_pair_profile(cfg->pair_profile_file);
+  m68k_set_jit_perf_map(0);
   if (mouse_fd != -1)
     close(mouse_fd);
-  if (mem_fd)
-    close(mem_fd);
+  if (bus->print_stats)
+    bus->print_stats();
+  bus->shutdown();
 
   return 0;
 }
@@ -461,8 +748,13 @@ int cpu_irq_ack(int level) {
 
 static unsigned int target = 0;
 
+// Whether the platform hooks want to see accesses to this address.
+static inline int is_custom_page(unsigned int address) {
+  return !cfg->page_type || cfg->page_type[address >> MAP_PAGE_SHIFT] == PAGETYPE_CUSTOM;
+}
+
 unsigned int m68k_read_memory_8(unsigned int address) {
-  if (cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_BYTE) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_BYTE) != -1) {
     return target;
   }
 
@@ -481,7 +773,7 @@ unsigned int m68k_read_memory_8(unsigned int address) {
 }
 
 unsigned int m68k_read_memory_16(unsigned int address) {
-  if (cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_WORD) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_WORD) != -1) {
     return target;
   }
 
@@ -527,7 +819,7 @@ unsigned int m68k_read_memory_16(unsigned int address) {
 }
 
 unsigned int m68k_read_memory_32(unsigned int address) {
-  if (cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_LONGWORD) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_read && cfg->platform->custom_read(cfg, address, &target, OP_TYPE_LONGWORD) != -1) {
     return target;
   }
 
@@ -547,8 +839,20 @@ unsigned int m68k_read_memory_32(unsigned int address) {
 //  return 1;
 }
 
+unsigned int m68k_read_disassembler_8(unsigned int address) {
+  return m68k_read_memory_8(address);
+}
+
+unsigned int m68k_read_disassembler_16(unsigned int address) {
+  return m68k_read_memory_16(address);
+}
+
+unsigned int m68k_read_disassembler_32(unsigned int address) {
+  return m68k_read_memory_32(address);
+}
+
 void m68k_write_memory_8(unsigned int address, unsigned int value) {
-  if (cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_BYTE) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_BYTE) != -1) {
     return;
   }
 
@@ -573,7 +877,7 @@ void m68k_write_memory_8(unsigned int address, unsigned int value) {
 }
 
 void m68k_write_memory_16(unsigned int address, unsigned int value) {
-  if (cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_WORD) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_WORD) != -1) {
     return;
   }
 
@@ -592,7 +896,7 @@ void m68k_write_memory_16(unsigned int address, unsigned int value) {
 }
 
 void m68k_write_memory_32(unsigned int address, unsigned int value) {
-  if (cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_LONGWORD) != -1) {
+  if (is_custom_page(address) && cfg->platform->custom_write && cfg->platform->custom_write(cfg, address, value, OP_TYPE_LONGWORD) != -1) {
     return;
   }
 
@@ -611,230 +915,3 @@ void m68k_write_memory_32(unsigned int address, unsigned int value) {
 
 //  return;
 }
-
-void write16(uint32_t address, uint32_t data) {
-  uint32_t addr_h_s = (address & 0x0000ffff) << 8;
-  uint32_t addr_h_r = (~address & 0x0000ffff) << 8;
-  uint32_t addr_l_s = (address >> 16) << 8;
-  uint32_t addr_l_r = (~address >> 16) << 8;
-  uint32_t data_s = (data & 0x0000ffff) << 8;
-  uint32_t data_r = (~data & 0x0000ffff) << 8;
-
-  //      asm volatile ("dmb" ::: "memory");
-  W16
-  *(gpio) = gpfsel0_o;
-  *(gpio + 1) = gpfsel1_o;
-  *(gpio + 2) = gpfsel2_o;
-
-  *(gpio + 7) = addr_h_s;
-  *(gpio + 10) = addr_h_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio + 7) = addr_l_s;
-  *(gpio + 10) = addr_l_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  // write phase
-  *(gpio + 7) = data_s;
-  *(gpio + 10) = data_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-  while ((GET_GPIO(0)))
-    ;
-  //     asm volatile ("dmb" ::: "memory");
-}
-
-void write8(uint32_t address, uint32_t data) {
-  if ((address & 1) == 0)
-    data = data + (data << 8);  // EVEN, A0=0,UDS
-  else
-    data = data & 0xff;  // ODD , A0=1,LDS
-  uint32_t addr_h_s = (address & 0x0000ffff) << 8;
-  uint32_t addr_h_r = (~address & 0x0000ffff) << 8;
-  uint32_t addr_l_s = (address >> 16) << 8;
-  uint32_t addr_l_r = (~address >> 16) << 8;
-  uint32_t data_s = (data & 0x0000ffff) << 8;
-  uint32_t data_r = (~data & 0x0000ffff) << 8;
-
-  //   asm volatile ("dmb" ::: "memory");
-  W8
-  *(gpio) = gpfsel0_o;
-  *(gpio + 1) = gpfsel1_o;
-  *(gpio + 2) = gpfsel2_o;
-
-  *(gpio + 7) = addr_h_s;
-  *(gpio + 10) = addr_h_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio + 7) = addr_l_s;
-  *(gpio + 10) = addr_l_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  // write phase
-  *(gpio + 7) = data_s;
-  *(gpio + 10) = data_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-  while ((GET_GPIO(0)))
-    ;
-  //   asm volatile ("dmb" ::: "memory");
-}
-
-uint32_t read16(uint32_t address) {
-  volatile int val;
-  uint32_t addr_h_s = (address & 0x0000ffff) << 8;
-  uint32_t addr_h_r = (~address & 0x0000ffff) << 8;
-  uint32_t addr_l_s = (address >> 16) << 8;
-  uint32_t addr_l_r = (~address >> 16) << 8;
-
-  //   asm volatile ("dmb" ::: "memory");
-  R16
-  *(gpio) = gpfsel0_o;
-  *(gpio + 1) = gpfsel1_o;
-  *(gpio + 2) = gpfsel2_o;
-
-  *(gpio + 7) = addr_h_s;
-  *(gpio + 10) = addr_h_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio + 7) = addr_l_s;
-  *(gpio + 10) = addr_l_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  // read phase
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-  GPIO_CLR = 1 << 6;
-  while (!(GET_GPIO(0)))
-    ;
-  GPIO_CLR = 1 << 6;
-  val = *(gpio + 13);
-  GPIO_SET = 1 << 6;
-  //    asm volatile ("dmb" ::: "memory");
-  return (val >> 8) & 0xffff;
-}
-
-uint32_t read8(uint32_t address) {
-  int val;
-  uint32_t addr_h_s = (address & 0x0000ffff) << 8;
-  uint32_t addr_h_r = (~address & 0x0000ffff) << 8;
-  uint32_t addr_l_s = (address >> 16) << 8;
-  uint32_t addr_l_r = (~address >> 16) << 8;
-
-  //    asm volatile ("dmb" ::: "memory");
-  R8
-  *(gpio) = gpfsel0_o;
-  *(gpio + 1) = gpfsel1_o;
-  *(gpio + 2) = gpfsel2_o;
-
-  *(gpio + 7) = addr_h_s;
-  *(gpio + 10) = addr_h_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  *(gpio + 7) = addr_l_s;
-  *(gpio + 10) = addr_l_r;
-  GPIO_CLR = 1 << 7;
-  GPIO_SET = 1 << 7;
-
-  // read phase
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-
-  GPIO_CLR = 1 << 6;
-  while (!(GET_GPIO(0)))
-    ;
-  GPIO_CLR = 1 << 6;
-  val = *(gpio + 13);
-  GPIO_SET = 1 << 6;
-  //    asm volatile ("dmb" ::: "memory");
-
-  val = (val >> 8) & 0xffff;
-  if ((address & 1) == 0)
-    return (val >> 8) & 0xff;  // EVEN, A0=0,UDS
-  else
-    return val & 0xff;  // ODD , A0=1,LDS
-}
-
-/******************************************************/
-
-void write_reg(unsigned int value) {
-  STATUSREGADDR
-  *(gpio) = gpfsel0_o;
-  *(gpio + 1) = gpfsel1_o;
-  *(gpio + 2) = gpfsel2_o;
-  *(gpio + 7) = (value & 0xffff) << 8;
-  *(gpio + 10) = (~value & 0xffff) << 8;
-  GPIO_CLR = 1 << 7;
-  GPIO_CLR = 1 << 7;  // delay
-  GPIO_SET = 1 << 7;
-  GPIO_SET = 1 << 7;
-  // Bus HIGH-Z
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-}
-
-uint16_t read_reg(void) {
-  uint32_t val;
-  STATUSREGADDR
-  // Bus HIGH-Z
-  *(gpio) = gpfsel0;
-  *(gpio + 1) = gpfsel1;
-  *(gpio + 2) = gpfsel2;
-  GPIO_CLR = 1 << 6;
-  GPIO_CLR = 1 << 6;  // delay
-  GPIO_CLR = 1 << 6;
-  GPIO_CLR = 1 << 6;
-  val = *(gpio + 13);
-  GPIO_SET = 1 << 6;
-  return (uint16_t)(val >> 8);
-}
-
-//
-// Set up a memory regions to access GPIO
-//
-void setup_io() {
-  /* open /dev/mem */
-  if ((mem_fd = open("/dev/mem", O_RDWR | O_SYNC)) < 0) {
-    printf("can't open /dev/mem \n");
-    exit(-1);
-  }
-
-  /* mmap GPIO */
-  gpio_map = mmap(
-      NULL,                    // Any adddress in our space will do
-      BCM2708_PERI_SIZE,       // Map length
-      PROT_READ | PROT_WRITE,  // Enable reading & writting to mapped memory
-      MAP_SHARED,              // Shared with other processes
-      mem_fd,                  // File to map
-      BCM2708_PERI_BASE        // Offset to GPIO peripheral
-  );
-
-  close(mem_fd);  // No need to keep mem_fd open after mmap
-
-  if (gpio_map == MAP_FAILED) {
-    printf("gpio mmap error %d\n", (int)gpio_map);  // errno also set!
-    exit(-1);
-  }
-
-  gpio = ((volatile unsigned *)gpio_map) + GPIO_ADDR / 4;
-  gpclk = ((volatile unsigned *)gpio_map) + GPCLK_ADDR / 4;
-
-}  // setup_io
@@ -331,6 +331,14 @@ int m68k_cycles_remaining(void);        /* Number of cycles left */
 void m68k_modify_timeslice(int cycles); /* Modify cycles left */
 void m68k_end_timeslice(void);          /* End timeslice now */
 
+/* End the running timeslice from another thread.  Sets a flag that
+ * m68k_execute() checks after every instruction, so it returns after the
+ * current one with the cycles it actually ran.  A request that comes in after
+ * m68k_execute() returned is dropped when the next timeslice finishes, and
+ * may end that one early.
+ */
+void m68k_end_timeslice_async(void);
+
 /* Set the IPL0-IPL2 pins on the CPU (IRQ).
  * A transition from < 7 to 7 will cause a non-maskable interrupt (NMI).
  * Setting IRQ to 0 will clear an interrupt request.
@@ -344,6 +352,60 @@ void m68k_set_irq(unsigned int int_level);
 void m68k_set_virq(unsigned int level, unsigned int active);
 unsigned int m68k_get_virq(unsigned int level);
 
+/* Map a range of the address space directly to host memory.
+ * You must enable M68K_HOST_PAGE_MAP in m68kconf.h.
+ * Reads from pages with a read pointer and writes to pages with a write
+ * pointer are done by the CPU core as big endian loads and stores on host
+ * memory, without calling m68k_read_memory_xx() or m68k_write_memory_xx().
+ * Passing NULL for a pointer sends accesses to those pages back to the
+ * memory callbacks.  address and size must be multiples of
+ * M68K_HOST_PAGE_SIZE.  Pages are meant to be mapped once after
+ * m68k_clear_host_pages(), to change the memory behind a page that is
+ * already mapped, clear and rebuild the whole map.
+ */
+#define M68K_HOST_PAGE_SHIFT 16
+#define M68K_HOST_PAGE_SIZE  (1 << M68K_HOST_PAGE_SHIFT)
+#define M68K_HOST_PAGE_MASK  (M68K_HOST_PAGE_SIZE - 1)
+#define M68K_HOST_PAGE_COUNT (1 << (32 - M68K_HOST_PAGE_SHIFT))
+void m68k_set_host_pages(unsigned int address, unsigned int size, unsigned char *read_ptr, unsigned char *write_ptr);
+
+/* Send all accesses back to the memory callbacks and drop all cached code */
+void m68k_clear_host_pages(void);
+
+/* Enable or disable the decoded block cache.
+ * You must enable M68K_BLOCK_CACHE in m68kconf.h.
+ * Default behavior: disabled.
+ */
+void m68k_set_block_cache(int enable);
+
+/* Translate frequently run blocks from the block cache into host machine
+ * code.  Only has an effect while the block cache is enabled.
+ * You must enable M68K_JIT in m68kconf.h.
+ * Default behavior: disabled.
+ */
+void m68k_set_jit(int enable);
+
+/* Write the address and size of every block the JIT translates to
+ * /tmp/perf-<pid>.map, so perf can attribute samples in translated code.
+ * Disabling it closes the file.
+ * You must enable M68K_JIT in m68kconf.h.
+ * Default behavior: disabled.
+ */
+void m68k_set_jit_perf_map(int enable);
+
+/* Write how often each pair of opcode handlers ran back to back to a text
+ * file, most frequent first, for m68kmake to generate fused handlers from.
+ * Returns 0 on success, -1 on failure.
+ * You must enable M68K_PAIR_PROFILE in m68kconf.h.
+ */
+int m68k_write_pair_profile(const char* filename);
+
+/* Tell the CPU that host mapped memory was modified behind its back, so
+ * any blocks decoded from the range are dropped.  Writes done by the CPU
+ * itself are tracked automatically.
+ */
+void m68k_invalidate_code(unsigned int address, unsigned int size);
+
 /* Halt the CPU as if you pulsed the HALT pin. */
 void m68k_pulse_halt(void);
 
@@ -112,8 +112,8 @@ M68KMAKE_PROTOTYPE_FOOTER
 /* Build the opcode handler table */
 void m68ki_build_opcode_table(void);
 
-extern void (*m68ki_instruction_jump_table[0x10000])(void); /* opcode handler jump table */
-extern unsigned char m68ki_cycles[][0x10000];
+/* Switch to the opcode handlers of a CPU family */
+void m68ki_set_opcode_family(unsigned int family);
 
 
 /* ======================================================================== */
@@ -134,15 +134,12 @@ M68KMAKE_TABLE_HEADER
 #include <stdio.h>
 #include "m68kops.h"
 
-#define NUM_CPU_TYPES 5
-
-void  (*m68ki_instruction_jump_table[0x10000])(void); /* opcode handler jump table */
-unsigned char m68ki_cycles[NUM_CPU_TYPES][0x10000]; /* Cycles used by CPU type */
+uint16 m68ki_instruction_index[0x10000]; /* Opcode handler table row by opcode */
 
 /* This is used to generate the opcode handler jump table */
 typedef struct
 {
-	void (*opcode_handler)(void);        /* handler function */
+	void (*opcode_handler[NUM_CPU_FAMILIES])(void); /* handler function by CPU family */
 	unsigned int  mask;                  /* mask on opcode */
 	unsigned int  match;                 /* what to match after masking */
 	unsigned char cycles[NUM_CPU_TYPES]; /* cycles each cpu type takes */
@@ -159,27 +156,55 @@ static const opcode_handler_struct m68k_opcode_handler_table[] =
 XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 M68KMAKE_TABLE_FOOTER
 
-	{0, 0, 0, {0, 0, 0, 0, 0}}
+	{{0, 0, 0}, 0, 0, {0, 0, 0, 0, 0}}
 };
 
+#define NUM_OPCODE_HANDLERS (sizeof(m68k_opcode_handler_table) / sizeof(m68k_opcode_handler_table[0]))
+
+/* Handler and cycles of each table row.  The terminating row is used for the
+ * opcodes no handler matches: illegal instruction, no cycles of its own.
+ */
+m68ki_instruction_handler m68ki_instruction_handlers[NUM_OPCODE_HANDLERS];
+
+
+static void m68ki_set_opcode_handler(int instr, const opcode_handler_struct *ostruct)
+{
+	m68ki_instruction_index[instr] = ostruct - m68k_opcode_handler_table;
+}
+
+/* Switch to the opcode handlers of a CPU family */
+void m68ki_set_opcode_family(unsigned int family)
+{
+	void (*handler)(void);
+	uint row;
+
+	for(row = 0; row < NUM_OPCODE_HANDLERS; row++)
+	{
+		handler = m68k_opcode_handler_table[row].opcode_handler[family];
+		m68ki_instruction_handlers[row].handler = handler ? handler : m68k_op_illegal;
+	}
+}
 
 /* Build the opcode handler jump table */
 void m68ki_build_opcode_table(void)
 {
 	const opcode_handler_struct *ostruct;
-	int cycle_cost;
-	int instr;
+	uint row;
 	int i;
 	int j;
 	int k;
 
-	for(i = 0; i < 0x10000; i++)
+	for(row = 0; row < NUM_OPCODE_HANDLERS; row++)
 	{
-		/* default to illegal */
-		m68ki_instruction_jump_table[i] = m68k_op_illegal;
+		ostruct = &m68k_opcode_handler_table[row];
 		for(k=0;k<NUM_CPU_TYPES;k++)
-			m68ki_cycles[k][i] = 0;
+			m68ki_instruction_handlers[row].cycles[k] = ostruct->cycles[k];
 	}
+	m68ki_set_opcode_family(CPU_FAMILY);
+
+	/* default to illegal */
+	for(i = 0; i < 0x10000; i++)
+		m68ki_instruction_index[i] = NUM_OPCODE_HANDLERS - 1;
 
 	ostruct = m68k_opcode_handler_table;
 	while(ostruct->mask != 0xff00)
@@ -187,22 +212,14 @@ void m68ki_build_opcode_table(void)
 		for(i = 0;i < 0x10000;i++)
 		{
 			if((i & ostruct->mask) == ostruct->match)
-			{
-				m68ki_instruction_jump_table[i] = ostruct->opcode_handler;
-				for(k=0;k<NUM_CPU_TYPES;k++)
-					m68ki_cycles[k][i] = ostruct->cycles[k];
-			}
+				m68ki_set_opcode_handler(i, ostruct);
 		}
 		ostruct++;
 	}
 	while(ostruct->mask == 0xff00)
 	{
 		for(i = 0;i <= 0xff;i++)
-		{
-			m68ki_instruction_jump_table[ostruct->match | i] = ostruct->opcode_handler;
-			for(k=0;k<NUM_CPU_TYPES;k++)
-				m68ki_cycles[k][ostruct->match | i] = ostruct->cycles[k];
-		}
+			m68ki_set_opcode_handler(ostruct->match | i, ostruct);
 		ostruct++;
 	}
 	while(ostruct->mask == 0xf1f8)
@@ -210,61 +227,31 @@ void m68ki_build_opcode_table(void)
 		for(i = 0;i < 8;i++)
 		{
 			for(j = 0;j < 8;j++)
-			{
-				instr = ostruct->match | (i << 9) | j;
-				m68ki_instruction_jump_table[instr] = ostruct->opcode_handler;
-				for(k=0;k<NUM_CPU_TYPES;k++)
-					m68ki_cycles[k][instr] = ostruct->cycles[k];
-				// For all shift operations with known shift distance (encoded in instruction word)
-				if((instr & 0xf000) == 0xe000 && (!(instr & 0x20)))
-				{
-					// On the 68000 and 68010 shift distance affect execution time.
-					// Add the cycle cost of shifting; 2 times the shift distance
-					cycle_cost = ((((i-1)&7)+1)<<1);
-					m68ki_cycles[0][instr] += cycle_cost;
-					m68ki_cycles[1][instr] += cycle_cost;
-					// On the 68020 shift distance does not affect execution time
-					m68ki_cycles[2][instr] += 0;
-				}
-			}
+				m68ki_set_opcode_handler(ostruct->match | (i << 9) | j, ostruct);
 		}
 		ostruct++;
 	}
 	while(ostruct->mask == 0xfff0)
 	{
 		for(i = 0;i <= 0x0f;i++)
-		{
-			m68ki_instruction_jump_table[ostruct->match | i] = ostruct->opcode_handler;
-			for(k=0;k<NUM_CPU_TYPES;k++)
-				m68ki_cycles[k][ostruct->match | i] = ostruct->cycles[k];
-		}
+			m68ki_set_opcode_handler(ostruct->match | i, ostruct);
 		ostruct++;
 	}
 	while(ostruct->mask == 0xf1ff)
 	{
 		for(i = 0;i <= 0x07;i++)
-		{
-			m68ki_instruction_jump_table[ostruct->match | (i << 9)] = ostruct->opcode_handler;
-			for(k=0;k<NUM_CPU_TYPES;k++)
-				m68ki_cycles[k][ostruct->match | (i << 9)] = ostruct->cycles[k];
-		}
+			m68ki_set_opcode_handler(ostruct->match | (i << 9), ostruct);
 		ostruct++;
 	}
 	while(ostruct->mask == 0xfff8)
 	{
 		for(i = 0;i <= 0x07;i++)
-		{
-			m68ki_instruction_jump_table[ostruct->match | i] = ostruct->opcode_handler;
-			for(k=0;k<NUM_CPU_TYPES;k++)
-				m68ki_cycles[k][ostruct->match | i] = ostruct->cycles[k];
-		}
+			m68ki_set_opcode_handler(ostruct->match | i, ostruct);
 		ostruct++;
 	}
 	while(ostruct->mask == 0xffff)
 	{
-		m68ki_instruction_jump_table[ostruct->match] = ostruct->opcode_handler;
-		for(k=0;k<NUM_CPU_TYPES;k++)
-			m68ki_cycles[k][ostruct->match] = ostruct->cycles[k];
+		m68ki_set_opcode_handler(ostruct->match, ostruct);
 		ostruct++;
 	}
 }
@@ -285,6 +272,78 @@ extern void m68040_fpu_op0(void);
 extern void m68040_fpu_op1(void);
 extern void m68881_mmu_ops();
 
+#if M68K_THREADED_DISPATCH
+
+/* The handlers are inlined into m68ki_execute_threaded(), and still exist as
+ * functions for the jump table used by the block cache.
+ */
+#define M68KI_HANDLER_INLINE inline __attribute__((always_inline))
+
+/* Fetch the next opcode.  This is the loop body of m68k_execute() up to the
+ * handler call.
+ */
+#define M68KI_THREADED_FETCH() \
+	do { \
+		int i_; \
+		m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */ \
+		m68ki_use_data_space(); /* auto-disable (see m68kcpu.h) */ \
+		m68ki_instr_hook(REG_PC); /* auto-disable (see m68kcpu.h) */ \
+		REG_PPC = REG_PC; \
+		for(i_ = 15; i_ >= 0; i_--) \
+			REG_DA_SAVE[i_] = REG_DA[i_]; \
+		REG_IR = m68ki_read_imm_16(); \
+	} while(0)
+
+/* Fetch the next opcode and jump to its handler */
+#define M68KI_THREADED_DISPATCH() \
+	do { \
+		M68KI_THREADED_FETCH(); \
+		goto *handler_labels[m68ki_instruction_index[REG_IR]]; \
+	} while(0)
+
+/* Account for the instruction just run by the handler of the given table row,
+ * and stop if the cycles ran out
+ */
+#define M68KI_THREADED_END(ROW) \
+	do { \
+		USE_CYCLES(m68ki_instruction_handlers[ROW].cycles[CYC_INSTR_TYPE]); \
+		m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */ \
+		if(SLICE_OVER()) \
+			return; \
+	} while(0)
+
+/* Finish the instruction of the given table row and go on with the next one */
+#define M68KI_THREADED_NEXT(ROW) \
+	do { \
+		M68KI_THREADED_END(ROW); \
+		M68KI_THREADED_DISPATCH(); \
+	} while(0)
+
+#else
+
+#define M68KI_HANDLER_INLINE
+
+#endif /* M68K_THREADED_DISPATCH */
+
+/* Handlers that depend on the CPU type are generated once per CPU family,
+ * with CPU_TYPE masked to the types of the family.  The mask doesn't change
+ * the value for a CPU of that family, but lets the compiler fold away the
+ * CPU_TYPE_IS_xxx() checks for the other families.  Telling GCC that the
+ * result is never 0 also folds the checks that hold for the whole family.
+ */
+#define M68KI_CPU_TYPE_ANY        m68ki_cpu.cpu_type
+#ifdef __GNUC__
+#define M68KI_CPU_TYPE_FAMILY(F) \
+	__extension__ ({ \
+		uint type_ = m68ki_cpu.cpu_type & CPU_TYPES_FAMILY_##F; \
+		if(!type_) \
+			__builtin_unreachable(); \
+		type_; \
+	})
+#else
+#define M68KI_CPU_TYPE_FAMILY(F)  (m68ki_cpu.cpu_type & CPU_TYPES_FAMILY_##F)
+#endif
+
 /* ======================================================================== */
 /* ========================= INSTRUCTION HANDLERS ========================= */
 /* ======================================================================== */
@@ -1073,10 +1132,7 @@ M68KMAKE_OP(add, 8, er, d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -1089,10 +1145,7 @@ M68KMAKE_OP(add, 8, er, .)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -1105,10 +1158,7 @@ M68KMAKE_OP(add, 16, er, d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -1121,10 +1171,7 @@ M68KMAKE_OP(add, 16, er, a)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -1137,10 +1184,7 @@ M68KMAKE_OP(add, 16, er, .)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -1153,10 +1197,7 @@ M68KMAKE_OP(add, 32, er, d)
 	uint dst = *r_dst;
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -1169,10 +1210,7 @@ M68KMAKE_OP(add, 32, er, a)
 	uint dst = *r_dst;
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -1185,10 +1223,7 @@ M68KMAKE_OP(add, 32, er, .)
 	uint dst = *r_dst;
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -1201,10 +1236,7 @@ M68KMAKE_OP(add, 8, re, .)
 	uint dst = m68ki_read_8(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -1217,10 +1249,7 @@ M68KMAKE_OP(add, 16, re, .)
 	uint dst = m68ki_read_16(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -1233,10 +1262,7 @@ M68KMAKE_OP(add, 32, re, .)
 	uint dst = m68ki_read_32(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
@@ -1299,10 +1325,7 @@ M68KMAKE_OP(addi, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -1315,10 +1338,7 @@ M68KMAKE_OP(addi, 8, ., .)
 	uint dst = m68ki_read_8(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -1331,10 +1351,7 @@ M68KMAKE_OP(addi, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -1347,10 +1364,7 @@ M68KMAKE_OP(addi, 16, ., .)
 	uint dst = m68ki_read_16(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -1363,10 +1377,7 @@ M68KMAKE_OP(addi, 32, ., d)
 	uint dst = *r_dst;
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -1379,10 +1390,7 @@ M68KMAKE_OP(addi, 32, ., .)
 	uint dst = m68ki_read_32(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
@@ -1395,10 +1403,7 @@ M68KMAKE_OP(addq, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -1411,10 +1416,7 @@ M68KMAKE_OP(addq, 8, ., .)
 	uint dst = m68ki_read_8(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_V = VFLAG_ADD_8(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_ADD_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -1427,10 +1429,7 @@ M68KMAKE_OP(addq, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -1451,10 +1450,7 @@ M68KMAKE_OP(addq, 16, ., .)
 	uint dst = m68ki_read_16(ea);
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_V = VFLAG_ADD_16(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_ADD_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -1467,10 +1463,7 @@ M68KMAKE_OP(addq, 32, ., d)
 	uint dst = *r_dst;
 	uint res = src + dst;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -1492,10 +1485,7 @@ M68KMAKE_OP(addq, 32, ., .)
 	uint res = src + dst;
 
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_V = VFLAG_ADD_32(src, dst, res);
-	FLAG_X = FLAG_C = CFLAG_ADD_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_ADD_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
@@ -3863,10 +3853,7 @@ M68KMAKE_OP(cmp, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(DX);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -3876,10 +3863,7 @@ M68KMAKE_OP(cmp, 8, ., .)
 	uint dst = MASK_OUT_ABOVE_8(DX);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -3889,10 +3873,7 @@ M68KMAKE_OP(cmp, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(DX);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -3902,10 +3883,7 @@ M68KMAKE_OP(cmp, 16, ., a)
 	uint dst = MASK_OUT_ABOVE_16(DX);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -3915,10 +3893,7 @@ M68KMAKE_OP(cmp, 16, ., .)
 	uint dst = MASK_OUT_ABOVE_16(DX);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -3928,10 +3903,7 @@ M68KMAKE_OP(cmp, 32, ., d)
 	uint dst = DX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -3941,10 +3913,7 @@ M68KMAKE_OP(cmp, 32, ., a)
 	uint dst = DX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -3954,10 +3923,7 @@ M68KMAKE_OP(cmp, 32, ., .)
 	uint dst = DX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -3967,10 +3933,7 @@ M68KMAKE_OP(cmpa, 16, ., d)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -3980,10 +3943,7 @@ M68KMAKE_OP(cmpa, 16, ., a)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -3993,10 +3953,7 @@ M68KMAKE_OP(cmpa, 16, ., .)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4006,10 +3963,7 @@ M68KMAKE_OP(cmpa, 32, ., d)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4019,10 +3973,7 @@ M68KMAKE_OP(cmpa, 32, ., a)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4032,10 +3983,7 @@ M68KMAKE_OP(cmpa, 32, ., .)
 	uint dst = AX;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4045,10 +3993,7 @@ M68KMAKE_OP(cmpi, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(DY);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4058,10 +4003,7 @@ M68KMAKE_OP(cmpi, 8, ., .)
 	uint dst = M68KMAKE_GET_OPER_AY_8;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4073,10 +4015,7 @@ M68KMAKE_OP(cmpi, 8, ., pcdi)
 		uint dst = OPER_PCDI_8();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_8(res);
-		FLAG_Z = MASK_OUT_ABOVE_8(res);
-		FLAG_V = VFLAG_SUB_8(src, dst, res);
-		FLAG_C = CFLAG_8(res);
+		M68KI_FLAGS_CMP_8(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4091,10 +4030,7 @@ M68KMAKE_OP(cmpi, 8, ., pcix)
 		uint dst = OPER_PCIX_8();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_8(res);
-		FLAG_Z = MASK_OUT_ABOVE_8(res);
-		FLAG_V = VFLAG_SUB_8(src, dst, res);
-		FLAG_C = CFLAG_8(res);
+		M68KI_FLAGS_CMP_8(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4107,10 +4043,7 @@ M68KMAKE_OP(cmpi, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(DY);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -4120,10 +4053,7 @@ M68KMAKE_OP(cmpi, 16, ., .)
 	uint dst = M68KMAKE_GET_OPER_AY_16;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -4135,10 +4065,7 @@ M68KMAKE_OP(cmpi, 16, ., pcdi)
 		uint dst = OPER_PCDI_16();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_16(res);
-		FLAG_Z = MASK_OUT_ABOVE_16(res);
-		FLAG_V = VFLAG_SUB_16(src, dst, res);
-		FLAG_C = CFLAG_16(res);
+		M68KI_FLAGS_CMP_16(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4153,10 +4080,7 @@ M68KMAKE_OP(cmpi, 16, ., pcix)
 		uint dst = OPER_PCIX_16();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_16(res);
-		FLAG_Z = MASK_OUT_ABOVE_16(res);
-		FLAG_V = VFLAG_SUB_16(src, dst, res);
-		FLAG_C = CFLAG_16(res);
+		M68KI_FLAGS_CMP_16(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4170,10 +4094,7 @@ M68KMAKE_OP(cmpi, 32, ., d)
 	uint res = dst - src;
 
 	m68ki_cmpild_callback(src, REG_IR & 7);		   /* auto-disable (see m68kcpu.h) */
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4183,10 +4104,7 @@ M68KMAKE_OP(cmpi, 32, ., .)
 	uint dst = M68KMAKE_GET_OPER_AY_32;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -4198,10 +4116,7 @@ M68KMAKE_OP(cmpi, 32, ., pcdi)
 		uint dst = OPER_PCDI_32();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_32(res);
-		FLAG_Z = MASK_OUT_ABOVE_32(res);
-		FLAG_V = VFLAG_SUB_32(src, dst, res);
-		FLAG_C = CFLAG_SUB_32(src, dst, res);
+		M68KI_FLAGS_CMP_32(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4216,10 +4131,7 @@ M68KMAKE_OP(cmpi, 32, ., pcix)
 		uint dst = OPER_PCIX_32();
 		uint res = dst - src;
 
-		FLAG_N = NFLAG_32(res);
-		FLAG_Z = MASK_OUT_ABOVE_32(res);
-		FLAG_V = VFLAG_SUB_32(src, dst, res);
-		FLAG_C = CFLAG_SUB_32(src, dst, res);
+		M68KI_FLAGS_CMP_32(src, dst, res);
 		return;
 	}
 	m68ki_exception_illegal();
@@ -4232,10 +4144,7 @@ M68KMAKE_OP(cmpm, 8, ., ax7)
 	uint dst = OPER_A7_PI_8();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4245,10 +4154,7 @@ M68KMAKE_OP(cmpm, 8, ., ay7)
 	uint dst = OPER_AX_PI_8();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4258,10 +4164,7 @@ M68KMAKE_OP(cmpm, 8, ., axy7)
 	uint dst = OPER_A7_PI_8();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4271,10 +4174,7 @@ M68KMAKE_OP(cmpm, 8, ., .)
 	uint dst = OPER_AX_PI_8();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_C = CFLAG_8(res);
+	M68KI_FLAGS_CMP_8(src, dst, res);
 }
 
 
@@ -4284,10 +4184,7 @@ M68KMAKE_OP(cmpm, 16, ., .)
 	uint dst = OPER_AX_PI_16();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_C = CFLAG_16(res);
+	M68KI_FLAGS_CMP_16(src, dst, res);
 }
 
 
@@ -4297,10 +4194,7 @@ M68KMAKE_OP(cmpm, 32, ., .)
 	uint dst = OPER_AX_PI_32();
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_C = CFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_CMP_32(src, dst, res);
 }
 
 
@@ -8844,7 +8738,7 @@ M68KMAKE_OP(roxr, 8, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_8(*r_dst);
 	FLAG_Z = MASK_OUT_ABOVE_8(*r_dst);
 	FLAG_V = VFLAG_CLEAR;
@@ -8874,7 +8768,7 @@ M68KMAKE_OP(roxr, 16, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_16(*r_dst);
 	FLAG_Z = MASK_OUT_ABOVE_16(*r_dst);
 	FLAG_V = VFLAG_CLEAR;
@@ -8908,7 +8802,7 @@ M68KMAKE_OP(roxr, 32, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_32(*r_dst);
 	FLAG_Z = *r_dst;
 	FLAG_V = VFLAG_CLEAR;
@@ -8932,7 +8826,7 @@ M68KMAKE_OP(roxr, 32, r, .)
 	}
 	else
 		res = src;
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_32(res);
 	FLAG_Z = res;
 	FLAG_V = VFLAG_CLEAR;
@@ -9069,7 +8963,7 @@ M68KMAKE_OP(roxl, 8, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_8(*r_dst);
 	FLAG_Z = MASK_OUT_ABOVE_8(*r_dst);
 	FLAG_V = VFLAG_CLEAR;
@@ -9099,7 +8993,7 @@ M68KMAKE_OP(roxl, 16, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_16(*r_dst);
 	FLAG_Z = MASK_OUT_ABOVE_16(*r_dst);
 	FLAG_V = VFLAG_CLEAR;
@@ -9133,7 +9027,7 @@ M68KMAKE_OP(roxl, 32, r, .)
 		return;
 	}
 
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_32(*r_dst);
 	FLAG_Z = *r_dst;
 	FLAG_V = VFLAG_CLEAR;
@@ -9157,7 +9051,7 @@ M68KMAKE_OP(roxl, 32, r, .)
 	}
 	else
 		res = src;
-	FLAG_C = FLAG_X;
+	FLAG_C = XFLAG_VALUE;
 	FLAG_N = NFLAG_32(res);
 	FLAG_Z = res;
 	FLAG_V = VFLAG_CLEAR;
@@ -9519,8 +9413,8 @@ M68KMAKE_OP(stop, 0, ., .)
 		m68ki_trace_t0();			   /* auto-disable (see m68kcpu.h) */
 		CPU_STOPPED |= STOP_LEVEL_STOP;
 		m68ki_set_sr(new_sr);
-		if(m68ki_remaining_cycles >= CYC_INSTRUCTION[REG_IR])
-			m68ki_remaining_cycles = CYC_INSTRUCTION[REG_IR];
+		if(m68ki_remaining_cycles >= CYC_INSTRUCTION(REG_IR))
+			m68ki_remaining_cycles = CYC_INSTRUCTION(REG_IR);
 		else
 			USE_ALL_CYCLES();
 		return;
@@ -9536,10 +9430,7 @@ M68KMAKE_OP(sub, 8, er, d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -9552,10 +9443,7 @@ M68KMAKE_OP(sub, 8, er, .)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -9568,10 +9456,7 @@ M68KMAKE_OP(sub, 16, er, d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -9584,10 +9469,7 @@ M68KMAKE_OP(sub, 16, er, a)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -9600,10 +9482,7 @@ M68KMAKE_OP(sub, 16, er, .)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -9616,10 +9495,7 @@ M68KMAKE_OP(sub, 32, er, d)
 	uint dst = *r_dst;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -9632,10 +9508,7 @@ M68KMAKE_OP(sub, 32, er, a)
 	uint dst = *r_dst;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -9648,10 +9521,7 @@ M68KMAKE_OP(sub, 32, er, .)
 	uint dst = *r_dst;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -9664,10 +9534,7 @@ M68KMAKE_OP(sub, 8, re, .)
 	uint dst = m68ki_read_8(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -9680,10 +9547,7 @@ M68KMAKE_OP(sub, 16, re, .)
 	uint dst = m68ki_read_16(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -9696,10 +9560,7 @@ M68KMAKE_OP(sub, 32, re, .)
 	uint dst = m68ki_read_32(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
@@ -9762,10 +9623,7 @@ M68KMAKE_OP(subi, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -9778,10 +9636,7 @@ M68KMAKE_OP(subi, 8, ., .)
 	uint dst = m68ki_read_8(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -9794,10 +9649,7 @@ M68KMAKE_OP(subi, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -9810,10 +9662,7 @@ M68KMAKE_OP(subi, 16, ., .)
 	uint dst = m68ki_read_16(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -9826,10 +9675,7 @@ M68KMAKE_OP(subi, 32, ., d)
 	uint dst = *r_dst;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -9842,10 +9688,7 @@ M68KMAKE_OP(subi, 32, ., .)
 	uint dst = m68ki_read_32(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
@@ -9858,10 +9701,7 @@ M68KMAKE_OP(subq, 8, ., d)
 	uint dst = MASK_OUT_ABOVE_8(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_8(*r_dst) | FLAG_Z;
 }
@@ -9874,10 +9714,7 @@ M68KMAKE_OP(subq, 8, ., .)
 	uint dst = m68ki_read_8(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_8(res);
-	FLAG_Z = MASK_OUT_ABOVE_8(res);
-	FLAG_X = FLAG_C = CFLAG_8(res);
-	FLAG_V = VFLAG_SUB_8(src, dst, res);
+	M68KI_FLAGS_SUB_8(src, dst, res);
 
 	m68ki_write_8(ea, FLAG_Z);
 }
@@ -9890,10 +9727,7 @@ M68KMAKE_OP(subq, 16, ., d)
 	uint dst = MASK_OUT_ABOVE_16(*r_dst);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	*r_dst = MASK_OUT_BELOW_16(*r_dst) | FLAG_Z;
 }
@@ -9914,10 +9748,7 @@ M68KMAKE_OP(subq, 16, ., .)
 	uint dst = m68ki_read_16(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_16(res);
-	FLAG_Z = MASK_OUT_ABOVE_16(res);
-	FLAG_X = FLAG_C = CFLAG_16(res);
-	FLAG_V = VFLAG_SUB_16(src, dst, res);
+	M68KI_FLAGS_SUB_16(src, dst, res);
 
 	m68ki_write_16(ea, FLAG_Z);
 }
@@ -9930,10 +9761,7 @@ M68KMAKE_OP(subq, 32, ., d)
 	uint dst = *r_dst;
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	*r_dst = FLAG_Z;
 }
@@ -9954,10 +9782,7 @@ M68KMAKE_OP(subq, 32, ., .)
 	uint dst = m68ki_read_32(ea);
 	uint res = dst - src;
 
-	FLAG_N = NFLAG_32(res);
-	FLAG_Z = MASK_OUT_ABOVE_32(res);
-	FLAG_X = FLAG_C = CFLAG_SUB_32(src, dst, res);
-	FLAG_V = VFLAG_SUB_32(src, dst, res);
+	M68KI_FLAGS_SUB_32(src, dst, res);
 
 	m68ki_write_32(ea, FLAG_Z);
 }
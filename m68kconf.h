@@ -188,6 +188,66 @@
 #define M68K_EMULATE_PMMU   OPT_ON
 
 
+/* If ON, the CPU will access host memory directly for pages that have been
+ * mapped using m68k_set_host_pages(), and only call m68k_read_memory_xx()
+ * and m68k_write_memory_xx() for the rest of the address space.
+ */
+#define M68K_HOST_PAGE_MAP  OPT_ON
+
+
+/* If ON, straight-line code in host mapped pages is decoded once into blocks
+ * of opcode handlers and pre-extracted instruction words, which m68k_execute()
+ * then runs without fetching and dispatching each opcode through the prefetch
+ * emulation again.  Blocks are dropped when their memory is written.
+ * Requires M68K_HOST_PAGE_MAP, and is switched on with m68k_set_block_cache().
+ */
+#define M68K_BLOCK_CACHE    OPT_ON
+
+
+/* If ON, blocks from the block cache that run often are translated into
+ * x86-64 machine code (see m68kjit.c).  Other hosts keep interpreting them.
+ * Requires M68K_BLOCK_CACHE, and is switched on with m68k_set_jit().  Off by
+ * default, since it does not yet beat the threaded interpreter; build with
+ * -DM68K_JIT=1 to try it.
+ */
+#ifndef M68K_JIT
+#define M68K_JIT            OPT_OFF
+#endif
+
+
+/* If ON, instructions outside the block cache are run by a single function
+ * that inlines every opcode handler and jumps from one handler straight to
+ * the next (GCC computed goto), instead of calling each handler through the
+ * jump table.  Needs GCC or clang.  Can be set from the command line, e.g.
+ * -DM68K_THREADED_DISPATCH=0 to get the jump table loop back.
+ */
+#ifndef M68K_THREADED_DISPATCH
+#define M68K_THREADED_DISPATCH OPT_ON
+#endif
+
+
+/* If ON, m68k_execute() counts how often each pair of opcode handlers runs
+ * back to back, for m68k_write_pair_profile().  m68kmake can read the profile
+ * to generate fused handlers for the most frequent pairs.  Instructions all
+ * go through the jump table loop while profiling, so it is slow.  Set it from
+ * the command line, e.g. -DM68K_PAIR_PROFILE=1.
+ */
+#ifndef M68K_PAIR_PROFILE
+#define M68K_PAIR_PROFILE OPT_OFF
+#endif
+
+
+/* If ON, add, subtract and compare instructions only record their operands
+ * for the V, C and X flags, which are worked out when an instruction, an
+ * exception or an SR read needs them.  N and Z are always set right away.
+ * Check it with tools/flagtest and tools/flagtest-lazy.  Can be set from the
+ * command line, e.g. -DM68K_LAZY_FLAGS=1.
+ */
+#ifndef M68K_LAZY_FLAGS
+#define M68K_LAZY_FLAGS OPT_OFF
+#endif
+
+
 /* ----------------------------- COMPATIBILITY ---------------------------- */
 
 /* The following options set optimizations that violate the current ANSI
@@ -41,9 +41,8 @@
 extern void m68040_fpu_op0(void);
 extern void m68040_fpu_op1(void);
 extern void m68881_mmu_ops();
-extern unsigned char m68ki_cycles[][0x10000];
-extern void (*m68ki_instruction_jump_table[0x10000])(void); /* opcode handler jump table */
 extern void m68ki_build_opcode_table(void);
+extern void m68ki_set_opcode_family(unsigned int family);
 
 #include "m68kops.h"
 #include "m68kcpu.h"
@@ -78,6 +77,182 @@ const char *const m68ki_cpu_names[] =
 /* The CPU core */
 m68ki_cpu_core m68ki_cpu = {0};
 
+#if M68K_HOST_PAGE_MAP
+/* Host memory backing for directly mapped pages, NULL for callback pages */
+unsigned char *m68ki_host_read_page[M68K_HOST_PAGE_COUNT];
+unsigned char *m68ki_host_write_page[M68K_HOST_PAGE_COUNT];
+#endif /* M68K_HOST_PAGE_MAP */
+
+#if M68K_THREADED_DISPATCH
+/* In m68kops.c, runs instructions until the cycles run out */
+void m68ki_execute_threaded(void);
+#endif /* M68K_THREADED_DISPATCH */
+
+#if M68K_LAZY_FLAGS
+/* Work out pending flags from the operands of the last add, subtract or
+ * compare, the same way the handlers do without M68K_LAZY_FLAGS.
+ */
+void m68ki_lazy_materialize(uint flags)
+{
+	uint src = m68ki_cpu.lazy_src;
+	uint dst = m68ki_cpu.lazy_dst;
+	uint res = m68ki_cpu.lazy_res;
+	uint v;
+	uint c;
+
+	switch(m68ki_cpu.lazy_op)
+	{
+		case M68KI_LAZY_ADD_8:
+			v = VFLAG_ADD_8(src, dst, res);
+			c = CFLAG_8(res);
+			break;
+		case M68KI_LAZY_ADD_16:
+			v = VFLAG_ADD_16(src, dst, res);
+			c = CFLAG_16(res);
+			break;
+		case M68KI_LAZY_ADD_32:
+			v = VFLAG_ADD_32(src, dst, res);
+			c = CFLAG_ADD_32(src, dst, res);
+			break;
+		case M68KI_LAZY_SUB_8:
+			v = VFLAG_SUB_8(src, dst, res);
+			c = CFLAG_8(res);
+			break;
+		case M68KI_LAZY_SUB_16:
+			v = VFLAG_SUB_16(src, dst, res);
+			c = CFLAG_16(res);
+			break;
+		default:
+			v = VFLAG_SUB_32(src, dst, res);
+			c = CFLAG_SUB_32(src, dst, res);
+			break;
+	}
+
+	flags &= m68ki_cpu.lazy_pending;
+	if(flags & M68KI_LAZY_V)
+		m68ki_cpu.v_flag = v;
+	if(flags & M68KI_LAZY_C)
+		m68ki_cpu.c_flag = c;
+	if(flags & M68KI_LAZY_X)
+		m68ki_cpu.x_flag = c;
+	m68ki_cpu.lazy_pending &= ~flags;
+}
+#endif /* M68K_LAZY_FLAGS */
+
+#if M68K_PAIR_PROFILE
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Handler name of each opcode handler table row, in m68kops.c */
+extern const char* const m68ki_instruction_names[];
+
+/* Open addressed hash of (previous row, row) pairs and how often they ran */
+#define M68KI_PAIR_HASH_BITS 17
+#define M68KI_PAIR_HASH_SIZE (1 << M68KI_PAIR_HASH_BITS)
+#define M68KI_PAIR_MAX_PROBES 64
+
+typedef struct
+{
+	uint   pair;   /* (previous row + 1) << 16 | row, 0 for a free slot */
+	uint64 count;
+} m68ki_pair_count;
+
+static m68ki_pair_count m68ki_pair_counts[M68KI_PAIR_HASH_SIZE];
+static uint             m68ki_pair_prev = 0;   /* Previous row + 1, 0 before the first instruction */
+static uint64           m68ki_pair_dropped = 0;
+
+static void m68ki_pair_profile_count(uint row)
+{
+	uint pair = m68ki_pair_prev << 16 | row;
+	uint slot = (pair * 2654435761u) >> (32 - M68KI_PAIR_HASH_BITS);
+	int i;
+
+	if(m68ki_pair_prev)
+	{
+		for(i = 0; i < M68KI_PAIR_MAX_PROBES; i++, slot = (slot + 1) & (M68KI_PAIR_HASH_SIZE - 1))
+		{
+			if(m68ki_pair_counts[slot].pair == 0)
+				m68ki_pair_counts[slot].pair = pair;
+			if(m68ki_pair_counts[slot].pair == pair)
+			{
+				m68ki_pair_counts[slot].count++;
+				break;
+			}
+		}
+		if(i == M68KI_PAIR_MAX_PROBES)
+			m68ki_pair_dropped++;
+	}
+	m68ki_pair_prev = row + 1;
+}
+
+static int m68ki_pair_compare(const void* a, const void* b)
+{
+	uint64 count_a = ((const m68ki_pair_count*)a)->count;
+	uint64 count_b = ((const m68ki_pair_count*)b)->count;
+
+	return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+#endif /* M68K_PAIR_PROFILE */
+
+#if M68K_BLOCK_CACHE
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Limits for a single decoded block */
+#define M68KI_BC_MAX_INSTRS  32
+#define M68KI_BC_MAX_WORDS   160
+/* Longest possible 680x0 instruction, in words */
+#define M68KI_BC_INSTR_WORDS 11
+#define M68KI_BC_HASH_SIZE   4096
+#define M68KI_BC_POOL_SIZE   2048
+
+typedef struct
+{
+	void (*handler)(void);
+	uint16 opcode;
+	uint16 next_offset;  /* Offset of the next instruction from the block start */
+	uint   cycles;
+} m68ki_bc_instr;
+
+typedef struct m68ki_bc_block
+{
+	uint   pc;
+	uint   num_instrs;
+	uint   length;       /* Size of the decoded instructions in bytes */
+	uint32 gen_first;    /* Code page generations when the block was decoded */
+	uint32 gen_last;
+	uint32* page_first;
+	uint32* page_last;
+	uint   epoch;        /* m68ki_bc_epoch when the block was decoded */
+	uint   exec_count;
+	void (*native)(void); /* Translated code, see m68kjit.c */
+	m68ki_bc_instr instr[M68KI_BC_MAX_INSTRS];
+	/* Instruction stream in host byte order, including a few words past the
+	 * last instruction so an unexpectedly long instruction still reads the
+	 * right memory.
+	 */
+	uint16 words[M68KI_BC_MAX_WORDS + M68KI_BC_INSTR_WORDS];
+} m68ki_bc_block;
+
+/* 4 MB, only allocated once the block cache is first enabled */
+uint32*       m68ki_bc_page_gen = NULL;
+const uint16* m68ki_bc_imm = NULL;
+int           m68ki_bc_enabled = 0;
+
+static uint            m68ki_bc_cpu_type = M68K_CPU_TYPE_68000;
+static m68ki_bc_block* m68ki_bc_hash[M68KI_BC_HASH_SIZE];
+static m68ki_bc_block  m68ki_bc_pool[M68KI_BC_POOL_SIZE];
+static uint            m68ki_bc_pool_used = 0;
+/* Bumped on every flush, so a block that is running when the memory map
+ * changes stops after the current instruction.
+ */
+static uint            m68ki_bc_epoch = 0;
+
+static void m68ki_bc_flush(void);
+
+#include "m68kjit.c"
+#endif /* M68K_BLOCK_CACHE */
+
 #if M68K_EMULATE_ADDRESS_ERROR
 #ifdef _BSD_SETJMP_H
 sigjmp_buf m68ki_aerr_trap;
@@ -635,7 +810,8 @@ unsigned int m68k_get_reg(void* context, m68k_register_t regnum)
 		case M68K_REG_A6:	return cpu->dar[14];
 		case M68K_REG_A7:	return cpu->dar[15];
 		case M68K_REG_PC:	return MASK_OUT_ABOVE_32(cpu->pc);
-		case M68K_REG_SR:	return	cpu->t1_flag						|
+		case M68K_REG_SR:	m68ki_lazy_flush(); /* auto-disable (see m68kcpu.h) */
+							return	cpu->t1_flag						|
 									cpu->t0_flag						|
 									(cpu->s_flag << 11)					|
 									(cpu->m_flag << 11)					|
@@ -777,13 +953,19 @@ void m68k_set_instr_hook_callback(void  (*callback)(unsigned int pc))
 /* Set the CPU type. */
 void m68k_set_cpu_type(unsigned int cpu_type)
 {
+#if M68K_BLOCK_CACHE
+	/* Blocks are decoded for a specific CPU type */
+	m68ki_bc_cpu_type = cpu_type;
+	m68ki_bc_flush();
+#endif /* M68K_BLOCK_CACHE */
+
 	switch(cpu_type)
 	{
 		case M68K_CPU_TYPE_68000:
 			CPU_TYPE         = CPU_TYPE_000;
 			CPU_ADDRESS_MASK = 0x00ffffff;
 			CPU_SR_MASK      = 0xa71f; /* T1 -- S  -- -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[0];
+			CYC_INSTR_TYPE   = 0;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[0];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 2;
@@ -795,17 +977,17 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 1;
 			CYC_RESET        = 132;
 			HAS_PMMU	 = 0;
-			return;
+			break;
 		case M68K_CPU_TYPE_SCC68070:
 			m68k_set_cpu_type(M68K_CPU_TYPE_68010);
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_TYPE         = CPU_TYPE_SCC070;
-			return;
+			break;
 		case M68K_CPU_TYPE_68010:
 			CPU_TYPE         = CPU_TYPE_010;
 			CPU_ADDRESS_MASK = 0x00ffffff;
 			CPU_SR_MASK      = 0xa71f; /* T1 -- S  -- -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[1];
+			CYC_INSTR_TYPE   = 1;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[1];
 			CYC_BCC_NOTAKE_B = -4;
 			CYC_BCC_NOTAKE_W = 0;
@@ -817,12 +999,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 1;
 			CYC_RESET        = 130;
 			HAS_PMMU	 = 0;
-			return;
+			break;
 		case M68K_CPU_TYPE_68EC020:
 			CPU_TYPE         = CPU_TYPE_EC020;
 			CPU_ADDRESS_MASK = 0x00ffffff;
 			CPU_SR_MASK      = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[2];
+			CYC_INSTR_TYPE   = 2;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[2];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -834,12 +1016,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	 = 0;
-			return;
+			break;
 		case M68K_CPU_TYPE_68020:
 			CPU_TYPE         = CPU_TYPE_020;
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_SR_MASK      = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[2];
+			CYC_INSTR_TYPE   = 2;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[2];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -851,12 +1033,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	 = 0;
-			return;
+			break;
 		case M68K_CPU_TYPE_68030:
 			CPU_TYPE         = CPU_TYPE_030;
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_SR_MASK      = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[3];
+			CYC_INSTR_TYPE   = 3;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[3];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -868,12 +1050,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	       = 1;
-			return;
+			break;
 		case M68K_CPU_TYPE_68EC030:
 			CPU_TYPE         = CPU_TYPE_EC030;
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_SR_MASK          = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[3];
+			CYC_INSTR_TYPE   = 3;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[3];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -885,12 +1067,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	       = 0;		/* EC030 lacks the PMMU and is effectively a die-shrink 68020 */
-			return;
+			break;
 		case M68K_CPU_TYPE_68040:		// TODO: these values are not correct
 			CPU_TYPE         = CPU_TYPE_040;
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_SR_MASK      = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[4];
+			CYC_INSTR_TYPE   = 4;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[4];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -902,12 +1084,12 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	 = 1;
-			return;
+			break;
 		case M68K_CPU_TYPE_68EC040: // Just a 68040 without pmmu apparently...
 			CPU_TYPE         = CPU_TYPE_EC040;
 			CPU_ADDRESS_MASK = 0xffffffff;
 			CPU_SR_MASK      = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			CYC_INSTRUCTION  = m68ki_cycles[4];
+			CYC_INSTR_TYPE   = 4;
 			CYC_EXCEPTION    = m68ki_exception_cycle_table[4];
 			CYC_BCC_NOTAKE_B = -2;
 			CYC_BCC_NOTAKE_W = 0;
@@ -919,11 +1101,11 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_SHIFT        = 0;
 			CYC_RESET        = 518;
 			HAS_PMMU	 = 0;
-			return;
+			break;
 		case M68K_CPU_TYPE_68LC040:
 			CPU_TYPE         = CPU_TYPE_LC040;
 			m68ki_cpu.sr_mask          = 0xf71f; /* T1 T0 S  M  -- I2 I1 I0 -- -- -- X  N  Z  V  C  */
-			m68ki_cpu.cyc_instruction  = m68ki_cycles[4];
+			m68ki_cpu.cyc_instr_type   = 4;
 			m68ki_cpu.cyc_exception    = m68ki_exception_cycle_table[4];
 			m68ki_cpu.cyc_bcc_notake_b = -2;
 			m68ki_cpu.cyc_bcc_notake_w = 0;
@@ -935,8 +1117,317 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			m68ki_cpu.cyc_shift        = 0;
 			m68ki_cpu.cyc_reset        = 518;
 			HAS_PMMU	       = 1;
+			break;
+	}
+
+	/* Switch to the opcode handlers built for this CPU type */
+	if(CPU_TYPE & CPU_TYPES_FAMILY_040)
+		CPU_FAMILY = CPU_FAMILY_040;
+	else if(CPU_TYPE & CPU_TYPES_FAMILY_020)
+		CPU_FAMILY = CPU_FAMILY_020;
+	else
+		CPU_FAMILY = CPU_FAMILY_000;
+	m68ki_set_opcode_family(CPU_FAMILY);
+}
+
+/* ======================================================================== */
+/* ============================== BLOCK CACHE ============================= */
+/* ======================================================================== */
+
+#if M68K_BLOCK_CACHE
+
+static void m68ki_bc_flush(void)
+{
+	memset(m68ki_bc_hash, 0, sizeof(m68ki_bc_hash));
+	m68ki_bc_pool_used = 0;
+	m68ki_bc_epoch++;
+#if M68K_JIT
+	m68ki_jit_reset();
+#endif /* M68K_JIT */
+}
+
+/* Instructions that always or usually change the flow of execution.
+ * Decoding stops after these, since whatever follows is likely not reached.
+ */
+static int m68ki_bc_ends_block(uint opcode)
+{
+	if((opcode & 0xf000) == 0x6000)     /* bra, bsr, bcc */
+		return 1;
+	if((opcode & 0xf0f8) == 0x50c8)     /* dbcc */
+		return 1;
+	if((opcode & 0xff80) == 0x4e80)     /* jsr, jmp */
+		return 1;
+	if((opcode & 0xfff0) == 0x4e40)     /* trap */
+		return 1;
+	if(opcode >= 0x4e70 && opcode <= 0x4e77) /* reset, nop, stop, rte, rtd, rts, trapv, rtr */
+		return opcode != 0x4e71;
+	if((opcode & 0xf000) == 0xa000 || (opcode & 0xf000) == 0xf000) /* line A/F */
+		return 1;
+	return 0;
+}
+
+/* Decode straight-line code starting at pc into a new block */
+static m68ki_bc_block* m68ki_bc_decode(uint pc)
+{
+	unsigned char* page = m68ki_host_read_page[pc >> M68K_HOST_PAGE_SHIFT];
+	uint offset = pc & M68K_HOST_PAGE_MASK;
+	uint length = 0;
+	uint num_words;
+	uint i;
+	char dasm_buf[100];
+	m68ki_bc_block* block;
+
+	if(!page || (pc & 1))
+		return NULL;
+
+	if(m68ki_bc_pool_used == M68KI_BC_POOL_SIZE)
+		m68ki_bc_flush();
+	block = &m68ki_bc_pool[m68ki_bc_pool_used];
+
+	block->num_instrs = 0;
+	while(block->num_instrs < M68KI_BC_MAX_INSTRS)
+	{
+		uint opcode;
+		uint size;
+
+		/* Stay inside the host page, and leave room for the longest instruction */
+		if(offset + length + M68KI_BC_INSTR_WORDS * 2 > M68K_HOST_PAGE_SIZE)
+			break;
+		if(length / 2 + M68KI_BC_INSTR_WORDS > M68KI_BC_MAX_WORDS)
+			break;
+
+		opcode = (page[offset + length] << 8) | page[offset + length + 1];
+		size = m68k_disassemble_raw(dasm_buf, pc + length, page + offset + length, NULL, m68ki_bc_cpu_type);
+		if(size < 2 || (size & 1))
+			break;
+
+		block->instr[block->num_instrs].handler = m68ki_instruction_handlers[m68ki_instruction_index[opcode]].handler;
+		block->instr[block->num_instrs].opcode = opcode;
+		block->instr[block->num_instrs].cycles = CYC_INSTRUCTION(opcode);
+		block->instr[block->num_instrs].next_offset = length + size;
+		block->num_instrs++;
+		length += size;
+
+		if(m68ki_bc_ends_block(opcode))
+			break;
+	}
+
+	if(block->num_instrs == 0)
+		return NULL;
+
+	num_words = length / 2 + M68KI_BC_INSTR_WORDS;
+	for(i = 0; i < num_words; i++)
+		block->words[i] = (page[offset + i * 2] << 8) | page[offset + i * 2 + 1];
+
+	/* Mark the code pages, so writes to them drop the block */
+	block->page_first = &m68ki_bc_page_gen[pc >> M68KI_BC_PAGE_SHIFT];
+	block->page_last = &m68ki_bc_page_gen[(pc + length - 1) >> M68KI_BC_PAGE_SHIFT];
+	if(!(*block->page_first & 1))
+		(*block->page_first)++;
+	if(!(*block->page_last & 1))
+		(*block->page_last)++;
+	block->gen_first = *block->page_first;
+	block->gen_last = *block->page_last;
+	block->pc = pc;
+	block->length = length;
+	block->epoch = m68ki_bc_epoch;
+	block->exec_count = 0;
+	block->native = NULL;
+
+	m68ki_bc_pool_used++;
+	return block;
+}
+
+static inline int m68ki_bc_valid(m68ki_bc_block* block)
+{
+	return *block->page_first == block->gen_first && *block->page_last == block->gen_last &&
+		   block->epoch == m68ki_bc_epoch;
+}
+
+/* A write to a code page does not mean the code itself changed, code and
+ * data often share pages.  Keep the block if its instructions are intact.
+ */
+static int m68ki_bc_revalidate(m68ki_bc_block* block)
+{
+	unsigned char* page = m68ki_host_read_page[block->pc >> M68K_HOST_PAGE_SHIFT];
+	uint offset = block->pc & M68K_HOST_PAGE_MASK;
+	uint i;
+
+	if(!page || block->epoch != m68ki_bc_epoch)
+		return 0;
+
+	for(i = 0; i < block->length / 2; i++)
+		if(block->words[i] != ((page[offset + i * 2] << 8) | page[offset + i * 2 + 1]))
+			return 0;
+	for(; i < block->length / 2 + M68KI_BC_INSTR_WORDS; i++)
+		block->words[i] = (page[offset + i * 2] << 8) | page[offset + i * 2 + 1];
+
+	if(!(*block->page_first & 1))
+		(*block->page_first)++;
+	if(!(*block->page_last & 1))
+		(*block->page_last)++;
+	block->gen_first = *block->page_first;
+	block->gen_last = *block->page_last;
+	return 1;
+}
+
+static m68ki_bc_block* m68ki_bc_lookup(uint pc)
+{
+	m68ki_bc_block** slot = &m68ki_bc_hash[(pc >> 1) & (M68KI_BC_HASH_SIZE - 1)];
+
+	if(*slot && (*slot)->pc == pc && (m68ki_bc_valid(*slot) || m68ki_bc_revalidate(*slot)))
+		return *slot;
+
+	*slot = m68ki_bc_decode(pc);
+	return *slot;
+}
+
+/* Run a block until it ends, the flow changes, or we run out of cycles */
+static void m68ki_bc_execute(m68ki_bc_block* block)
+{
+	uint i;
+
+	for(i = 0; i < block->num_instrs; i++)
+	{
+		const m68ki_bc_instr* instr = &block->instr[i];
+		int j;
+
+		m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */
+		m68ki_use_data_space(); /* auto-disable (see m68kcpu.h) */
+		m68ki_instr_hook(REG_PC); /* auto-disable (see m68kcpu.h) */
+
+		REG_PPC = REG_PC;
+		for (j = 15; j >= 0; j--){
+			REG_DA_SAVE[j] = REG_DA[j];
+		}
+
+		/* Opcode and extension words come from the block instead of memory */
+		REG_IR = instr->opcode;
+		REG_PC += 2;
+		m68ki_bc_imm = &block->words[(REG_PPC - block->pc) / 2 + 1];
+		instr->handler();
+		m68ki_bc_imm = NULL;
+		USE_CYCLES(instr->cycles);
+
+		m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
+
+		if(REG_PC != block->pc + instr->next_offset || CPU_STOPPED || SLICE_OVER() || !m68ki_bc_valid(block))
+			break;
+	}
+
+	/* The prefetch queue was bypassed, make sure it gets refilled */
+	CPU_PREF_ADDR = REG_PC ^ 1;
+}
+
+#endif /* M68K_BLOCK_CACHE */
+
+void m68k_set_block_cache(int enable)
+{
+#if M68K_BLOCK_CACHE
+	m68ki_bc_flush();
+	if(enable && !m68ki_bc_page_gen)
+	{
+		m68ki_bc_page_gen = calloc(1 << (32 - M68KI_BC_PAGE_SHIFT), sizeof(*m68ki_bc_page_gen));
+		if(!m68ki_bc_page_gen)
+		{
+			printf("Failed to allocate memory for the block cache, running without it.\n");
 			return;
+		}
+	}
+	m68ki_bc_enabled = enable;
+#else
+	(void)enable;
+#endif /* M68K_BLOCK_CACHE */
+}
+
+void m68k_set_jit(int enable)
+{
+#if M68K_JIT
+	m68ki_bc_flush();
+	m68ki_jit_set_enabled(enable);
+#else
+	(void)enable;
+#endif /* M68K_JIT */
+}
+
+void m68k_set_jit_perf_map(int enable)
+{
+#if M68K_JIT
+	m68ki_jit_set_perf_map(enable);
+#else
+	(void)enable;
+#endif /* M68K_JIT */
+}
+
+int m68k_write_pair_profile(const char* filename)
+{
+#if M68K_PAIR_PROFILE
+	m68ki_pair_count* pairs;
+	uint64 total = 0;
+	FILE* f;
+	uint num_pairs = 0;
+	uint i;
+
+	pairs = malloc(sizeof(m68ki_pair_counts));
+	if(!pairs)
+	{
+		printf("[CPU] Failed to allocate memory for the opcode pair profile.\n");
+		return -1;
+	}
+	for(i = 0; i < M68KI_PAIR_HASH_SIZE; i++)
+	{
+		if(m68ki_pair_counts[i].pair)
+		{
+			pairs[num_pairs++] = m68ki_pair_counts[i];
+			total += m68ki_pair_counts[i].count;
+		}
+	}
+	qsort(pairs, num_pairs, sizeof(pairs[0]), m68ki_pair_compare);
+
+	f = fopen(filename, "w");
+	if(!f)
+	{
+		printf("[CPU] Failed to open %s for the opcode pair profile.\n", filename);
+		free(pairs);
+		return -1;
 	}
+	fprintf(f, "# Opcode handler pairs run back to back: count, first handler, second handler\n");
+	fprintf(f, "# %llu pairs, %llu not counted because the table was full\n", (unsigned long long)total,
+	        (unsigned long long)m68ki_pair_dropped);
+	for(i = 0; i < num_pairs; i++)
+		fprintf(f, "%llu %s %s\n", (unsigned long long)pairs[i].count, m68ki_instruction_names[(pairs[i].pair >> 16) - 1],
+		        m68ki_instruction_names[pairs[i].pair & 0xffff]);
+	fclose(f);
+	free(pairs);
+
+	printf("[CPU] Wrote %u different opcode pairs to %s.\n", num_pairs, filename);
+	return 0;
+#else
+	(void)filename;
+	printf("[CPU] Opcode pair profiling needs a build with M68K_PAIR_PROFILE enabled.\n");
+	return -1;
+#endif /* M68K_PAIR_PROFILE */
+}
+
+void m68k_invalidate_code(unsigned int address, unsigned int size)
+{
+#if M68K_BLOCK_CACHE
+	uint page;
+
+	/* Nothing is decoded while the cache is off, and enabling it flushes */
+	if(!m68ki_bc_enabled || size == 0)
+		return;
+	for(page = address >> M68KI_BC_PAGE_SHIFT; page <= (address + size - 1) >> M68KI_BC_PAGE_SHIFT; page++)
+	{
+		if(m68ki_bc_page_gen[page] & 1)
+			m68ki_bc_page_gen[page]++;
+		if(page == (1 << (32 - M68KI_BC_PAGE_SHIFT)) - 1)
+			break;
+	}
+#else
+	(void)address;
+	(void)size;
+#endif /* M68K_BLOCK_CACHE */
 }
 
 /* Execute some instructions until we use up num_cycles clock cycles */
@@ -967,10 +1458,60 @@ int m68k_execute(int num_cycles)
 
 		m68ki_check_bus_error_trap();
 
+#if M68K_BLOCK_CACHE
+		/* A bus error may have left us in the middle of a block */
+		m68ki_bc_imm = NULL;
+#endif /* M68K_BLOCK_CACHE */
+
+#if M68K_THREADED_DISPATCH && !M68K_PAIR_PROFILE
+		/* The block cache looks up every instruction, it needs the loop below */
+#if M68K_BLOCK_CACHE
+		if(!m68ki_bc_enabled || PMMU_ENABLED)
+#endif /* M68K_BLOCK_CACHE */
+		{
+			m68ki_execute_threaded();
+			REG_PPC = REG_PC;
+			return m68ki_initial_cycles - GET_CYCLES();
+		}
+#endif /* M68K_THREADED_DISPATCH && !M68K_PAIR_PROFILE */
+
 		/* Main loop.  Keep going until we run out of clock cycles */
 		do
 		{
+			const m68ki_instruction_handler* handler;
 			int i;
+
+#if M68K_BLOCK_CACHE
+			/* Profiling counts every instruction here, blocks would skip it */
+			if(m68ki_bc_enabled && !PMMU_ENABLED && !M68K_PAIR_PROFILE)
+			{
+				m68ki_bc_block* block = m68ki_bc_lookup(REG_PC);
+				if(block)
+				{
+#if M68K_JIT
+					if(m68ki_jit_enabled && !block->native && ++block->exec_count == M68KI_JIT_THRESHOLD)
+					{
+						/* The flush also freed the block, look it up again */
+						if(!m68ki_jit_compile(block))
+						{
+							m68ki_bc_flush();
+							continue;
+						}
+					}
+					if(block->native)
+					{
+						block->native();
+						/* The prefetch queue was bypassed, make sure it gets refilled */
+						CPU_PREF_ADDR = REG_PC ^ 1;
+						continue;
+					}
+#endif /* M68K_JIT */
+					m68ki_bc_execute(block);
+					continue;
+				}
+			}
+#endif /* M68K_BLOCK_CACHE */
+
 			/* Set tracing accodring to T1. (T0 is done inside instruction) */
 			m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */
 
@@ -990,12 +1531,16 @@ int m68k_execute(int num_cycles)
 
 			/* Read an instruction and call its handler */
 			REG_IR = m68ki_read_imm_16();
-			m68ki_instruction_jump_table[REG_IR]();
-			USE_CYCLES(CYC_INSTRUCTION[REG_IR]);
+#if M68K_PAIR_PROFILE
+			m68ki_pair_profile_count(m68ki_instruction_index[REG_IR]);
+#endif /* M68K_PAIR_PROFILE */
+			handler = &m68ki_instruction_handlers[m68ki_instruction_index[REG_IR]];
+			handler->handler();
+			USE_CYCLES(handler->cycles[CYC_INSTR_TYPE]);
 
 			/* Trace m68k_exception, if necessary */
 			m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
-		} while(GET_CYCLES() > 0);
+		} while(!SLICE_OVER());
 
 		/* set previous PC to current PC for the next entry into the loop */
 		REG_PPC = REG_PC;
@@ -1003,6 +1548,9 @@ int m68k_execute(int num_cycles)
 	else
 		SET_CYCLES(0);
 
+	/* A request to end this timeslice doesn't carry over to the next one */
+	__atomic_store_n(&CPU_END_SLICE, 0, __ATOMIC_RELAXED);
+
 	/* return how many clocks we used */
 	return m68ki_initial_cycles - GET_CYCLES();
 }
@@ -1032,6 +1580,11 @@ void m68k_end_timeslice(void)
 	SET_CYCLES(0);
 }
 
+void m68k_end_timeslice_async(void)
+{
+	__atomic_store_n(&CPU_END_SLICE, 1, __ATOMIC_RELAXED);
+}
+
 
 /* ASG: rewrote so that the int_level is a mask of the IPL0/IPL1/IPL2 bits */
 /* KS: Modified so that IPL* bits match with mask positions in the SR
@@ -1141,6 +1694,38 @@ void m68k_pulse_reset(void)
 	RESET_CYCLES = CYC_EXCEPTION[EXCEPTION_RESET];
 }
 
+/* Map host memory into the 68k address space */
+void m68k_set_host_pages(unsigned int address, unsigned int size, unsigned char *read_ptr, unsigned char *write_ptr)
+{
+#if M68K_HOST_PAGE_MAP
+	uint page = address >> M68K_HOST_PAGE_SHIFT;
+	uint end = page + (size >> M68K_HOST_PAGE_SHIFT);
+	uint offset = 0;
+
+	for(; page < end && page < M68K_HOST_PAGE_COUNT; page++, offset += M68K_HOST_PAGE_SIZE)
+	{
+		m68ki_host_read_page[page] = read_ptr ? read_ptr + offset : NULL;
+		m68ki_host_write_page[page] = write_ptr ? write_ptr + offset : NULL;
+	}
+#else
+	(void)address;
+	(void)size;
+	(void)read_ptr;
+	(void)write_ptr;
+#endif /* M68K_HOST_PAGE_MAP */
+}
+
+void m68k_clear_host_pages(void)
+{
+#if M68K_HOST_PAGE_MAP
+	memset(m68ki_host_read_page, 0, sizeof(m68ki_host_read_page));
+	memset(m68ki_host_write_page, 0, sizeof(m68ki_host_write_page));
+#if M68K_BLOCK_CACHE
+	m68ki_bc_flush();
+#endif /* M68K_BLOCK_CACHE */
+#endif /* M68K_HOST_PAGE_MAP */
+}
+
 /* Pulse the HALT line on the CPU */
 void m68k_pulse_halt(void)
 {
@@ -1156,13 +1741,22 @@ unsigned int m68k_context_size()
 
 unsigned int m68k_get_context(void* dst)
 {
+	m68ki_lazy_flush(); /* auto-disable (see m68kcpu.h) */
 	if(dst) *(m68ki_cpu_core*)dst = m68ki_cpu;
 	return sizeof(m68ki_cpu_core);
 }
 
 void m68k_set_context(void* src)
 {
-	if(src) m68ki_cpu = *(m68ki_cpu_core*)src;
+	uint family = CPU_FAMILY;
+
+	if(src)
+	{
+		m68ki_cpu = *(m68ki_cpu_core*)src;
+		/* The context may be from a CPU of another family */
+		if(CPU_FAMILY != family)
+			m68ki_set_opcode_family(CPU_FAMILY);
+	}
 }
 
 /* ======================================================================== */
@@ -40,6 +40,9 @@ extern "C" {
 #include "m68k.h"
 
 #include <limits.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <setjmp.h>
 
@@ -95,6 +98,15 @@ typedef uint32 uint64;
 #define S64(val) val
 #endif
 
+/* For the few places where the compiler's own inlining choice is wrong */
+#ifdef __GNUC__
+#define M68KI_ALWAYS_INLINE inline __attribute__((always_inline))
+#define M68KI_NOINLINE      __attribute__((noinline, unused))
+#else
+#define M68KI_ALWAYS_INLINE inline
+#define M68KI_NOINLINE      inline
+#endif
+
 #include "softfloat/milieu.h"
 #include "softfloat/softfloat.h"
 
@@ -188,6 +200,16 @@ typedef uint32 uint64;
 #define CPU_TYPE_040    (0x00000200)
 #define CPU_TYPE_SCC070 (0x00000400)
 
+/* CPU families with their own opcode handlers (see m68k_in.c) */
+#define CPU_FAMILY_000   0
+#define CPU_FAMILY_020   1
+#define CPU_FAMILY_040   2
+#define NUM_CPU_FAMILIES 3
+
+#define CPU_TYPES_FAMILY_000 (CPU_TYPE_000 | CPU_TYPE_008 | CPU_TYPE_010 | CPU_TYPE_SCC070)
+#define CPU_TYPES_FAMILY_020 (CPU_TYPE_EC020 | CPU_TYPE_020 | CPU_TYPE_EC030 | CPU_TYPE_030)
+#define CPU_TYPES_FAMILY_040 (CPU_TYPE_EC040 | CPU_TYPE_LC040 | CPU_TYPE_040)
+
 /* Different ways to stop the CPU */
 #define STOP_LEVEL_STOP 1
 #define STOP_LEVEL_HALT 2
@@ -325,6 +347,7 @@ typedef uint32 uint64;
 
 /* Access the CPU registers */
 #define CPU_TYPE         m68ki_cpu.cpu_type
+#define CPU_FAMILY       m68ki_cpu.cpu_family
 
 #define REG_DA           m68ki_cpu.dar /* easy access to data and address regs */
 #define REG_DA_SAVE           m68ki_cpu.dar_save
@@ -353,15 +376,32 @@ typedef uint32 uint64;
 #define FLAG_T0          m68ki_cpu.t0_flag
 #define FLAG_S           m68ki_cpu.s_flag
 #define FLAG_M           m68ki_cpu.m_flag
+#if M68K_LAZY_FLAGS
+/* V, C and X may still have to be worked out.  Writing them through FLAG_X,
+ * FLAG_V and FLAG_C drops the pending value, reading them has to go through
+ * XFLAG_VALUE, VFLAG_VALUE and CFLAG_VALUE (see m68ki_lazy_flag()).
+ */
+#define FLAG_X           (*m68ki_lazy_write(M68KI_LAZY_X, &m68ki_cpu.x_flag))
+#define FLAG_V           (*m68ki_lazy_write(M68KI_LAZY_V, &m68ki_cpu.v_flag))
+#define FLAG_C           (*m68ki_lazy_write(M68KI_LAZY_C, &m68ki_cpu.c_flag))
+#define XFLAG_VALUE      (*m68ki_lazy_flag(M68KI_LAZY_X, &m68ki_cpu.x_flag))
+#define VFLAG_VALUE      (*m68ki_lazy_flag(M68KI_LAZY_V, &m68ki_cpu.v_flag))
+#define CFLAG_VALUE      (*m68ki_lazy_flag(M68KI_LAZY_C, &m68ki_cpu.c_flag))
+#else
 #define FLAG_X           m68ki_cpu.x_flag
-#define FLAG_N           m68ki_cpu.n_flag
-#define FLAG_Z           m68ki_cpu.not_z_flag
 #define FLAG_V           m68ki_cpu.v_flag
 #define FLAG_C           m68ki_cpu.c_flag
+#define XFLAG_VALUE      FLAG_X
+#define VFLAG_VALUE      FLAG_V
+#define CFLAG_VALUE      FLAG_C
+#endif /* M68K_LAZY_FLAGS */
+#define FLAG_N           m68ki_cpu.n_flag
+#define FLAG_Z           m68ki_cpu.not_z_flag
 #define FLAG_INT_MASK    m68ki_cpu.int_mask
 
 #define CPU_INT_LEVEL    m68ki_cpu.int_level /* ASG: changed from CPU_INTS_PENDING */
 #define CPU_STOPPED      m68ki_cpu.stopped
+#define CPU_END_SLICE    m68ki_cpu.end_slice
 #define CPU_PREF_ADDR    m68ki_cpu.pref_addr
 #define CPU_PREF_DATA    m68ki_cpu.pref_data
 #define CPU_ADDRESS_MASK m68ki_cpu.address_mask
@@ -369,7 +409,8 @@ typedef uint32 uint64;
 #define CPU_INSTR_MODE   m68ki_cpu.instr_mode
 #define CPU_RUN_MODE     m68ki_cpu.run_mode
 
-#define CYC_INSTRUCTION  m68ki_cpu.cyc_instruction
+#define CYC_INSTR_TYPE   m68ki_cpu.cyc_instr_type
+#define CYC_INSTRUCTION(A) m68ki_instruction_handlers[m68ki_instruction_index[A]].cycles[CYC_INSTR_TYPE]
 #define CYC_EXCEPTION    m68ki_cpu.cyc_exception
 #define CYC_BCC_NOTAKE_B m68ki_cpu.cyc_bcc_notake_b
 #define CYC_BCC_NOTAKE_W m68ki_cpu.cyc_bcc_notake_w
@@ -713,7 +754,7 @@ extern jmp_buf m68ki_aerr_trap;
 #define EA_AY_DI_8()   (AY+MAKE_INT_16(m68ki_read_imm_16())) /* displacement */
 #define EA_AY_DI_16()  EA_AY_DI_8()
 #define EA_AY_DI_32()  EA_AY_DI_8()
-#define EA_AY_IX_8()   m68ki_get_ea_ix(AY)                   /* indirect + index */
+#define EA_AY_IX_8()   m68ki_get_ea_ix(AY, CPU_TYPE)         /* indirect + index */
 #define EA_AY_IX_16()  EA_AY_IX_8()
 #define EA_AY_IX_32()  EA_AY_IX_8()
 
@@ -729,7 +770,7 @@ extern jmp_buf m68ki_aerr_trap;
 #define EA_AX_DI_8()   (AX+MAKE_INT_16(m68ki_read_imm_16()))
 #define EA_AX_DI_16()  EA_AX_DI_8()
 #define EA_AX_DI_32()  EA_AX_DI_8()
-#define EA_AX_IX_8()   m68ki_get_ea_ix(AX)
+#define EA_AX_IX_8()   m68ki_get_ea_ix(AX, CPU_TYPE)
 #define EA_AX_IX_16()  EA_AX_IX_8()
 #define EA_AX_IX_32()  EA_AX_IX_8()
 
@@ -745,7 +786,7 @@ extern jmp_buf m68ki_aerr_trap;
 #define EA_PCDI_8()    m68ki_get_ea_pcdi()                   /* pc indirect + displacement */
 #define EA_PCDI_16()   EA_PCDI_8()
 #define EA_PCDI_32()   EA_PCDI_8()
-#define EA_PCIX_8()    m68ki_get_ea_pcix()                   /* pc indirect + index */
+#define EA_PCIX_8()    m68ki_get_ea_pcix(CPU_TYPE)           /* pc indirect + index */
 #define EA_PCIX_16()   EA_PCIX_8()
 #define EA_PCIX_32()   EA_PCIX_8()
 
@@ -778,6 +819,38 @@ extern jmp_buf m68ki_aerr_trap;
 #define VFLAG_SUB_16(S, D, R) (((S^D) & (R^D))>>8)
 #define VFLAG_SUB_32(S, D, R) (((S^D) & (R^D))>>24)
 
+/* All flags of an add or subtract, and all but X of a compare */
+#if M68K_LAZY_FLAGS
+#define M68KI_FLAGS_ADD_8(S, D, R)  m68ki_lazy_record(M68KI_LAZY_ADD_8, M68KI_LAZY_VCX, NFLAG_8(R), ZFLAG_8(R), S, D, R)
+#define M68KI_FLAGS_ADD_16(S, D, R) m68ki_lazy_record(M68KI_LAZY_ADD_16, M68KI_LAZY_VCX, NFLAG_16(R), ZFLAG_16(R), S, D, R)
+#define M68KI_FLAGS_ADD_32(S, D, R) m68ki_lazy_record(M68KI_LAZY_ADD_32, M68KI_LAZY_VCX, NFLAG_32(R), ZFLAG_32(R), S, D, R)
+#define M68KI_FLAGS_SUB_8(S, D, R)  m68ki_lazy_record(M68KI_LAZY_SUB_8, M68KI_LAZY_VCX, NFLAG_8(R), ZFLAG_8(R), S, D, R)
+#define M68KI_FLAGS_SUB_16(S, D, R) m68ki_lazy_record(M68KI_LAZY_SUB_16, M68KI_LAZY_VCX, NFLAG_16(R), ZFLAG_16(R), S, D, R)
+#define M68KI_FLAGS_SUB_32(S, D, R) m68ki_lazy_record(M68KI_LAZY_SUB_32, M68KI_LAZY_VCX, NFLAG_32(R), ZFLAG_32(R), S, D, R)
+#define M68KI_FLAGS_CMP_8(S, D, R)  m68ki_lazy_record(M68KI_LAZY_SUB_8, M68KI_LAZY_VC, NFLAG_8(R), ZFLAG_8(R), S, D, R)
+#define M68KI_FLAGS_CMP_16(S, D, R) m68ki_lazy_record(M68KI_LAZY_SUB_16, M68KI_LAZY_VC, NFLAG_16(R), ZFLAG_16(R), S, D, R)
+#define M68KI_FLAGS_CMP_32(S, D, R) m68ki_lazy_record(M68KI_LAZY_SUB_32, M68KI_LAZY_VC, NFLAG_32(R), ZFLAG_32(R), S, D, R)
+#else
+#define M68KI_FLAGS_ADD_8(S, D, R) \
+	do { FLAG_N = NFLAG_8(R); FLAG_V = VFLAG_ADD_8(S, D, R); FLAG_X = FLAG_C = CFLAG_8(R); FLAG_Z = ZFLAG_8(R); } while(0)
+#define M68KI_FLAGS_ADD_16(S, D, R) \
+	do { FLAG_N = NFLAG_16(R); FLAG_V = VFLAG_ADD_16(S, D, R); FLAG_X = FLAG_C = CFLAG_16(R); FLAG_Z = ZFLAG_16(R); } while(0)
+#define M68KI_FLAGS_ADD_32(S, D, R) \
+	do { FLAG_N = NFLAG_32(R); FLAG_V = VFLAG_ADD_32(S, D, R); FLAG_X = FLAG_C = CFLAG_ADD_32(S, D, R); FLAG_Z = ZFLAG_32(R); } while(0)
+#define M68KI_FLAGS_SUB_8(S, D, R) \
+	do { FLAG_N = NFLAG_8(R); FLAG_V = VFLAG_SUB_8(S, D, R); FLAG_X = FLAG_C = CFLAG_8(R); FLAG_Z = ZFLAG_8(R); } while(0)
+#define M68KI_FLAGS_SUB_16(S, D, R) \
+	do { FLAG_N = NFLAG_16(R); FLAG_V = VFLAG_SUB_16(S, D, R); FLAG_X = FLAG_C = CFLAG_16(R); FLAG_Z = ZFLAG_16(R); } while(0)
+#define M68KI_FLAGS_SUB_32(S, D, R) \
+	do { FLAG_N = NFLAG_32(R); FLAG_V = VFLAG_SUB_32(S, D, R); FLAG_X = FLAG_C = CFLAG_SUB_32(S, D, R); FLAG_Z = ZFLAG_32(R); } while(0)
+#define M68KI_FLAGS_CMP_8(S, D, R) \
+	do { FLAG_N = NFLAG_8(R); FLAG_V = VFLAG_SUB_8(S, D, R); FLAG_C = CFLAG_8(R); FLAG_Z = ZFLAG_8(R); } while(0)
+#define M68KI_FLAGS_CMP_16(S, D, R) \
+	do { FLAG_N = NFLAG_16(R); FLAG_V = VFLAG_SUB_16(S, D, R); FLAG_C = CFLAG_16(R); FLAG_Z = ZFLAG_16(R); } while(0)
+#define M68KI_FLAGS_CMP_32(S, D, R) \
+	do { FLAG_N = NFLAG_32(R); FLAG_V = VFLAG_SUB_32(S, D, R); FLAG_C = CFLAG_SUB_32(S, D, R); FLAG_Z = ZFLAG_32(R); } while(0)
+#endif /* M68K_LAZY_FLAGS */
+
 #define NFLAG_8(A) (A)
 #define NFLAG_16(A) ((A)>>8)
 #define NFLAG_32(A) ((A)>>24)
@@ -806,23 +879,23 @@ extern jmp_buf m68ki_aerr_trap;
 #define MFLAG_CLEAR 0
 
 /* Turn flag values into 1 or 0 */
-#define XFLAG_AS_1() ((FLAG_X>>8)&1)
+#define XFLAG_AS_1() ((XFLAG_VALUE>>8)&1)
 #define NFLAG_AS_1() ((FLAG_N>>7)&1)
-#define VFLAG_AS_1() ((FLAG_V>>7)&1)
+#define VFLAG_AS_1() ((VFLAG_VALUE>>7)&1)
 #define ZFLAG_AS_1() (!FLAG_Z)
-#define CFLAG_AS_1() ((FLAG_C>>8)&1)
+#define CFLAG_AS_1() ((CFLAG_VALUE>>8)&1)
 
 
 /* Conditions */
-#define COND_CS() (FLAG_C&0x100)
+#define COND_CS() (CFLAG_VALUE&0x100)
 #define COND_CC() (!COND_CS())
-#define COND_VS() (FLAG_V&0x80)
+#define COND_VS() (VFLAG_VALUE&0x80)
 #define COND_VC() (!COND_VS())
 #define COND_NE() FLAG_Z
 #define COND_EQ() (!COND_NE())
 #define COND_MI() (FLAG_N&0x80)
 #define COND_PL() (!COND_MI())
-#define COND_LT() ((FLAG_N^FLAG_V)&0x80)
+#define COND_LT() ((FLAG_N^VFLAG_VALUE)&0x80)
 #define COND_GE() (!COND_LT())
 #define COND_HI() (COND_CC() && COND_NE())
 #define COND_LS() (COND_CS() || COND_EQ())
@@ -846,7 +919,7 @@ extern jmp_buf m68ki_aerr_trap;
 #define COND_NOT_LE() COND_GT()
 
 /* Not real conditions, but here for convenience */
-#define COND_XS() (FLAG_X&0x100)
+#define COND_XS() (XFLAG_VALUE&0x100)
 #define COND_XC() (!COND_XS)
 
 
@@ -873,7 +946,9 @@ extern jmp_buf m68ki_aerr_trap;
 #define USE_CYCLES(A)    m68ki_remaining_cycles -= (A)
 #define SET_CYCLES(A)    m68ki_remaining_cycles = A
 #define GET_CYCLES()     m68ki_remaining_cycles
-#define USE_ALL_CYCLES() m68ki_remaining_cycles %= CYC_INSTRUCTION[REG_IR]
+#define USE_ALL_CYCLES() m68ki_remaining_cycles %= CYC_INSTRUCTION(REG_IR)
+/* The timeslice is over when its cycles are used up or another thread ended it */
+#define SLICE_OVER()     (GET_CYCLES() <= 0 || __atomic_load_n(&CPU_END_SLICE, __ATOMIC_RELAXED))
 
 
 
@@ -950,9 +1025,17 @@ typedef struct
 	uint not_z_flag;   /* Zero, inverted for speedups */
 	uint v_flag;       /* Overflow */
 	uint c_flag;       /* Carry */
+#if M68K_LAZY_FLAGS
+	uint lazy_pending; /* M68KI_LAZY_V/C/X flags still to be worked out */
+	uint lazy_op;      /* M68KI_LAZY_ADD/SUB_xx operation they come from */
+	uint lazy_src;     /* And its operands and result */
+	uint lazy_dst;
+	uint lazy_res;
+#endif /* M68K_LAZY_FLAGS */
 	uint int_mask;     /* I0-I2 */
 	uint int_level;    /* State of interrupt pins IPL0-IPL2 -- ASG: changed from ints_pending */
 	uint stopped;      /* Stopped state */
+	uint end_slice;    /* Set by m68k_end_timeslice_async() from another thread */
 	uint pref_addr;    /* Last prefetch address */
 	uint pref_data;    /* Data in the prefetch queue */
 	uint address_mask; /* Available address pins */
@@ -985,7 +1068,8 @@ typedef struct
 	uint mmu_tc;
 	uint16 mmu_sr;
 
-	const uint8* cyc_instruction;
+	uint cyc_instr_type;               /* Column of m68ki_instruction_handlers[].cycles */
+	uint cpu_family;                   /* Opcode handler set in use, CPU_FAMILY_xxx */
 	const uint8* cyc_exception;
 
 	/* Callbacks to host */
@@ -1013,6 +1097,98 @@ extern const uint8    m68ki_exception_cycle_table[][256];
 extern uint           m68ki_address_space;
 extern const uint8    m68ki_ea_idx_cycle_table[];
 
+#if M68K_LAZY_FLAGS
+/* Flags in m68ki_cpu.lazy_pending */
+#define M68KI_LAZY_V   1
+#define M68KI_LAZY_C   2
+#define M68KI_LAZY_X   4
+#define M68KI_LAZY_VC  (M68KI_LAZY_V | M68KI_LAZY_C)
+#define M68KI_LAZY_VCX (M68KI_LAZY_V | M68KI_LAZY_C | M68KI_LAZY_X)
+
+/* Operations in m68ki_cpu.lazy_op, a compare is a subtract without X */
+#define M68KI_LAZY_ADD_8  0
+#define M68KI_LAZY_ADD_16 1
+#define M68KI_LAZY_ADD_32 2
+#define M68KI_LAZY_SUB_8  3
+#define M68KI_LAZY_SUB_16 4
+#define M68KI_LAZY_SUB_32 5
+
+/* In m68kcpu.c, works out the given flags if they are pending */
+void m68ki_lazy_materialize(uint flags);
+
+/* Address of the V, C or X flag for a read, worked out first if it is pending */
+static M68KI_ALWAYS_INLINE uint* m68ki_lazy_flag(uint flag, uint* value)
+{
+	if(m68ki_cpu.lazy_pending & flag)
+	{
+		m68ki_lazy_materialize(flag);
+		/* Lets the compiler drop the check on the next access */
+		m68ki_cpu.lazy_pending &= ~flag;
+	}
+	return value;
+}
+
+/* Address of the V, C or X flag for a write, which replaces a pending value */
+static M68KI_ALWAYS_INLINE uint* m68ki_lazy_write(uint flag, uint* value)
+{
+	m68ki_cpu.lazy_pending &= ~flag;
+	return value;
+}
+
+/* Set N and Z, and keep the operands to work out the given flags from when
+ * they are needed.  A pending flag the operation doesn't set is worked out
+ * before its operands are replaced.
+ */
+static M68KI_ALWAYS_INLINE void m68ki_lazy_record(uint op, uint flags, uint n, uint not_z, uint src, uint dst, uint res)
+{
+	if(m68ki_cpu.lazy_pending & ~flags)
+		m68ki_lazy_materialize(m68ki_cpu.lazy_pending & ~flags);
+	m68ki_cpu.n_flag = n;
+	m68ki_cpu.not_z_flag = not_z;
+	m68ki_cpu.lazy_pending = flags;
+	m68ki_cpu.lazy_op = op;
+	m68ki_cpu.lazy_src = src;
+	m68ki_cpu.lazy_dst = dst;
+	m68ki_cpu.lazy_res = res;
+}
+
+/* Work out every pending flag, so the CPU state can be read directly */
+#define m68ki_lazy_flush() m68ki_lazy_materialize(M68KI_LAZY_VCX)
+#else
+#define m68ki_lazy_flush()
+#endif /* M68K_LAZY_FLAGS */
+
+/* Opcode dispatch, built by m68ki_build_opcode_table() in m68kops.c.  Each
+ * opcode has the 16 bit index of its entry in the dense handler array, with
+ * one entry per opcode handler table row.
+ */
+#define NUM_CPU_TYPES 5
+
+typedef struct
+{
+	void (*handler)(void);
+	uint8 cycles[NUM_CPU_TYPES];   /* Base cycles by CPU type */
+} m68ki_instruction_handler;
+
+extern uint16                    m68ki_instruction_index[0x10000];
+extern m68ki_instruction_handler m68ki_instruction_handlers[];
+
+#if M68K_HOST_PAGE_MAP
+extern unsigned char *m68ki_host_read_page[M68K_HOST_PAGE_COUNT];
+extern unsigned char *m68ki_host_write_page[M68K_HOST_PAGE_COUNT];
+#endif /* M68K_HOST_PAGE_MAP */
+
+#if M68K_BLOCK_CACHE
+/* Code pages are tracked at a finer granularity than host pages, so data
+ * written next to code doesn't throw away every block in a 64K page.
+ * An odd generation means blocks have been decoded from the page.
+ */
+#define M68KI_BC_PAGE_SHIFT 12
+extern uint32*       m68ki_bc_page_gen;
+extern const uint16* m68ki_bc_imm;
+extern int           m68ki_bc_enabled;
+#endif /* M68K_BLOCK_CACHE */
+
 extern uint           m68ki_aerr_address;
 extern uint           m68ki_aerr_write_mode;
 extern uint           m68ki_aerr_fc;
@@ -1020,7 +1196,7 @@ extern uint           m68ki_aerr_fc;
 /* Forward declarations to keep some of the macros happy */
 static inline uint m68ki_read_16_fc (uint address, uint fc);
 static inline uint m68ki_read_32_fc (uint address, uint fc);
-static inline uint m68ki_get_ea_ix(uint An);
+static M68KI_ALWAYS_INLINE uint m68ki_get_ea_ix(uint An, uint cpu_type);
 static inline void m68ki_check_interrupts(void);            /* ASG: check for interrupts */
 
 /* quick disassembly (used for logging) */
@@ -1041,6 +1217,15 @@ extern uint pmmu_translate_addr(uint addr_in);
  */
 static inline uint m68ki_read_imm_16(void)
 {
+#if M68K_BLOCK_CACHE
+	/* Instruction words already extracted when the block was decoded */
+	if(m68ki_bc_imm)
+	{
+		REG_PC += 2;
+		return *m68ki_bc_imm++;
+	}
+#endif /* M68K_BLOCK_CACHE */
+
 	m68ki_set_fc(FLAG_S | FUNCTION_CODE_USER_PROGRAM); /* auto-disable (see m68kcpu.h) */
 	m68ki_check_address_error(REG_PC, MODE_READ, FLAG_S | FUNCTION_CODE_USER_PROGRAM); /* auto-disable (see m68kcpu.h) */
 
@@ -1079,6 +1264,16 @@ static inline uint m68ki_read_imm_8(void)
 
 static inline uint m68ki_read_imm_32(void)
 {
+#if M68K_BLOCK_CACHE
+	if(m68ki_bc_imm)
+	{
+		uint temp_val = (m68ki_bc_imm[0] << 16) | m68ki_bc_imm[1];
+		m68ki_bc_imm += 2;
+		REG_PC += 4;
+		return temp_val;
+	}
+#endif /* M68K_BLOCK_CACHE */
+
 #if M68K_SEPARATE_READS
 #if M68K_EMULATE_PMMU
 	if (PMMU_ENABLED)
@@ -1116,6 +1311,28 @@ static inline uint m68ki_read_imm_32(void)
 #endif /* M68K_EMULATE_PREFETCH */
 }
 
+/* Drop blocks decoded from code pages that are being written to */
+#if M68K_BLOCK_CACHE
+static inline void m68ki_bc_note_write(uint address, uint size)
+{
+	uint32* gen;
+
+	if(!m68ki_bc_enabled)
+		return;
+	gen = &m68ki_bc_page_gen[address >> M68KI_BC_PAGE_SHIFT];
+	if(*gen & 1)
+		(*gen)++;
+	if(size > 1)
+	{
+		gen = &m68ki_bc_page_gen[(address + size - 1) >> M68KI_BC_PAGE_SHIFT];
+		if(*gen & 1)
+			(*gen)++;
+	}
+}
+#else
+#define m68ki_bc_note_write(A, S)
+#endif /* M68K_BLOCK_CACHE */
+
 /* ------------------------- Top level read/write ------------------------- */
 
 /* Handles all memory accesses (except for immediate reads if they are
@@ -1134,6 +1351,14 @@ static inline uint m68ki_read_8_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_read_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page)
+			return page[address & M68K_HOST_PAGE_MASK];
+	}
+#endif
+
 	return m68k_read_memory_8(ADDRESS_68K(address));
 }
 static inline uint m68ki_read_16_fc(uint address, uint fc)
@@ -1147,6 +1372,14 @@ static inline uint m68ki_read_16_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_read_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page && (address & M68K_HOST_PAGE_MASK) <= M68K_HOST_PAGE_MASK - 1)
+			return be16toh(*(uint16_t *)(page + (address & M68K_HOST_PAGE_MASK)));
+	}
+#endif
+
 	return m68k_read_memory_16(ADDRESS_68K(address));
 }
 static inline uint m68ki_read_32_fc(uint address, uint fc)
@@ -1160,6 +1393,14 @@ static inline uint m68ki_read_32_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_read_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page && (address & M68K_HOST_PAGE_MASK) <= M68K_HOST_PAGE_MASK - 3)
+			return be32toh(*(uint32_t *)(page + (address & M68K_HOST_PAGE_MASK)));
+	}
+#endif
+
 	return m68k_read_memory_32(ADDRESS_68K(address));
 }
 
@@ -1173,6 +1414,19 @@ static inline void m68ki_write_8_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+	m68ki_bc_note_write(ADDRESS_68K(address), 1);
+
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_write_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page)
+		{
+			page[address & M68K_HOST_PAGE_MASK] = (unsigned char)value;
+			return;
+		}
+	}
+#endif
+
 	m68k_write_memory_8(ADDRESS_68K(address), value);
 }
 static inline void m68ki_write_16_fc(uint address, uint fc, uint value)
@@ -1186,6 +1440,19 @@ static inline void m68ki_write_16_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+	m68ki_bc_note_write(ADDRESS_68K(address), 2);
+
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_write_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page && (address & M68K_HOST_PAGE_MASK) <= M68K_HOST_PAGE_MASK - 1)
+		{
+			*(uint16_t *)(page + (address & M68K_HOST_PAGE_MASK)) = htobe16(value);
+			return;
+		}
+	}
+#endif
+
 	m68k_write_memory_16(ADDRESS_68K(address), value);
 }
 static inline void m68ki_write_32_fc(uint address, uint fc, uint value)
@@ -1199,6 +1466,19 @@ static inline void m68ki_write_32_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+	m68ki_bc_note_write(ADDRESS_68K(address), 4);
+
+#if M68K_HOST_PAGE_MAP
+	{
+		unsigned char *page = m68ki_host_write_page[ADDRESS_68K(address) >> M68K_HOST_PAGE_SHIFT];
+		if (page && (address & M68K_HOST_PAGE_MASK) <= M68K_HOST_PAGE_MASK - 3)
+		{
+			*(uint32_t *)(page + (address & M68K_HOST_PAGE_MASK)) = htobe32(value);
+			return;
+		}
+	}
+#endif
+
 	m68k_write_memory_32(ADDRESS_68K(address), value);
 }
 
@@ -1214,6 +1494,8 @@ static inline void m68ki_write_32_pd_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+	m68ki_bc_note_write(ADDRESS_68K(address), 4);
+
 	m68k_write_memory_32_pd(ADDRESS_68K(address), value);
 }
 #endif
@@ -1231,10 +1513,10 @@ static inline uint m68ki_get_ea_pcdi(void)
 }
 
 
-static inline uint m68ki_get_ea_pcix(void)
+static inline uint m68ki_get_ea_pcix(uint cpu_type)
 {
 	m68ki_use_program_space(); /* auto-disable */
-	return m68ki_get_ea_ix(REG_PC);
+	return m68ki_get_ea_ix(REG_PC, cpu_type);
 }
 
 /* Indexed addressing modes are encoded as follows:
@@ -1278,43 +1560,17 @@ static inline uint m68ki_get_ea_pcix(void)
  * 1  010  mem indir with word outer
  * 1  011  mem indir with long outer
  * 1  100-111  reserved
+ *
+ * The CPU type comes from the EA macros, so that opcode handlers built for
+ * one CPU family (see m68k_in.c) only keep the format decoding it uses.  The
+ * full extension format of the 68020+ is kept out of line.
  */
-static inline uint m68ki_get_ea_ix(uint An)
+static M68KI_NOINLINE uint m68ki_get_ea_ix_full(uint An, uint extension)
 {
-	/* An = base register */
-	uint extension = m68ki_read_imm_16();
 	uint Xn = 0;                        /* Index register */
 	uint bd = 0;                        /* Base Displacement */
 	uint od = 0;                        /* Outer Displacement */
 
-	if(CPU_TYPE_IS_010_LESS(CPU_TYPE))
-	{
-		/* Calculate index */
-		Xn = REG_DA[extension>>12];     /* Xn */
-		if(!BIT_B(extension))           /* W/L */
-			Xn = MAKE_INT_16(Xn);
-
-		/* Add base register and displacement and return */
-		return An + Xn + MAKE_INT_8(extension);
-	}
-
-	/* Brief extension format */
-	if(!BIT_8(extension))
-	{
-		/* Calculate index */
-		Xn = REG_DA[extension>>12];     /* Xn */
-		if(!BIT_B(extension))           /* W/L */
-			Xn = MAKE_INT_16(Xn);
-		/* Add scale if proper CPU type */
-		if(CPU_TYPE_IS_EC020_PLUS(CPU_TYPE))
-			Xn <<= (extension>>9) & 3;  /* SCALE */
-
-		/* Add base register and displacement and return */
-		return An + Xn + MAKE_INT_8(extension);
-	}
-
-	/* Full extension format */
-
 	USE_CYCLES(m68ki_ea_idx_cycle_table[extension&0x3f]);
 
 	/* Check if base register is present */
@@ -1350,6 +1606,42 @@ static inline uint m68ki_get_ea_ix(uint An)
 	return m68ki_read_32(An + bd + Xn) + od;
 }
 
+static M68KI_ALWAYS_INLINE uint m68ki_get_ea_ix(uint An, uint cpu_type)
+{
+	/* An = base register */
+	uint extension = m68ki_read_imm_16();
+	uint Xn;                            /* Index register */
+
+	if(CPU_TYPE_IS_010_LESS(cpu_type))
+	{
+		/* Calculate index */
+		Xn = REG_DA[extension>>12];     /* Xn */
+		if(!BIT_B(extension))           /* W/L */
+			Xn = MAKE_INT_16(Xn);
+
+		/* Add base register and displacement and return */
+		return An + Xn + MAKE_INT_8(extension);
+	}
+
+	/* Brief extension format */
+	if(!BIT_8(extension))
+	{
+		/* Calculate index */
+		Xn = REG_DA[extension>>12];     /* Xn */
+		if(!BIT_B(extension))           /* W/L */
+			Xn = MAKE_INT_16(Xn);
+		/* Add scale if proper CPU type */
+		if(CPU_TYPE_IS_EC020_PLUS(cpu_type))
+			Xn <<= (extension>>9) & 3;  /* SCALE */
+
+		/* Add base register and displacement and return */
+		return An + Xn + MAKE_INT_8(extension);
+	}
+
+	/* Full extension format */
+	return m68ki_get_ea_ix_full(An, extension);
+}
+
 
 /* Fetch operands */
 static inline uint OPER_AY_AI_8(void)  {uint ea = EA_AY_AI_8();  return m68ki_read_8(ea); }
@@ -1364,9 +1656,9 @@ static inline uint OPER_AY_PD_32(void) {uint ea = EA_AY_PD_32(); return m68ki_re
 static inline uint OPER_AY_DI_8(void)  {uint ea = EA_AY_DI_8();  return m68ki_read_8(ea); }
 static inline uint OPER_AY_DI_16(void) {uint ea = EA_AY_DI_16(); return m68ki_read_16(ea);}
 static inline uint OPER_AY_DI_32(void) {uint ea = EA_AY_DI_32(); return m68ki_read_32(ea);}
-static inline uint OPER_AY_IX_8(void)  {uint ea = EA_AY_IX_8();  return m68ki_read_8(ea); }
-static inline uint OPER_AY_IX_16(void) {uint ea = EA_AY_IX_16(); return m68ki_read_16(ea);}
-static inline uint OPER_AY_IX_32(void) {uint ea = EA_AY_IX_32(); return m68ki_read_32(ea);}
+static inline uint m68ki_oper_ay_ix_8(uint cpu_type)  {uint ea = m68ki_get_ea_ix(AY, cpu_type); return m68ki_read_8(ea); }
+static inline uint m68ki_oper_ay_ix_16(uint cpu_type) {uint ea = m68ki_get_ea_ix(AY, cpu_type); return m68ki_read_16(ea);}
+static inline uint m68ki_oper_ay_ix_32(uint cpu_type) {uint ea = m68ki_get_ea_ix(AY, cpu_type); return m68ki_read_32(ea);}
 
 static inline uint OPER_AX_AI_8(void)  {uint ea = EA_AX_AI_8();  return m68ki_read_8(ea); }
 static inline uint OPER_AX_AI_16(void) {uint ea = EA_AX_AI_16(); return m68ki_read_16(ea);}
@@ -1380,9 +1672,9 @@ static inline uint OPER_AX_PD_32(void) {uint ea = EA_AX_PD_32(); return m68ki_re
 static inline uint OPER_AX_DI_8(void)  {uint ea = EA_AX_DI_8();  return m68ki_read_8(ea); }
 static inline uint OPER_AX_DI_16(void) {uint ea = EA_AX_DI_16(); return m68ki_read_16(ea);}
 static inline uint OPER_AX_DI_32(void) {uint ea = EA_AX_DI_32(); return m68ki_read_32(ea);}
-static inline uint OPER_AX_IX_8(void)  {uint ea = EA_AX_IX_8();  return m68ki_read_8(ea); }
-static inline uint OPER_AX_IX_16(void) {uint ea = EA_AX_IX_16(); return m68ki_read_16(ea);}
-static inline uint OPER_AX_IX_32(void) {uint ea = EA_AX_IX_32(); return m68ki_read_32(ea);}
+static inline uint m68ki_oper_ax_ix_8(uint cpu_type)  {uint ea = m68ki_get_ea_ix(AX, cpu_type); return m68ki_read_8(ea); }
+static inline uint m68ki_oper_ax_ix_16(uint cpu_type) {uint ea = m68ki_get_ea_ix(AX, cpu_type); return m68ki_read_16(ea);}
+static inline uint m68ki_oper_ax_ix_32(uint cpu_type) {uint ea = m68ki_get_ea_ix(AX, cpu_type); return m68ki_read_32(ea);}
 
 static inline uint OPER_A7_PI_8(void)  {uint ea = EA_A7_PI_8();  return m68ki_read_8(ea); }
 static inline uint OPER_A7_PD_8(void)  {uint ea = EA_A7_PD_8();  return m68ki_read_8(ea); }
@@ -1396,9 +1688,20 @@ static inline uint OPER_AL_32(void)    {uint ea = EA_AL_32();    return m68ki_re
 static inline uint OPER_PCDI_8(void)   {uint ea = EA_PCDI_8();   return m68ki_read_pcrel_8(ea); }
 static inline uint OPER_PCDI_16(void)  {uint ea = EA_PCDI_16();  return m68ki_read_pcrel_16(ea);}
 static inline uint OPER_PCDI_32(void)  {uint ea = EA_PCDI_32();  return m68ki_read_pcrel_32(ea);}
-static inline uint OPER_PCIX_8(void)   {uint ea = EA_PCIX_8();   return m68ki_read_pcrel_8(ea); }
-static inline uint OPER_PCIX_16(void)  {uint ea = EA_PCIX_16();  return m68ki_read_pcrel_16(ea);}
-static inline uint OPER_PCIX_32(void)  {uint ea = EA_PCIX_32();  return m68ki_read_pcrel_32(ea);}
+static inline uint m68ki_oper_pcix_8(uint cpu_type) {uint ea = m68ki_get_ea_pcix(cpu_type); return m68ki_read_pcrel_8(ea); }
+static inline uint m68ki_oper_pcix_16(uint cpu_type) {uint ea = m68ki_get_ea_pcix(cpu_type); return m68ki_read_pcrel_16(ea);}
+static inline uint m68ki_oper_pcix_32(uint cpu_type) {uint ea = m68ki_get_ea_pcix(cpu_type); return m68ki_read_pcrel_32(ea);}
+
+/* The indexed modes take the CPU type of the handler, like their EA macros */
+#define OPER_AY_IX_8()   m68ki_oper_ay_ix_8(CPU_TYPE)
+#define OPER_AY_IX_16()  m68ki_oper_ay_ix_16(CPU_TYPE)
+#define OPER_AY_IX_32()  m68ki_oper_ay_ix_32(CPU_TYPE)
+#define OPER_AX_IX_8()   m68ki_oper_ax_ix_8(CPU_TYPE)
+#define OPER_AX_IX_16()  m68ki_oper_ax_ix_16(CPU_TYPE)
+#define OPER_AX_IX_32()  m68ki_oper_ax_ix_32(CPU_TYPE)
+#define OPER_PCIX_8()    m68ki_oper_pcix_8(CPU_TYPE)
+#define OPER_PCIX_16()   m68ki_oper_pcix_16(CPU_TYPE)
+#define OPER_PCIX_32()   m68ki_oper_pcix_32(CPU_TYPE)
 
 
 
@@ -1846,7 +2149,7 @@ static inline void m68ki_exception_trap(uint vector)
 	m68ki_jump_vector(vector);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[vector] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[vector] - CYC_INSTRUCTION(REG_IR));
 }
 
 /* Trap#n stacks a 0 frame but behaves like group2 otherwise */
@@ -1857,7 +2160,7 @@ static inline void m68ki_exception_trapN(uint vector)
 	m68ki_jump_vector(vector);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[vector] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[vector] - CYC_INSTRUCTION(REG_IR));
 }
 
 /* Exception for trace mode */
@@ -1903,7 +2206,7 @@ static inline void m68ki_exception_privilege_violation(void)
 	m68ki_jump_vector(EXCEPTION_PRIVILEGE_VIOLATION);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_PRIVILEGE_VIOLATION] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_PRIVILEGE_VIOLATION] - CYC_INSTRUCTION(REG_IR));
 }
 
 extern jmp_buf m68ki_bus_error_jmp_buf;
@@ -1928,7 +2231,7 @@ m68k_read_memory_8(0x00ffff01);
 	CPU_RUN_MODE = RUN_MODE_BERR_AERR_RESET;
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_BUS_ERROR] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_BUS_ERROR] - CYC_INSTRUCTION(REG_IR));
 
 	for (i = 15; i >= 0; i--){
 		REG_DA[i] = REG_DA_SAVE[i];
@@ -1958,7 +2261,7 @@ static inline void m68ki_exception_1010(void)
 	m68ki_jump_vector(EXCEPTION_1010);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_1010] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_1010] - CYC_INSTRUCTION(REG_IR));
 }
 
 /* Exception for F-Line instructions */
@@ -1977,7 +2280,7 @@ static inline void m68ki_exception_1111(void)
 	m68ki_jump_vector(EXCEPTION_1111);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_1111] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_1111] - CYC_INSTRUCTION(REG_IR));
 }
 
 #if M68K_ILLG_HAS_CALLBACK == OPT_SPECIFY_HANDLER
@@ -2008,7 +2311,7 @@ static inline void m68ki_exception_illegal(void)
 	m68ki_jump_vector(EXCEPTION_ILLEGAL_INSTRUCTION);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_ILLEGAL_INSTRUCTION] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_ILLEGAL_INSTRUCTION] - CYC_INSTRUCTION(REG_IR));
 }
 
 /* Exception for format errror in RTE */
@@ -2019,7 +2322,7 @@ static inline void m68ki_exception_format_error(void)
 	m68ki_jump_vector(EXCEPTION_FORMAT_ERROR);
 
 	/* Use up some clock cycles and undo the instruction's cycles */
-	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_FORMAT_ERROR] - CYC_INSTRUCTION[REG_IR]);
+	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_FORMAT_ERROR] - CYC_INSTRUCTION(REG_IR));
 }
 
 /* Exception for address error */
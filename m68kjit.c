@@ -0,0 +1,945 @@
+/* ======================================================================== */
+/* ============================ BLOCK COMPILER ============================ */
+/* ======================================================================== */
+/*
+ * Translates hot blocks from the block cache into host machine code.
+ *
+ * This file is included from m68kcpu.c, since it works directly on the
+ * block cache structures.
+ *
+ * The common data movement and logic instructions (moveq, move, movea,
+ * lea, addq/subq to An, and, or, eor) are translated into native code
+ * that works on m68ki_cpu directly.  Their memory accesses load and store
+ * the host RAM/ROM pages inline, and call out to m68ki_read_xx() and
+ * m68ki_write_xx() for everything else: addresses without a host page,
+ * accesses that cross a page and writes to pages with decoded code.
+ *
+ * All other instructions are subroutine threaded: the generated code
+ * stores the instruction state that m68k_execute would otherwise set up
+ * and calls the opcode handler directly.  Either way the cycles are
+ * accounted and execution is checked to still be on the expected path
+ * after every instruction, so there is no fetch, no jump table lookup and
+ * no loop overhead left.
+ *
+ * A translation stays valid as long as the block it was made from; writes
+ * to a page holding translated code bump the page generation, which the
+ * generated code checks after every instruction.
+ */
+
+#if M68K_JIT
+
+#if M68K_EMULATE_TRACE || M68K_EMULATE_FC || M68K_INSTRUCTION_HOOK
+#error M68K_JIT requires M68K_EMULATE_TRACE, M68K_EMULATE_FC and M68K_INSTRUCTION_HOOK to be off
+#endif
+
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#define M68KI_JIT_HOST 1
+#else
+#define M68KI_JIT_HOST 0
+#endif
+
+/* Number of times a block is interpreted before it gets translated */
+#define M68KI_JIT_THRESHOLD  16
+#define M68KI_JIT_CODE_SIZE  (8 << 20)
+/* Worst case size of the code for one instruction, plus the block epilogue */
+#define M68KI_JIT_MAX_INSTR_SIZE 1024
+
+#define M68KI_JIT_OFFSET(FIELD) ((uint)offsetof(m68ki_cpu_core, FIELD))
+
+static int            m68ki_jit_enabled = 0;
+static unsigned char* m68ki_jit_code = NULL;
+static uint           m68ki_jit_code_used = 0;
+static FILE*          m68ki_jit_perf_map = NULL;
+
+/* Places in the block that branch to the exit code, patched at the end.  A
+ * threaded instruction has the most: PC, cycles, end of slice, stopped, two
+ * page generations and the epoch.
+ */
+static uint m68ki_jit_exits[M68KI_BC_MAX_INSTRS * 7];
+static uint m68ki_jit_num_exits;
+
+static unsigned char* m68ki_jit_ptr;
+
+static void m68ki_jit_store_cpu(uint offset, uint value);
+static void m68ki_jit_store_state(void);
+
+static void m68ki_jit_emit8(uint value)
+{
+	*m68ki_jit_ptr++ = value;
+}
+
+static void m68ki_jit_emit32(uint value)
+{
+	memcpy(m68ki_jit_ptr, &value, 4);
+	m68ki_jit_ptr += 4;
+}
+
+#if defined(__x86_64__)
+
+/* rbx = &m68ki_cpu, r12 = &m68ki_remaining_cycles, r13 = &m68ki_bc_imm */
+
+static void m68ki_jit_emit64(uint64_t value)
+{
+	memcpy(m68ki_jit_ptr, &value, 8);
+	m68ki_jit_ptr += 8;
+}
+
+static void m68ki_jit_exit_if(uint cc)
+{
+	m68ki_jit_emit8(0x0f);
+	m68ki_jit_emit8(0x80 | cc);
+	m68ki_jit_exits[m68ki_jit_num_exits++] = m68ki_jit_ptr - m68ki_jit_code;
+	m68ki_jit_emit32(0);
+}
+
+#define M68KI_JIT_CC_NE 0x5
+#define M68KI_JIT_CC_LE 0xe
+
+static void m68ki_jit_prologue(void)
+{
+	m68ki_jit_emit8(0x53);                           /* push rbx */
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x54);    /* push r12 */
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x55);    /* push r13 */
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xbb);    /* mov rbx, &m68ki_cpu */
+	m68ki_jit_emit64((uintptr_t)&m68ki_cpu);
+	m68ki_jit_emit8(0x49); m68ki_jit_emit8(0xbc);    /* mov r12, &m68ki_remaining_cycles */
+	m68ki_jit_emit64((uintptr_t)&m68ki_remaining_cycles);
+	m68ki_jit_emit8(0x49); m68ki_jit_emit8(0xbd);    /* mov r13, &m68ki_bc_imm */
+	m68ki_jit_emit64((uintptr_t)&m68ki_bc_imm);
+}
+
+static void m68ki_jit_epilogue(void)
+{
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x5d);    /* pop r13 */
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x5c);    /* pop r12 */
+	m68ki_jit_emit8(0x5b);                           /* pop rbx */
+	m68ki_jit_emit8(0xc3);                           /* ret */
+}
+
+static void m68ki_jit_patch_exits(unsigned char* target)
+{
+	uint i;
+
+	for(i = 0; i < m68ki_jit_num_exits; i++)
+	{
+		unsigned char* branch = m68ki_jit_code + m68ki_jit_exits[i];
+		uint rel = target - (branch + 4);
+		memcpy(branch, &rel, 4);
+	}
+}
+
+static void m68ki_jit_store_cpu(uint offset, uint value)
+{
+	m68ki_jit_emit8(0xc7); m68ki_jit_emit8(0x83);    /* mov dword [rbx+offset], value */
+	m68ki_jit_emit32(offset);
+	m68ki_jit_emit32(value);
+}
+
+static void m68ki_jit_save_registers(void)
+{
+	uint i;
+
+	for(i = 0; i < 16; i += 2)
+	{
+		m68ki_jit_emit8(0x48); m68ki_jit_emit8(0x8b); m68ki_jit_emit8(0x83); /* mov rax, [rbx+dar] */
+		m68ki_jit_emit32(M68KI_JIT_OFFSET(dar) + i * 4);
+		m68ki_jit_emit8(0x48); m68ki_jit_emit8(0x89); m68ki_jit_emit8(0x83); /* mov [rbx+dar_save], rax */
+		m68ki_jit_emit32(M68KI_JIT_OFFSET(dar_save) + i * 4);
+	}
+}
+
+static void m68ki_jit_call(void (*handler)(void), const uint16* imm)
+{
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, imm */
+	m68ki_jit_emit64((uintptr_t)imm);
+	m68ki_jit_emit8(0x49); m68ki_jit_emit8(0x89);    /* mov [r13], rax */
+	m68ki_jit_emit8(0x45); m68ki_jit_emit8(0x00);
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, handler */
+	m68ki_jit_emit64((uintptr_t)handler);
+	m68ki_jit_emit8(0xff); m68ki_jit_emit8(0xd0);    /* call rax */
+	m68ki_jit_emit8(0x49); m68ki_jit_emit8(0xc7);    /* mov qword [r13], 0 */
+	m68ki_jit_emit8(0x45); m68ki_jit_emit8(0x00);
+	m68ki_jit_emit32(0);
+}
+
+static void m68ki_jit_use_cycles(uint cycles)
+{
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x81);    /* sub dword [r12], cycles */
+	m68ki_jit_emit8(0x2c); m68ki_jit_emit8(0x24);
+	m68ki_jit_emit32(cycles);
+}
+
+static void m68ki_jit_check_cpu(uint offset, uint value)
+{
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xbb);    /* cmp dword [rbx+offset], value */
+	m68ki_jit_emit32(offset);
+	m68ki_jit_emit32(value);
+	m68ki_jit_exit_if(M68KI_JIT_CC_NE);
+}
+
+/* Same as SLICE_OVER() */
+static void m68ki_jit_check_cycles(void)
+{
+	m68ki_jit_emit8(0x41); m68ki_jit_emit8(0x83);    /* cmp dword [r12], 0 */
+	m68ki_jit_emit8(0x3c); m68ki_jit_emit8(0x24);
+	m68ki_jit_emit8(0x00);
+	m68ki_jit_exit_if(M68KI_JIT_CC_LE);
+	m68ki_jit_check_cpu(M68KI_JIT_OFFSET(end_slice), 0);
+}
+
+static void m68ki_jit_check_gen(const uint32* ptr, const uint32* expected)
+{
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, ptr */
+	m68ki_jit_emit64((uintptr_t)ptr);
+	m68ki_jit_emit8(0x8b); m68ki_jit_emit8(0x08);    /* mov ecx, [rax] */
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, expected */
+	m68ki_jit_emit64((uintptr_t)expected);
+	m68ki_jit_emit8(0x3b); m68ki_jit_emit8(0x08);    /* cmp ecx, [rax] */
+	m68ki_jit_exit_if(M68KI_JIT_CC_NE);
+}
+
+static void m68ki_jit_check32(const uint* ptr, uint value)
+{
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, ptr */
+	m68ki_jit_emit64((uintptr_t)ptr);
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0x38);    /* cmp dword [rax], value */
+	m68ki_jit_emit32(value);
+	m68ki_jit_exit_if(M68KI_JIT_CC_NE);
+}
+
+/* Translated instructions keep the operand value in eax and the address in
+ * ecx, edx, esi and edi are scratch.
+ */
+#define M68KI_JIT_V 0
+#define M68KI_JIT_A 1
+
+#define M68KI_JIT_CC_EQ  0x4
+#define M68KI_JIT_CC_HI  0x7
+#define M68KI_JIT_ALWAYS 0x10
+
+#define M68KI_JIT_AND 0x21
+#define M68KI_JIT_OR  0x09
+#define M68KI_JIT_EOR 0x31
+
+/* Forward branch inside the code of an instruction, see m68ki_jit_bind() */
+static uint m68ki_jit_branch(uint cc)
+{
+	uint site;
+
+	if(cc == M68KI_JIT_ALWAYS)
+		m68ki_jit_emit8(0xe9);                       /* jmp */
+	else
+	{
+		m68ki_jit_emit8(0x0f);                       /* jcc */
+		m68ki_jit_emit8(0x80 | cc);
+	}
+	site = m68ki_jit_ptr - m68ki_jit_code;
+	m68ki_jit_emit32(0);
+	return site;
+}
+
+static void m68ki_jit_bind(uint site)
+{
+	unsigned char* branch = m68ki_jit_code + site;
+	uint rel = m68ki_jit_ptr - (branch + 4);
+
+	memcpy(branch, &rel, 4);
+}
+
+static void m68ki_jit_load(uint reg, uint offset)
+{
+	m68ki_jit_emit8(0x8b); m68ki_jit_emit8(0x83 | (reg << 3));    /* mov reg, [rbx+offset] */
+	m68ki_jit_emit32(offset);
+}
+
+static void m68ki_jit_store(uint offset, uint reg, uint size)
+{
+	if(size == 2)
+		m68ki_jit_emit8(0x66);
+	m68ki_jit_emit8(size == 1 ? 0x88 : 0x89);       /* mov [rbx+offset], reg */
+	m68ki_jit_emit8(0x83 | (reg << 3));
+	m68ki_jit_emit32(offset);
+}
+
+static void m68ki_jit_move_imm(uint reg, uint value)
+{
+	m68ki_jit_emit8(0xb8 | reg);                     /* mov reg, value */
+	m68ki_jit_emit32(value);
+}
+
+static void m68ki_jit_add_imm(uint reg, uint value)
+{
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xc0 | reg);    /* add reg, value */
+	m68ki_jit_emit32(value);
+}
+
+static void m68ki_jit_add_cpu(uint offset, uint value)
+{
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0x83);    /* add dword [rbx+offset], value */
+	m68ki_jit_emit32(offset);
+	m68ki_jit_emit32(value);
+}
+
+#if M68K_LAZY_FLAGS
+static void m68ki_jit_and_cpu(uint offset, uint value)
+{
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xa3);    /* and dword [rbx+offset], value */
+	m68ki_jit_emit32(offset);
+	m68ki_jit_emit32(value);
+}
+#endif /* M68K_LAZY_FLAGS */
+
+/* Zero or sign extend the low byte or word of the value */
+static void m68ki_jit_extend(uint size, int sign)
+{
+	m68ki_jit_emit8(0x0f);                           /* movzx/movsx eax, al/ax */
+	m68ki_jit_emit8(size == 1 ? 0xb6 : (sign ? 0xbf : 0xb7));
+	m68ki_jit_emit8(0xc0);
+}
+
+/* value = value op address register */
+static void m68ki_jit_alu(uint op)
+{
+	m68ki_jit_emit8(op); m68ki_jit_emit8(0xc8);      /* and/or/xor eax, ecx */
+}
+
+static void m68ki_jit_store_shifted(uint offset, uint shift)
+{
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xc2);    /* mov edx, eax */
+	m68ki_jit_emit8(0xc1); m68ki_jit_emit8(0xea);    /* shr edx, shift */
+	m68ki_jit_emit8(shift);
+	m68ki_jit_store(offset, 2, 4);
+}
+
+/* Mask the address into edx, and branch if the access crosses a code page */
+static uint m68ki_jit_mask_address(uint size, uint mask)
+{
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xca);    /* mov edx, ecx */
+	if(mask != 0xffffffff)
+	{
+		m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xe2);    /* and edx, mask */
+		m68ki_jit_emit32(mask);
+	}
+	if(size == 1)
+		return 0;
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xd6);    /* mov esi, edx */
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xe6);    /* and esi, page mask */
+	m68ki_jit_emit32((1 << M68KI_BC_PAGE_SHIFT) - 1);
+	m68ki_jit_emit8(0x81); m68ki_jit_emit8(0xfe);    /* cmp esi, page size - size */
+	m68ki_jit_emit32((1 << M68KI_BC_PAGE_SHIFT) - size);
+	return m68ki_jit_branch(M68KI_JIT_CC_HI);
+}
+
+/* Look up the host page of edx in a page table into rdi, and the offset
+ * in the page into edx.  Branches away if there is no host page.
+ */
+static uint m68ki_jit_host_page(unsigned char** table)
+{
+	uint site;
+
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xd6);    /* mov esi, edx */
+	m68ki_jit_emit8(0xc1); m68ki_jit_emit8(0xee);    /* shr esi, M68K_HOST_PAGE_SHIFT */
+	m68ki_jit_emit8(M68K_HOST_PAGE_SHIFT);
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xbf);    /* mov rdi, table */
+	m68ki_jit_emit64((uintptr_t)table);
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0x8b);    /* mov rdi, [rdi+rsi*8] */
+	m68ki_jit_emit8(0x3c); m68ki_jit_emit8(0xf7);
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0x85);    /* test rdi, rdi */
+	m68ki_jit_emit8(0xff);
+	site = m68ki_jit_branch(M68KI_JIT_CC_EQ);
+	m68ki_jit_emit8(0x0f); m68ki_jit_emit8(0xb7);    /* movzx edx, dx */
+	m68ki_jit_emit8(0xd2);
+	return site;
+}
+
+static void m68ki_jit_call_bus(void (*function)(void), int write)
+{
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xcf);    /* mov edi, ecx */
+	if(write)
+	{
+		m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xc6);    /* mov esi, eax */
+	}
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xb8);    /* mov rax, function */
+	m68ki_jit_emit64((uintptr_t)function);
+	m68ki_jit_emit8(0xff); m68ki_jit_emit8(0xd0);    /* call rax, leaves the value in eax */
+}
+
+/* Read from the address in ecx into eax */
+static void m68ki_jit_read(uint size, uint mask, void (*bus_read)(void))
+{
+	uint slow[2];
+	uint done;
+
+	slow[0] = m68ki_jit_mask_address(size, mask);
+	slow[1] = m68ki_jit_host_page(m68ki_host_read_page);
+	switch(size)
+	{
+		case 1:
+			m68ki_jit_emit8(0x0f); m68ki_jit_emit8(0xb6);    /* movzx eax, byte [rdi+rdx] */
+			m68ki_jit_emit8(0x04); m68ki_jit_emit8(0x17);
+			break;
+		case 2:
+			m68ki_jit_emit8(0x0f); m68ki_jit_emit8(0xb7);    /* movzx eax, word [rdi+rdx] */
+			m68ki_jit_emit8(0x04); m68ki_jit_emit8(0x17);
+			m68ki_jit_emit8(0x66); m68ki_jit_emit8(0xc1);    /* rol ax, 8 */
+			m68ki_jit_emit8(0xc0); m68ki_jit_emit8(0x08);
+			break;
+		default:
+			m68ki_jit_emit8(0x8b); m68ki_jit_emit8(0x04);    /* mov eax, [rdi+rdx] */
+			m68ki_jit_emit8(0x17);
+			m68ki_jit_emit8(0x0f); m68ki_jit_emit8(0xc8);    /* bswap eax */
+			break;
+	}
+	done = m68ki_jit_branch(M68KI_JIT_ALWAYS);
+
+	if(size > 1)
+		m68ki_jit_bind(slow[0]);
+	m68ki_jit_bind(slow[1]);
+	m68ki_jit_store_state();
+	m68ki_jit_call_bus(bus_read, 0);
+	m68ki_jit_bind(done);
+}
+
+/* Write eax to the address in ecx */
+static void m68ki_jit_write(uint size, uint mask, void (*bus_write)(void))
+{
+	uint slow[3];
+	uint done;
+
+	slow[0] = m68ki_jit_mask_address(size, mask);
+	/* Writes to pages with decoded code go the slow way, which drops the blocks */
+	m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xd6);    /* mov esi, edx */
+	m68ki_jit_emit8(0xc1); m68ki_jit_emit8(0xee);    /* shr esi, M68KI_BC_PAGE_SHIFT */
+	m68ki_jit_emit8(M68KI_BC_PAGE_SHIFT);
+	m68ki_jit_emit8(0x48); m68ki_jit_emit8(0xbf);    /* mov rdi, m68ki_bc_page_gen */
+	m68ki_jit_emit64((uintptr_t)m68ki_bc_page_gen);
+	m68ki_jit_emit8(0xf6); m68ki_jit_emit8(0x04);    /* test byte [rdi+rsi*4], 1 */
+	m68ki_jit_emit8(0xb7); m68ki_jit_emit8(0x01);
+	slow[1] = m68ki_jit_branch(M68KI_JIT_CC_NE);
+	slow[2] = m68ki_jit_host_page(m68ki_host_write_page);
+	switch(size)
+	{
+		case 1:
+			m68ki_jit_emit8(0x88); m68ki_jit_emit8(0x04);    /* mov [rdi+rdx], al */
+			m68ki_jit_emit8(0x17);
+			break;
+		case 2:
+			m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xc6);    /* mov esi, eax */
+			m68ki_jit_emit8(0x66); m68ki_jit_emit8(0xc1);    /* rol si, 8 */
+			m68ki_jit_emit8(0xc6); m68ki_jit_emit8(0x08);
+			m68ki_jit_emit8(0x66); m68ki_jit_emit8(0x89);    /* mov [rdi+rdx], si */
+			m68ki_jit_emit8(0x34); m68ki_jit_emit8(0x17);
+			break;
+		default:
+			m68ki_jit_emit8(0x89); m68ki_jit_emit8(0xc6);    /* mov esi, eax */
+			m68ki_jit_emit8(0x0f); m68ki_jit_emit8(0xce);    /* bswap esi */
+			m68ki_jit_emit8(0x89); m68ki_jit_emit8(0x34);    /* mov [rdi+rdx], esi */
+			m68ki_jit_emit8(0x17);
+			break;
+	}
+	done = m68ki_jit_branch(M68KI_JIT_ALWAYS);
+
+	if(size > 1)
+		m68ki_jit_bind(slow[0]);
+	m68ki_jit_bind(slow[1]);
+	m68ki_jit_bind(slow[2]);
+	m68ki_jit_store_state();
+	m68ki_jit_call_bus(bus_write, 1);
+	m68ki_jit_bind(done);
+}
+
+
+#endif /* host backends */
+
+#if M68KI_JIT_HOST
+
+/* ------------------------ Translated instructions ----------------------- */
+
+/* The instruction being translated, for the bus side of its accesses */
+static uint m68ki_jit_instr_pc;
+static uint m68ki_jit_instr_ir;
+static uint m68ki_jit_instr_next_pc;
+
+/* Before a bus access, give the CPU state the values the interpreter would
+ * have, for the memory handlers and for exceptions.
+ */
+static void m68ki_jit_store_state(void)
+{
+	m68ki_jit_store_cpu(M68KI_JIT_OFFSET(ppc), m68ki_jit_instr_pc);
+	m68ki_jit_store_cpu(M68KI_JIT_OFFSET(ir), m68ki_jit_instr_ir);
+	m68ki_jit_store_cpu(M68KI_JIT_OFFSET(pc), m68ki_jit_instr_next_pc);
+}
+
+/* Accesses of translated code outside host pages, or writes to pages with
+ * decoded code.  Registers are only written after the accesses of an
+ * instruction, so they can be saved here for a bus error to restore.
+ * The writes return the value, so it doesn't have to be kept elsewhere.
+ */
+static uint m68ki_jit_bus_read_8(uint address)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	return m68ki_read_8(address);
+}
+
+static uint m68ki_jit_bus_read_16(uint address)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	return m68ki_read_16(address);
+}
+
+static uint m68ki_jit_bus_read_32(uint address)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	return m68ki_read_32(address);
+}
+
+static uint m68ki_jit_bus_write_8(uint address, uint value)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	m68ki_write_8(address, value);
+	return value;
+}
+
+static uint m68ki_jit_bus_write_16(uint address, uint value)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	m68ki_write_16(address, value);
+	return value;
+}
+
+static uint m68ki_jit_bus_write_32(uint address, uint value)
+{
+	memcpy(REG_DA_SAVE, REG_DA, sizeof(REG_DA_SAVE));
+	m68ki_write_32(address, value);
+	return value;
+}
+
+/* Kinds of operands */
+#define M68KI_JIT_DREG 0
+#define M68KI_JIT_AREG 1
+#define M68KI_JIT_AIND 2   /* (An), (An)+, -(An) and (d16,An) */
+#define M68KI_JIT_ABS  3
+#define M68KI_JIT_IMM  4
+
+typedef struct
+{
+	uint kind;
+	uint offset;  /* Offset of the register in m68ki_cpu */
+	uint value;   /* Displacement, absolute address or immediate data */
+	uint adjust;  /* Postincrement or predecrement of the address register */
+} m68ki_jit_operand;
+
+/* What m68ki_jit_translate() made of an instruction */
+#define M68KI_JIT_HANDLER    0   /* Left to the opcode handler */
+#define M68KI_JIT_NATIVE     1   /* Translated, works on registers only */
+#define M68KI_JIT_NATIVE_MEM 2   /* Translated, may call out to the bus */
+
+/* Decode an effective address, taking extension words from ext.  Returns
+ * 0 for the modes that are left to the opcode handlers.
+ */
+static int m68ki_jit_decode(m68ki_jit_operand* op, uint mode, uint reg, uint size, const uint16** ext)
+{
+	uint step = (size == 1 && reg == 7) ? 2 : size;    /* A7 stays word aligned */
+
+	op->offset = M68KI_JIT_OFFSET(dar) + (mode ? 8 + reg : reg) * 4;
+	op->value = 0;
+	op->adjust = 0;
+	switch(mode)
+	{
+		case 0:
+			op->kind = M68KI_JIT_DREG;
+			return 1;
+		case 1:
+			op->kind = M68KI_JIT_AREG;
+			return size != 1;
+		case 2:
+			op->kind = M68KI_JIT_AIND;
+			return 1;
+		case 3:
+			op->kind = M68KI_JIT_AIND;
+			op->adjust = step;
+			return 1;
+		case 4:
+			op->kind = M68KI_JIT_AIND;
+			op->value = op->adjust = -step;
+			return 1;
+		case 5:
+			op->kind = M68KI_JIT_AIND;
+			op->value = MAKE_INT_16(*(*ext)++);
+			return 1;
+		case 7:
+			if(reg == 0)
+			{
+				op->kind = M68KI_JIT_ABS;
+				op->value = MAKE_INT_16(*(*ext)++);
+				return 1;
+			}
+			if(reg == 1 || (reg == 4 && size == 4))
+			{
+				op->kind = reg == 1 ? M68KI_JIT_ABS : M68KI_JIT_IMM;
+				op->value = ((*ext)[0] << 16) | (*ext)[1];
+				*ext += 2;
+				return 1;
+			}
+			if(reg == 4)
+			{
+				op->kind = M68KI_JIT_IMM;
+				op->value = size == 1 ? MASK_OUT_ABOVE_8(**ext) : **ext;
+				(*ext)++;
+				return 1;
+			}
+			return 0;
+	}
+	return 0;
+}
+
+static int m68ki_jit_in_memory(const m68ki_jit_operand* op)
+{
+	return op->kind == M68KI_JIT_AIND || op->kind == M68KI_JIT_ABS;
+}
+
+/* Address of a memory operand into the address register.  adjust is the
+ * change of the register by an earlier operand of the same instruction.
+ */
+static void m68ki_jit_address(const m68ki_jit_operand* op, uint adjust)
+{
+	if(op->kind == M68KI_JIT_ABS)
+		m68ki_jit_move_imm(M68KI_JIT_A, op->value);
+	else
+	{
+		m68ki_jit_load(M68KI_JIT_A, op->offset);
+		if(op->value + adjust)
+			m68ki_jit_add_imm(M68KI_JIT_A, op->value + adjust);
+	}
+}
+
+/* Operand into the value register, zero extended */
+static void m68ki_jit_read_operand(const m68ki_jit_operand* op, uint size)
+{
+	switch(op->kind)
+	{
+		case M68KI_JIT_DREG:
+		case M68KI_JIT_AREG:
+			m68ki_jit_load(M68KI_JIT_V, op->offset);
+			if(size < 4)
+				m68ki_jit_extend(size, 0);
+			break;
+		case M68KI_JIT_IMM:
+			m68ki_jit_move_imm(M68KI_JIT_V, op->value);
+			break;
+		default:
+			m68ki_jit_address(op, 0);
+			m68ki_jit_read(size, CPU_ADDRESS_MASK, (void (*)(void))(size == 1 ? m68ki_jit_bus_read_8 :
+						   size == 2 ? m68ki_jit_bus_read_16 : m68ki_jit_bus_read_32));
+			break;
+	}
+}
+
+static void m68ki_jit_write_operand(const m68ki_jit_operand* op, uint size, uint adjust)
+{
+	m68ki_jit_address(op, adjust);
+	m68ki_jit_write(size, CPU_ADDRESS_MASK, (void (*)(void))(size == 1 ? m68ki_jit_bus_write_8 :
+					size == 2 ? m68ki_jit_bus_write_16 : m68ki_jit_bus_write_32));
+}
+
+static void m68ki_jit_adjust(const m68ki_jit_operand* op)
+{
+	if(op->adjust)
+		m68ki_jit_add_cpu(op->offset, op->adjust);
+}
+
+/* N and Z from the value, V and C cleared */
+static void m68ki_jit_logic_flags(uint size)
+{
+	m68ki_jit_store(M68KI_JIT_OFFSET(not_z_flag), M68KI_JIT_V, 4);
+	if(size == 1)
+		m68ki_jit_store(M68KI_JIT_OFFSET(n_flag), M68KI_JIT_V, 4);
+	else
+		m68ki_jit_store_shifted(M68KI_JIT_OFFSET(n_flag), size * 8 - 8);
+	m68ki_jit_store_cpu(M68KI_JIT_OFFSET(v_flag), VFLAG_CLEAR);
+	m68ki_jit_store_cpu(M68KI_JIT_OFFSET(c_flag), CFLAG_CLEAR);
+#if M68K_LAZY_FLAGS
+	m68ki_jit_and_cpu(M68KI_JIT_OFFSET(lazy_pending), ~M68KI_LAZY_VC);
+#endif /* M68K_LAZY_FLAGS */
+}
+
+/* Translate the data movement and logic instructions that make up most of
+ * typical code into native code that works on m68ki_cpu and the host pages
+ * directly.  Registers are written after the memory accesses, so a bus
+ * error leaves them as the interpreter would.
+ */
+static uint m68ki_jit_translate(const m68ki_bc_block* block, uint index, uint pc)
+{
+	static const uint8 move_size[4] = { 0, 1, 4, 2 };
+	uint opcode = block->instr[index].opcode;
+	const uint16* ext = &block->words[(pc - block->pc) / 2 + 1];
+	m68ki_jit_operand src;
+	m68ki_jit_operand dst;
+	uint size;
+
+	/* Address errors need the opcode handlers */
+	if(M68K_EMULATE_ADDRESS_ERROR)
+		return M68KI_JIT_HANDLER;
+
+	m68ki_jit_instr_pc = pc;
+	m68ki_jit_instr_ir = opcode;
+	m68ki_jit_instr_next_pc = block->pc + block->instr[index].next_offset;
+
+	/* moveq */
+	if((opcode & 0xf100) == 0x7000)
+	{
+		m68ki_jit_move_imm(M68KI_JIT_V, MAKE_INT_8(opcode));
+		m68ki_jit_store(M68KI_JIT_OFFSET(dar) + ((opcode >> 9) & 7) * 4, M68KI_JIT_V, 4);
+		m68ki_jit_logic_flags(4);
+		return M68KI_JIT_NATIVE;
+	}
+
+	/* addq and subq to an address register, word or long */
+	if((opcode & 0xf038) == 0x5008 && ((opcode >> 6) & 3) != 0 && ((opcode >> 6) & 3) != 3)
+	{
+		uint data = (((opcode >> 9) - 1) & 7) + 1;
+
+		m68ki_jit_add_cpu(M68KI_JIT_OFFSET(dar) + (8 + (opcode & 7)) * 4, (opcode & 0x0100) ? -data : data);
+		return M68KI_JIT_NATIVE;
+	}
+
+	/* lea */
+	if((opcode & 0xf1c0) == 0x41c0)
+	{
+		if(!m68ki_jit_decode(&src, (opcode >> 3) & 7, opcode & 7, 4, &ext) || !m68ki_jit_in_memory(&src) || src.adjust)
+			return M68KI_JIT_HANDLER;
+		m68ki_jit_address(&src, 0);
+		m68ki_jit_store(M68KI_JIT_OFFSET(dar) + (8 + ((opcode >> 9) & 7)) * 4, M68KI_JIT_A, 4);
+		return M68KI_JIT_NATIVE;
+	}
+
+	/* move and movea */
+	size = move_size[(opcode >> 12) & 3];
+	if((opcode & 0xc000) == 0 && size)
+	{
+		if(!m68ki_jit_decode(&src, (opcode >> 3) & 7, opcode & 7, size, &ext) ||
+		   !m68ki_jit_decode(&dst, (opcode >> 6) & 7, (opcode >> 9) & 7, size, &ext) || dst.kind == M68KI_JIT_IMM)
+			return M68KI_JIT_HANDLER;
+
+		m68ki_jit_read_operand(&src, size);
+		if(m68ki_jit_in_memory(&dst))
+		{
+			/* move.l (a0)+,(a0)+ writes to a0 + 4 */
+			m68ki_jit_write_operand(&dst, size, src.kind == M68KI_JIT_AIND && dst.kind == M68KI_JIT_AIND &&
+									src.offset == dst.offset ? src.adjust : 0);
+			m68ki_jit_adjust(&src);
+			m68ki_jit_adjust(&dst);
+		}
+		else
+		{
+			m68ki_jit_adjust(&src);
+			if(dst.kind == M68KI_JIT_AREG)
+			{
+				if(size == 2)
+					m68ki_jit_extend(2, 1);
+				m68ki_jit_store(dst.offset, M68KI_JIT_V, 4);
+				return m68ki_jit_in_memory(&src) ? M68KI_JIT_NATIVE_MEM : M68KI_JIT_NATIVE;
+			}
+			m68ki_jit_store(dst.offset, M68KI_JIT_V, size);
+		}
+		m68ki_jit_logic_flags(size);
+		return m68ki_jit_in_memory(&src) || m68ki_jit_in_memory(&dst) ? M68KI_JIT_NATIVE_MEM : M68KI_JIT_NATIVE;
+	}
+
+	/* and and or <ea>,Dn, eor Dn,Dn */
+	size = 1 << ((opcode >> 6) & 3);
+	if(size <= 4 && ((opcode & 0xb100) == 0x8000 || (opcode & 0xf138) == 0xb100))
+	{
+		uint op;
+
+		if((opcode & 0xf000) == 0xb000)
+		{
+			op = M68KI_JIT_EOR;
+			m68ki_jit_decode(&src, 0, (opcode >> 9) & 7, size, &ext);
+			m68ki_jit_decode(&dst, 0, opcode & 7, size, &ext);
+		}
+		else
+		{
+			op = (opcode & 0x4000) ? M68KI_JIT_AND : M68KI_JIT_OR;
+			if(!m68ki_jit_decode(&src, (opcode >> 3) & 7, opcode & 7, size, &ext) || src.kind == M68KI_JIT_AREG)
+				return M68KI_JIT_HANDLER;
+			m68ki_jit_decode(&dst, 0, (opcode >> 9) & 7, size, &ext);
+		}
+
+		m68ki_jit_read_operand(&src, size);
+		m68ki_jit_load(M68KI_JIT_A, dst.offset);
+		m68ki_jit_alu(op);
+		if(op != M68KI_JIT_AND && size < 4)
+			m68ki_jit_extend(size, 0);
+		m68ki_jit_adjust(&src);
+		m68ki_jit_store(dst.offset, M68KI_JIT_V, size);
+		m68ki_jit_logic_flags(size);
+		return m68ki_jit_in_memory(&src) ? M68KI_JIT_NATIVE_MEM : M68KI_JIT_NATIVE;
+	}
+
+	return M68KI_JIT_HANDLER;
+}
+
+#endif /* M68KI_JIT_HOST */
+
+/* Drop all translations.  This can happen while translated code is running,
+ * e.g. when an autoconf write from an opcode handler rebuilds the memory map.
+ * The code itself stays in place until m68ki_jit_compile() reuses the
+ * buffer, which is only done between blocks, and the running block stops
+ * after the current instruction because the block cache epoch changed.
+ */
+static void m68ki_jit_reset(void)
+{
+	m68ki_jit_code_used = 0;
+}
+
+/* Changes the protection of the pages holding start..end of the code buffer.
+ * The buffer is never writable and executable at the same time: it is made
+ * writable for m68ki_jit_compile() and executable again when it is done.
+ */
+static int m68ki_jit_protect(unsigned char* start, unsigned char* end, int prot)
+{
+	uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)start & ~(page_size - 1);
+	uintptr_t last = ((uintptr_t)end + page_size - 1) & ~(page_size - 1);
+
+	return mprotect((void*)first, last - first, prot);
+}
+
+static void m68ki_jit_set_perf_map(int enable)
+{
+#if M68KI_JIT_HOST
+	char perf_map_name[64];
+
+	if(m68ki_jit_perf_map)
+	{
+		fclose(m68ki_jit_perf_map);
+		m68ki_jit_perf_map = NULL;
+	}
+	if(!enable)
+		return;
+	/* Lets perf attribute samples to translated blocks */
+	sprintf(perf_map_name, "/tmp/perf-%d.map", (int)getpid());
+	m68ki_jit_perf_map = fopen(perf_map_name, "w");
+	if(!m68ki_jit_perf_map)
+		printf("Failed to open %s for the JIT perf map.\n", perf_map_name);
+#else
+	(void)enable;
+#endif /* M68KI_JIT_HOST */
+}
+
+static void m68ki_jit_set_enabled(int enable)
+{
+#if M68KI_JIT_HOST
+	if(enable && !m68ki_jit_code)
+	{
+		m68ki_jit_code = mmap(NULL, M68KI_JIT_CODE_SIZE, PROT_READ | PROT_EXEC,
+							  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(m68ki_jit_code == MAP_FAILED)
+		{
+			printf("Failed to allocate memory for the JIT, running interpreted.\n");
+			m68ki_jit_code = NULL;
+			return;
+		}
+	}
+	m68ki_jit_enabled = enable;
+#else
+	(void)enable;
+#endif /* M68KI_JIT_HOST */
+	m68ki_jit_reset();
+}
+
+/* Translate a block.  Returns 0 if the code buffer is full. */
+static int m68ki_jit_compile(m68ki_bc_block* block)
+{
+#if M68KI_JIT_HOST
+	unsigned char* start = m68ki_jit_code + m68ki_jit_code_used;
+	unsigned char* limit = start + M68KI_JIT_MAX_INSTR_SIZE * (block->num_instrs + 1);
+	uint i;
+
+	if(limit > m68ki_jit_code + M68KI_JIT_CODE_SIZE)
+		return 0;
+	if(m68ki_jit_protect(start, limit, PROT_READ | PROT_WRITE))
+	{
+		printf("Failed to make the JIT code buffer writable, running interpreted.\n");
+		m68ki_jit_enabled = 0;
+		return 1;
+	}
+
+	m68ki_jit_ptr = start;
+	m68ki_jit_num_exits = 0;
+	m68ki_jit_prologue();
+
+	for(i = 0; i < block->num_instrs; i++)
+	{
+		const m68ki_bc_instr* instr = &block->instr[i];
+		uint pc = block->pc + (i ? block->instr[i - 1].next_offset : 0);
+		uint kind = m68ki_jit_translate(block, i, pc);
+
+		if(kind == M68KI_JIT_HANDLER)
+		{
+			m68ki_jit_store_cpu(M68KI_JIT_OFFSET(ppc), pc);
+			m68ki_jit_save_registers();
+			m68ki_jit_store_cpu(M68KI_JIT_OFFSET(ir), instr->opcode);
+			m68ki_jit_store_cpu(M68KI_JIT_OFFSET(pc), pc + 2);
+			m68ki_jit_call(instr->handler, &block->words[(pc - block->pc) / 2 + 1]);
+		}
+		else
+			m68ki_jit_store_cpu(M68KI_JIT_OFFSET(pc), block->pc + instr->next_offset);
+		m68ki_jit_use_cycles(instr->cycles);
+
+		/* Same exit conditions as m68ki_bc_execute().  Translated
+		 * instructions don't branch, and only their bus accesses can
+		 * stop the CPU or change the memory map or code.
+		 */
+		if(i == block->num_instrs - 1)
+			break;
+		if(kind == M68KI_JIT_HANDLER)
+			m68ki_jit_check_cpu(M68KI_JIT_OFFSET(pc), block->pc + instr->next_offset);
+		m68ki_jit_check_cycles();
+		if(kind == M68KI_JIT_NATIVE)
+			continue;
+		m68ki_jit_check_cpu(M68KI_JIT_OFFSET(stopped), 0);
+		/* Against the block's own copy, which is refreshed when the block
+		 * survives a write to its pages.
+		 */
+		m68ki_jit_check_gen(block->page_first, &block->gen_first);
+		if(block->page_last != block->page_first)
+			m68ki_jit_check_gen(block->page_last, &block->gen_last);
+		m68ki_jit_check32(&m68ki_bc_epoch, block->epoch);
+	}
+
+	m68ki_jit_patch_exits(m68ki_jit_ptr);
+	m68ki_jit_epilogue();
+
+	/* Back to executable, the other blocks on these pages may run again */
+	if(m68ki_jit_protect(start, limit, PROT_READ | PROT_EXEC))
+	{
+		printf("Failed to make the JIT code buffer executable, running interpreted.\n");
+		m68ki_jit_enabled = 0;
+		return 0;
+	}
+	__builtin___clear_cache((char*)start, (char*)m68ki_jit_ptr);
+	m68ki_jit_code_used = m68ki_jit_ptr - m68ki_jit_code;
+	/* ISO C has no object to function pointer conversion */
+	memcpy(&block->native, &start, sizeof(block->native));
+
+	if(m68ki_jit_perf_map)
+	{
+		fprintf(m68ki_jit_perf_map, "%lx %x m68k_%08x\n", (unsigned long)(uintptr_t)start,
+				(uint)(m68ki_jit_ptr - start), block->pc);
+		/* perf reads it while the emulator runs, and may be stopped with it */
+		fflush(m68ki_jit_perf_map);
+	}
+	return 1;
+#else
+	(void)block;
+	return 1;
+#endif /* M68KI_JIT_HOST */
+}
+
+#endif /* M68K_JIT */
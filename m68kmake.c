@@ -40,10 +40,12 @@
  * It requires an input file to function (default m68k_in.c), but you can
  * specify your own like so:
  *
- * m68kmake <output path> <input file>
+ * m68kmake <output path> <input file> [<pair profile> [<number of pairs>]]
  *
  * where output path is the path where the output files should be placed, and
- * input file is the file to use for input.
+ * input file is the file to use for input.  A pair profile written by
+ * m68k_write_pair_profile() makes the threaded dispatcher fuse the most
+ * frequent opcode handler pairs in it, 32 unless a number is given.
  *
  * If you modify the input file greatly from its released form, you may have
  * to tweak the configuration section a bit since I'm using static allocation
@@ -88,6 +90,8 @@ static const char g_version[] = "4.60";
 #define EA_ALLOWED_LENGTH                11	/* Max length of ea allowed str */
 #define MAX_OPCODE_INPUT_TABLE_LENGTH  1000	/* Max length of opcode handler tbl */
 #define MAX_OPCODE_OUTPUT_TABLE_LENGTH 3000	/* Max length of opcode handler tbl */
+#define MAX_FUSED_PAIRS                 256	/* Max number of fused opcode pairs */
+#define DEFAULT_FUSED_PAIRS              32	/* Fused opcode pairs if not given */
 
 /* Default filenames */
 #define FILENAME_INPUT      "m68k_in.c"
@@ -188,6 +192,7 @@ typedef struct
 	char cpu_mode[NUM_CPUS];              /* User or supervisor mode */
 	char cpus[NUM_CPUS+1];                /* Allowed CPUs */
 	unsigned char cycles[NUM_CPUS];       /* cycles for 000, 010, 020, 030, 040 */
+	unsigned char family_variants;        /* One handler per CPU family */
 } opcode_struct;
 
 
@@ -232,11 +237,18 @@ opcode_struct* find_illegal_opcode(void);
 int extract_opcode_info(char* src, char* name, int* size, char* spec_proc, char* spec_ea);
 void add_replace_string(replace_struct* replace, char* search_str, char* replace_str);
 void write_body(FILE* filep, body_struct* body, replace_struct* replace);
+int depends_on_cpu_type(body_struct* body, int ea_mode);
 void get_base_name(char* base_name, opcode_struct* op);
 void write_function_name(FILE* filep, char* base_name);
 void add_opcode_output_table_entry(opcode_struct* op, char* name);
 static int DECL_SPEC compare_nof_true_bits(const void* aptr, const void* bptr);
+void sort_opcode_output_table(void);
 void print_opcode_output_table(FILE* filep);
+void write_threaded_dispatch(FILE* filep);
+void print_opcode_name_table(FILE* filep);
+int find_table_row(const char* name);
+void read_pair_profile(void);
+void write_threaded_handler(FILE* filep, int row, int family);
 void write_table_entry(FILE* filep, opcode_struct* op);
 void set_opcode_struct(opcode_struct* src, opcode_struct* dst, int ea_mode);
 void generate_opcode_handler(FILE* filep, body_struct* body, replace_struct* replace, opcode_struct* opinfo, int ea_mode);
@@ -270,6 +282,22 @@ opcode_struct g_opcode_input_table[MAX_OPCODE_INPUT_TABLE_LENGTH];
 opcode_struct g_opcode_output_table[MAX_OPCODE_OUTPUT_TABLE_LENGTH];
 int g_opcode_output_table_length = 0;
 
+/* Opcode handler pairs to fuse in the threaded dispatcher, as rows of the
+ * sorted output table, most frequent first.  Read from a pair profile
+ * written by m68k_write_pair_profile().
+ */
+typedef struct
+{
+	int first;
+	int second;
+	unsigned long long count;
+} fused_pair_struct;
+
+char g_pair_profile_filename[M68K_MAX_PATH] = "";
+int g_max_fused_pairs = DEFAULT_FUSED_PAIRS;
+fused_pair_struct g_fused_pairs[MAX_FUSED_PAIRS];
+int g_num_fused_pairs = 0;
+
 const ea_info_struct g_ea_info_table[13] =
 {/* fname    ea        mask  match */
 	{"",     "",       0x00, 0x00}, /* EA_MODE_NONE */
@@ -288,6 +316,14 @@ const ea_info_struct g_ea_info_table[13] =
 };
 
 
+/* Opcode handlers that depend on the CPU type are written once for each CPU
+ * family, with CPU_TYPE narrowed to the family's CPU_TYPES_FAMILY_xxx mask
+ * from m68kcpu.h.  The suffix of each copy is the family's name.
+ */
+#define NUM_CPU_FAMILIES 3
+const char *const g_cpu_family_table[NUM_CPU_FAMILIES] = {"000", "020", "040"};
+
+
 const char *const g_cc_table[16][2] =
 {
 	{ "t",  "T"}, /* 0000 */
@@ -770,6 +806,24 @@ void write_body(FILE* filep, body_struct* body, replace_struct* replace)
 	fprintf(filep, "\n\n");
 }
 
+/* Check if an opcode handler behaves differently by CPU type, either in its
+ * own body or in the indexed addressing modes (brief format scale and the
+ * 68020 full extension format).
+ */
+int depends_on_cpu_type(body_struct* body, int ea_mode)
+{
+	int i;
+
+	if(ea_mode == EA_MODE_IX || ea_mode == EA_MODE_PCIX)
+		return 1;
+	for(i=0;i<body->length;i++)
+	{
+		if(strstr(body->body[i], "CPU_TYPE") || strstr(body->body[i], "_IX_") || strstr(body->body[i], "PCIX_"))
+			return 1;
+	}
+	return 0;
+}
+
 /* Generate a base function name from an opcode struct */
 void get_base_name(char* base_name, opcode_struct* op)
 {
@@ -785,7 +839,7 @@ void get_base_name(char* base_name, opcode_struct* op)
 /* Write the name of an opcode handler function */
 void write_function_name(FILE* filep, char* base_name)
 {
-	fprintf(filep, "static void %s(void)\n", base_name);
+	fprintf(filep, "static M68KI_HANDLER_INLINE void %s(void)\n", base_name);
 }
 
 void add_opcode_output_table_entry(opcode_struct* op, char* name)
@@ -816,22 +870,227 @@ static int DECL_SPEC compare_nof_true_bits(const void* aptr, const void* bptr)
 	return a->op_match - b->op_match;
 }
 
+void sort_opcode_output_table(void)
+{
+	qsort((void *)g_opcode_output_table, g_opcode_output_table_length, sizeof(g_opcode_output_table[0]), compare_nof_true_bits);
+}
+
 void print_opcode_output_table(FILE* filep)
 {
 	int i;
-	qsort((void *)g_opcode_output_table, g_opcode_output_table_length, sizeof(g_opcode_output_table[0]), compare_nof_true_bits);
 
 	for(i=0;i<g_opcode_output_table_length;i++)
 		write_table_entry(filep, g_opcode_output_table+i);
 }
 
+/* Find the row of the named opcode handler in the sorted output table */
+int find_table_row(const char* name)
+{
+	int i;
+
+	for(i=0;i<g_opcode_output_table_length;i++)
+		if(strcmp(g_opcode_output_table[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+/* Read the pair profile given on the command line and keep its most frequent
+ * pairs for fusing.  Each line holds a count and the names of two handlers.
+ * A pair listed more than once, as in profiles of several runs put together,
+ * is counted once with the sum of its counts.
+ */
+void read_pair_profile(void)
+{
+	FILE* filep;
+	char line[MAX_LINE_LENGTH+1];
+	char first[MAX_LINE_LENGTH+1];
+	char second[MAX_LINE_LENGTH+1];
+	fused_pair_struct pair;
+	fused_pair_struct* pairs = NULL;
+	int num_pairs = 0;
+	int max_pairs = 0;
+	int i;
+	int j;
+
+	if(g_pair_profile_filename[0] == 0)
+		return;
+	if((filep = fopen(g_pair_profile_filename, "rt")) == NULL)
+		perror_exit("Unable to open pair profile (%s)\n", g_pair_profile_filename);
+
+	while(fgets(line, sizeof(line), filep) != NULL)
+	{
+		if(line[0] == '#' || sscanf(line, "%llu %s %s", &pair.count, first, second) != 3)
+			continue;
+		if(strcmp(first, "no_handler") == 0 || strcmp(second, "no_handler") == 0)
+			continue;
+		pair.first = find_table_row(first);
+		pair.second = find_table_row(second);
+		if(pair.first < 0 || pair.second < 0)
+		{
+			printf("Skipping pair %s %s, no such opcode handler\n", first, second);
+			continue;
+		}
+		/* The first handler's label decides which copy of the second is used */
+		if(g_opcode_output_table[pair.second].family_variants && !g_opcode_output_table[pair.first].family_variants)
+			continue;
+
+		for(i=0;i<num_pairs;i++)
+			if(pairs[i].first == pair.first && pairs[i].second == pair.second)
+				break;
+		if(i < num_pairs)
+		{
+			pairs[i].count += pair.count;
+			continue;
+		}
+		if(num_pairs == max_pairs)
+		{
+			max_pairs = max_pairs ? max_pairs * 2 : 256;
+			if((pairs = realloc(pairs, max_pairs * sizeof(fused_pair_struct))) == NULL)
+				error_exit("Out of memory reading the pair profile");
+		}
+		pairs[num_pairs++] = pair;
+	}
+	fclose(filep);
+
+	for(j=0;j<num_pairs;j++)
+	{
+		pair = pairs[j];
+		for(i=g_num_fused_pairs;i>0 && g_fused_pairs[i-1].count < pair.count;i--)
+			if(i < g_max_fused_pairs)
+				g_fused_pairs[i] = g_fused_pairs[i-1];
+		if(i < g_max_fused_pairs)
+		{
+			g_fused_pairs[i] = pair;
+			if(g_num_fused_pairs < g_max_fused_pairs)
+				g_num_fused_pairs++;
+		}
+	}
+	free(pairs);
+
+	printf("Fusing %d opcode pairs from %s\n", g_num_fused_pairs, g_pair_profile_filename);
+}
+
+/* Write the threaded code of a table row, for one CPU family or for all of
+ * them if family is -1.  When the row starts fused pairs, the handlers of
+ * the second opcodes are inlined after it, and the next opcode's row is
+ * compared against theirs before taking the indirect jump.
+ */
+void write_threaded_handler(FILE* filep, int row, int family)
+{
+	opcode_struct* op = g_opcode_output_table + row;
+	opcode_struct* next;
+	char suffix[MAX_NAME_LENGTH] = "";
+	int fused = 0;
+	int i;
+
+	if(family >= 0)
+		sprintf(suffix, "_%s", g_cpu_family_table[family]);
+	fprintf(filep, "l_%s%s:\n", op->name, suffix);
+	fprintf(filep, "\t%s%s();\n", op->name, suffix);
+	for(i=0;i<g_num_fused_pairs;i++)
+	{
+		if(g_fused_pairs[i].first != row)
+			continue;
+		if(!fused)
+		{
+			fprintf(filep, "\tM68KI_THREADED_END(%d);\n", row);
+			fprintf(filep, "\tM68KI_THREADED_FETCH();\n");
+			fused = 1;
+		}
+		next = g_opcode_output_table + g_fused_pairs[i].second;
+		fprintf(filep, "\tif(m68ki_instruction_index[REG_IR] == %d)\n\t{\n", g_fused_pairs[i].second);
+		fprintf(filep, "\t\t%s%s();\n", next->name, next->family_variants ? suffix : "");
+		fprintf(filep, "\t\tM68KI_THREADED_NEXT(%d);\n\t}\n", g_fused_pairs[i].second);
+	}
+	if(fused)
+		fprintf(filep, "\tgoto *handler_labels[m68ki_instruction_index[REG_IR]];\n");
+	else
+		fprintf(filep, "\tM68KI_THREADED_NEXT(%d);\n", row);
+}
+
+/* Write m68ki_execute_threaded(), which inlines every opcode handler and
+ * jumps from the end of one straight to the handler of the next opcode.
+ * Each CPU family has a label list in the order of the sorted opcode handler
+ * table, so m68ki_instruction_index[] gives an opcode's label as well.  The
+ * lists only differ for the handlers with a copy per family.  The last label
+ * is for the terminating table row, the opcodes no handler matches.
+ */
+void write_threaded_dispatch(FILE* filep)
+{
+	opcode_struct* op;
+	int i;
+	int j;
+
+	fprintf(filep, "#if M68K_THREADED_DISPATCH\n\n");
+	fprintf(filep, "#pragma GCC diagnostic push\n");
+	fprintf(filep, "#pragma GCC diagnostic ignored \"-Wpedantic\"\n\n");
+	fprintf(filep, "void m68ki_execute_threaded(void)\n{\n");
+	fprintf(filep, "\tstatic const void* const family_handler_labels[NUM_CPU_FAMILIES][%d] =\n\t{\n", g_opcode_output_table_length + 1);
+	for(j=0;j<NUM_CPU_FAMILIES;j++)
+	{
+		fprintf(filep, "\t\t{\n");
+		for(i=0;i<g_opcode_output_table_length;i++)
+		{
+			op = g_opcode_output_table + i;
+			if(op->family_variants)
+				fprintf(filep, "\t\t\t&&l_%s_%s,\n", op->name, g_cpu_family_table[j]);
+			else
+				fprintf(filep, "\t\t\t&&l_%s,\n", op->name);
+		}
+		fprintf(filep, "\t\t\t&&l_no_handler,\n");
+		fprintf(filep, "\t\t},\n");
+	}
+	fprintf(filep, "\t};\n");
+	fprintf(filep, "\tconst void* const* handler_labels = family_handler_labels[CPU_FAMILY];\n\n");
+	fprintf(filep, "\tM68KI_THREADED_DISPATCH();\n\n");
+	for(i=0;i<g_opcode_output_table_length;i++)
+	{
+		if(!g_opcode_output_table[i].family_variants)
+		{
+			write_threaded_handler(filep, i, -1);
+			continue;
+		}
+		for(j=0;j<NUM_CPU_FAMILIES;j++)
+			write_threaded_handler(filep, i, j);
+	}
+	fprintf(filep, "l_no_handler:\n");
+	fprintf(filep, "\tm68k_op_illegal();\n");
+	fprintf(filep, "\tM68KI_THREADED_NEXT(%d);\n", i);
+	fprintf(filep, "}\n\n");
+	fprintf(filep, "#pragma GCC diagnostic pop\n\n");
+	fprintf(filep, "#endif /* M68K_THREADED_DISPATCH */\n\n\n");
+}
+
+/* Write the handler name of each table row, for the opcode pair profile */
+void print_opcode_name_table(FILE* filep)
+{
+	int i;
+
+	fprintf(filep, "#if M68K_PAIR_PROFILE\n\n");
+	fprintf(filep, "const char* const m68ki_instruction_names[] =\n{\n");
+	for(i=0;i<g_opcode_output_table_length;i++)
+		fprintf(filep, "\t\"%s\",\n", g_opcode_output_table[i].name);
+	fprintf(filep, "\t\"no_handler\",\n");
+	fprintf(filep, "};\n\n");
+	fprintf(filep, "#endif /* M68K_PAIR_PROFILE */\n\n\n");
+}
+
 /* Write an entry in the opcode handler table */
 void write_table_entry(FILE* filep, opcode_struct* op)
 {
+	char str[MAX_LINE_LENGTH+1];
 	int i;
 
-	fprintf(filep, "\t{%-28s, 0x%04x, 0x%04x, {",
-		op->name, op->op_mask, op->op_match);
+	fprintf(filep, "\t{{");
+	for(i=0;i<NUM_CPU_FAMILIES;i++)
+	{
+		if(op->family_variants)
+			sprintf(str, "%s_%s", op->name, g_cpu_family_table[i]);
+		else
+			strcpy(str, op->name);
+		fprintf(filep, "%s%s", str, i < NUM_CPU_FAMILIES-1 ? ", " : "}");
+	}
+	fprintf(filep, ", 0x%04x, 0x%04x, {", op->op_mask, op->op_match);
 
 	for(i=0;i<NUM_CPUS;i++)
 	{
@@ -863,13 +1122,15 @@ void set_opcode_struct(opcode_struct* src, opcode_struct* dst, int ea_mode)
 void generate_opcode_handler(FILE* filep, body_struct* body, replace_struct* replace, opcode_struct* opinfo, int ea_mode)
 {
 	char str[MAX_LINE_LENGTH+1];
+	char base_name[MAX_LINE_LENGTH+1];
 	opcode_struct* op = malloc(sizeof(opcode_struct));
+	int i;
 
 	/* Set the opcode structure and write the tables, prototypes, etc */
 	set_opcode_struct(opinfo, op, ea_mode);
-	get_base_name(str, op);
-	add_opcode_output_table_entry(op, str);
-	write_function_name(filep, str);
+	op->family_variants = depends_on_cpu_type(body, ea_mode);
+	get_base_name(base_name, op);
+	add_opcode_output_table_entry(op, base_name);
 
 	/* Add any replace strings needed */
 	if(ea_mode != EA_MODE_NONE)
@@ -889,7 +1150,22 @@ void generate_opcode_handler(FILE* filep, body_struct* body, replace_struct* rep
 	}
 
 	/* Now write the function body with the selected replace strings */
-	write_body(filep, body, replace);
+	if(!op->family_variants)
+	{
+		write_function_name(filep, base_name);
+		write_body(filep, body, replace);
+	}
+	else
+	{
+		for(i=0;i<NUM_CPU_FAMILIES;i++)
+		{
+			fprintf(filep, "#undef CPU_TYPE\n#define CPU_TYPE M68KI_CPU_TYPE_FAMILY(%s)\n", g_cpu_family_table[i]);
+			sprintf(str, "%s_%s", base_name, g_cpu_family_table[i]);
+			write_function_name(filep, str);
+			write_body(filep, body, replace);
+		}
+		fprintf(filep, "#undef CPU_TYPE\n#define CPU_TYPE M68KI_CPU_TYPE_ANY\n\n\n");
+	}
 	g_num_functions++;
 	free(op);
 }
@@ -1252,6 +1528,14 @@ int main(int argc, char **argv)
 			strcat(output_path, "/");
 		if(argc > 2)
 			strcpy(g_input_filename, argv[2]);
+		if(argc > 3)
+			strcpy(g_pair_profile_filename, argv[3]);
+		if(argc > 4)
+		{
+			g_max_fused_pairs = atoi(argv[4]);
+			if(g_max_fused_pairs < 0 || g_max_fused_pairs > MAX_FUSED_PAIRS)
+				error_exit("Number of fused pairs must be 0 to %d", MAX_FUSED_PAIRS);
+		}
 	}
 
 
@@ -1353,7 +1637,6 @@ int main(int argc, char **argv)
 
 			fprintf(g_table_file, "%s\n\n", ophandler_header_insert);
 			process_opcode_handlers(g_table_file);
-			fprintf(g_table_file, "%s\n\n", ophandler_footer_insert);
 
 			ophandler_body_read = 1;
 		}
@@ -1377,6 +1660,13 @@ int main(int argc, char **argv)
 			if(!ophandler_body_read)
 				error_exit("Missing opcode handler body");
 
+			/* The threaded dispatcher goes after the handlers it inlines */
+			sort_opcode_output_table();
+			read_pair_profile();
+			write_threaded_dispatch(g_table_file);
+			print_opcode_name_table(g_table_file);
+			fprintf(g_table_file, "%s\n\n", ophandler_footer_insert);
+
 			fprintf(g_table_file, "%s\n\n", table_header_insert);
 			print_opcode_output_table(g_table_file);
 			fprintf(g_table_file, "%s\n\n", table_footer_insert);
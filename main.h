@@ -9,7 +9,6 @@
 
 #include <stdint.h>
 
-void setup_io();
 void restore_io();
 int set_pio_timing(int p);
 /*
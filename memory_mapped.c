@@ -1,7 +1,13 @@
 #include "config_file/config_file.h"
 #include "m68k.h"
 #include "Gayle.h"
+#include "bus/bus.h"
 #include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define CHKRANGE(a, b, c) a >= (unsigned int)b && a < (unsigned int)(b + c)
 
@@ -15,7 +21,7 @@ const char *op_type_names[OP_TYPE_NUM] = {
   "MEM",
 };
 
-int handle_mapped_read(struct emulator_config *cfg, unsigned int addr, unsigned int *val, unsigned char type, unsigned char mirror) {
+static int handle_mapped_read_scan(struct emulator_config *cfg, unsigned int addr, unsigned int *val, unsigned char type, unsigned char mirror) {
   unsigned char *read_addr = NULL;
   char handle_regs = 0;
 
@@ -82,7 +88,7 @@ int handle_mapped_read(struct emulator_config *cfg, unsigned int addr, unsigned
   return -1;
 }
 
-int handle_mapped_write(struct emulator_config *cfg, unsigned int addr, unsigned int value, unsigned char type, unsigned char mirror) {
+static int handle_mapped_write_scan(struct emulator_config *cfg, unsigned int addr, unsigned int value, unsigned char type, unsigned char mirror) {
   unsigned char *write_addr = NULL;
   char handle_regs = 0;
 
@@ -143,3 +149,503 @@ int handle_mapped_write(struct emulator_config *cfg, unsigned int addr, unsigned
 
   return -1;
 }
+
+static void set_page_range(struct emulator_config *cfg, uint64_t start, uint64_t end, unsigned char type, unsigned char *data, unsigned int wrap) {
+  for (uint64_t page = start >> MAP_PAGE_SHIFT; page <= (end - 1) >> MAP_PAGE_SHIFT && page < MAP_NUM_PAGES; page++) {
+    uint64_t page_base = page << MAP_PAGE_SHIFT;
+
+    // Pages only partially covered by an item still need the full range checks.
+    if (page_base < start || page_base + MAP_PAGE_SIZE > end || type == PAGETYPE_SCAN) {
+      cfg->page_type[page] = PAGETYPE_SCAN;
+      cfg->page_data[page] = NULL;
+      continue;
+    }
+
+    cfg->page_type[page] = type;
+    if (data)
+      cfg->page_data[page] = data + ((wrap) ? (page_base - start) % wrap : page_base - start);
+    else
+      cfg->page_data[page] = NULL;
+  }
+}
+
+void build_page_table(struct emulator_config *cfg) {
+  if (!cfg->page_type) {
+    cfg->page_type = (unsigned char *)calloc(MAP_NUM_PAGES, sizeof(unsigned char));
+    cfg->page_data = (unsigned char **)calloc(MAP_NUM_PAGES, sizeof(unsigned char *));
+    if (!cfg->page_type || !cfg->page_data) {
+      printf("Failed to allocate memory for the mapped page table, falling back to range checks.\n");
+      free(cfg->page_type);
+      free(cfg->page_data);
+      cfg->page_type = NULL;
+      cfg->page_data = NULL;
+      return;
+    }
+  }
+
+  memset(cfg->page_type, PAGETYPE_PASSTHROUGH, MAP_NUM_PAGES * sizeof(unsigned char));
+  memset(cfg->page_data, 0x00, MAP_NUM_PAGES * sizeof(unsigned char *));
+
+  // Walk the items backwards, so that the lowest numbered item covering a page
+  // wins, the same way the first match wins in the range check scan.
+  for (int i = MAX_NUM_MAPPED_ITEMS - 1; i >= 0; i--) {
+    if (cfg->map_type[i] == MAPTYPE_NONE || cfg->map_size[i] == 0)
+      continue;
+
+    uint64_t start = (uint32_t)cfg->map_offset[i];
+    uint64_t end = start + cfg->map_size[i];
+
+    switch(cfg->map_type[i]) {
+      case MAPTYPE_ROM:
+        // The OVL mirror depends on the current overlay state, let the scan deal with it.
+        if (cfg->map_mirror[i] != -1)
+          set_page_range(cfg, (uint32_t)cfg->map_mirror[i], (uint32_t)cfg->map_mirror[i] + (uint64_t)cfg->map_size[i], PAGETYPE_SCAN, NULL, 0);
+        if (cfg->rom_size[i] == 0 || cfg->rom_size[i] % MAP_PAGE_SIZE != 0)
+          set_page_range(cfg, start, end, PAGETYPE_SCAN, NULL, 0);
+        else
+          set_page_range(cfg, start, end, PAGETYPE_ROM, cfg->map_data[i], cfg->rom_size[i]);
+        break;
+      case MAPTYPE_RAM:
+        set_page_range(cfg, start, end, PAGETYPE_RAM, cfg->map_data[i], 0);
+        break;
+      case MAPTYPE_REGISTER:
+        set_page_range(cfg, start, end, PAGETYPE_REGISTER, NULL, 0);
+        break;
+      case MAPTYPE_SHADOW:
+        set_page_range(cfg, start, end, PAGETYPE_SHADOW_FILL, cfg->map_data[i], 0);
+        for (uint64_t page = start >> MAP_PAGE_SHIFT; page <= (end - 1) >> MAP_PAGE_SHIFT; page++) {
+          if (cfg->page_type[page] == PAGETYPE_SHADOW_FILL && cfg->map_shadow_valid[i][page - (start >> MAP_PAGE_SHIFT)])
+            cfg->page_type[page] = PAGETYPE_SHADOW;
+        }
+        break;
+      default:
+        set_page_range(cfg, start, end, PAGETYPE_SCAN, NULL, 0);
+        break;
+    }
+  }
+
+  // Platform hooks go before everything else, so these pages must not be reached directly.
+  for (int i = 0; i < MAX_NUM_CUSTOM_RANGES; i++) {
+    if (cfg->custom_range_size[i] == 0)
+      continue;
+    uint64_t end = (uint64_t)cfg->custom_range_addr[i] + cfg->custom_range_size[i];
+    for (uint64_t page = cfg->custom_range_addr[i] >> MAP_PAGE_SHIFT; page <= (end - 1) >> MAP_PAGE_SHIFT && page < MAP_NUM_PAGES; page++) {
+      cfg->page_type[page] = PAGETYPE_CUSTOM;
+      cfg->page_data[page] = NULL;
+    }
+  }
+
+  // Let the CPU core access RAM and ROM pages directly.
+  m68k_clear_host_pages();
+  for (unsigned int page = 0; page < MAP_NUM_PAGES; page++) {
+    switch(cfg->page_type[page]) {
+      case PAGETYPE_RAM:
+        m68k_set_host_pages(page << MAP_PAGE_SHIFT, MAP_PAGE_SIZE, cfg->page_data[page], cfg->page_data[page]);
+        break;
+      case PAGETYPE_ROM:
+        m68k_set_host_pages(page << MAP_PAGE_SHIFT, MAP_PAGE_SIZE, cfg->page_data[page], NULL);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Chip RAM shadows serve CPU reads from a host copy and pass every write on to
+// the bus as well. A page is read in from the bus the first time the CPU reads
+// from it, while OVL is set reads of the low pages see ROM and go to the bus.
+static int fill_shadow_page(struct emulator_config *cfg, unsigned int page) {
+  uint32_t base = page << MAP_PAGE_SHIFT;
+  uint16_t *data = (uint16_t *)cfg->page_data[page];
+
+  for (int i = 0; i < MAX_NUM_MAPPED_ITEMS; i++) {
+    if (cfg->map_type[i] != MAPTYPE_SHADOW || !(CHKRANGE(base, cfg->map_offset[i], cfg->map_size[i])))
+      continue;
+
+    for (unsigned int offset = 0; offset < MAP_PAGE_SIZE; offset += 2)
+      data[offset >> 1] = htobe16(bus_read16((base + offset) & 0xFFFFFF));
+    cfg->map_shadow_valid[i][(base - cfg->map_offset[i]) >> MAP_PAGE_SHIFT] = 1;
+    cfg->page_type[page] = PAGETYPE_SHADOW;
+    return 1;
+  }
+
+  return -1;
+}
+
+static inline void write_shadow(unsigned char *write_addr, unsigned int value, unsigned char type) {
+  switch(type) {
+    case OP_TYPE_BYTE:
+      write_addr[0] = (unsigned char)value;
+      break;
+    case OP_TYPE_WORD:
+      ((short *)write_addr)[0] = htobe16(value);
+      break;
+    case OP_TYPE_LONGWORD:
+      ((int *)write_addr)[0] = htobe32(value);
+      break;
+  }
+}
+
+#define SHADOW_VERIFY_LONGWORDS 32
+#define SHADOW_VERIFY_INTERVAL_NS 1000000
+#define SHADOW_VERIFY_MAX_REPORTS 10
+
+static int verify_item, verify_offset;
+static uint64_t verify_last_ns;
+static unsigned int verify_mismatches[MAX_NUM_MAPPED_ITEMS];
+
+// Compare a small piece of the shadows mapped with verify=1 against the bus, at most once per
+// millisecond, so a full pass over 512KB takes about four seconds. Call it between timeslices.
+// A mismatch means something other than the CPU wrote there, most likely DMA, so the range
+// should not be shadowed. The copy is reloaded from the bus so checking can carry on.
+void verify_shadow_mappings(struct emulator_config *cfg) {
+  struct timespec ts;
+  uint64_t now_ns;
+  int i = verify_item;
+
+  if (!cfg->page_type)
+    return;
+  for (int n = 0; n < MAX_NUM_MAPPED_ITEMS; n++, i = (i + 1) % MAX_NUM_MAPPED_ITEMS) {
+    if (cfg->map_type[i] == MAPTYPE_SHADOW && cfg->map_verify[i])
+      break;
+  }
+  if (cfg->map_type[i] != MAPTYPE_SHADOW || !cfg->map_verify[i])
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  if (now_ns - verify_last_ns < SHADOW_VERIFY_INTERVAL_NS)
+    return;
+  verify_last_ns = now_ns;
+
+  if (i != verify_item) {
+    verify_item = i;
+    verify_offset = 0;
+  }
+
+  for (int n = 0; n < SHADOW_VERIFY_LONGWORDS && verify_offset + 4 <= (int)cfg->map_size[i]; n++, verify_offset += 4) {
+    unsigned int addr = cfg->map_offset[i] + verify_offset;
+    unsigned int page = addr >> MAP_PAGE_SHIFT;
+    uint32_t *host;
+    uint32_t value;
+
+    // Only filled pages are served from the copy.
+    if (cfg->page_type[page] != PAGETYPE_SHADOW)
+      continue;
+
+    host = (uint32_t *)(cfg->page_data[page] + (addr & MAP_PAGE_MASK));
+    value = (bus_read16(addr & 0xFFFFFF) << 16) | bus_read16((addr + 2) & 0xFFFFFF);
+    if (be32toh(*host) == value)
+      continue;
+
+    if (verify_mismatches[i]++ < SHADOW_VERIFY_MAX_REPORTS)
+      printf("[MAP %d] Shadow mismatch at $%.8X: copy %.8X, bus %.8X. Is this range written by DMA?\n", i, addr, be32toh(*host), value);
+    *host = htobe32(value);
+    m68k_invalidate_code(addr, 4);
+  }
+
+  if (verify_offset + 4 > (int)cfg->map_size[i]) {
+    verify_offset = 0;
+    verify_item = (i + 1) % MAX_NUM_MAPPED_ITEMS;
+  }
+}
+
+int handle_mapped_read(struct emulator_config *cfg, unsigned int addr, unsigned int *val, unsigned char type, unsigned char mirror) {
+  unsigned char *read_addr;
+  unsigned int page = addr >> MAP_PAGE_SHIFT;
+
+  if (!cfg->page_type)
+    return handle_mapped_read_scan(cfg, addr, val, type, mirror);
+
+  switch(cfg->page_type[page]) {
+    case PAGETYPE_PASSTHROUGH:
+      return -1;
+    case PAGETYPE_SHADOW_FILL:
+      if (mirror || fill_shadow_page(cfg, page) == -1)
+        return -1;
+      // Fall through
+    case PAGETYPE_SHADOW:
+      // A longword at the end of the page may need the next page, which could still be unfilled.
+      if (mirror || ((addr & MAP_PAGE_MASK) > MAP_PAGE_SIZE - 4 &&
+                     (page + 1 >= MAP_NUM_PAGES || cfg->page_type[page + 1] != PAGETYPE_SHADOW)))
+        return -1;
+      // Fall through
+    case PAGETYPE_RAM:
+    case PAGETYPE_ROM:
+      read_addr = cfg->page_data[page] + (addr & MAP_PAGE_MASK);
+      switch(type) {
+        case OP_TYPE_BYTE:
+          *val = read_addr[0];
+          return 1;
+        case OP_TYPE_WORD:
+          *val = be16toh(((unsigned short *)read_addr)[0]);
+          return 1;
+        case OP_TYPE_LONGWORD:
+          *val = be32toh(((unsigned int *)read_addr)[0]);
+          return 1;
+        default:
+          return -1;
+      }
+    case PAGETYPE_REGISTER:
+      if (cfg->platform && cfg->platform->register_read) {
+        if (cfg->platform->register_read(addr, type, &target) != -1) {
+          *val = target;
+          return 1;
+        }
+      }
+      return -1;
+    default:
+      return handle_mapped_read_scan(cfg, addr, val, type, mirror);
+  }
+}
+
+int handle_mapped_write(struct emulator_config *cfg, unsigned int addr, unsigned int value, unsigned char type, unsigned char mirror) {
+  unsigned char *write_addr;
+  unsigned int page = addr >> MAP_PAGE_SHIFT;
+
+  if (!cfg->page_type)
+    return handle_mapped_write_scan(cfg, addr, value, type, mirror);
+
+  switch(cfg->page_type[page]) {
+    case PAGETYPE_PASSTHROUGH:
+      return -1;
+    case PAGETYPE_ROM:
+      return 1;
+    case PAGETYPE_SHADOW:
+      // Keep the copy up to date and let the write go out to the bus too.
+      if ((addr & MAP_PAGE_MASK) + (1 << type) <= MAP_PAGE_SIZE) {
+        write_shadow(cfg->page_data[page] + (addr & MAP_PAGE_MASK), value, type);
+      } else {
+        for (int i = 0; i < (1 << type); i++) {
+          unsigned int byte_addr = addr + i;
+          if (cfg->page_type[byte_addr >> MAP_PAGE_SHIFT] == PAGETYPE_SHADOW)
+            cfg->page_data[byte_addr >> MAP_PAGE_SHIFT][byte_addr & MAP_PAGE_MASK] = value >> ((((1 << type) - 1) - i) * 8);
+        }
+      }
+      return -1;
+    case PAGETYPE_SHADOW_FILL:
+      return -1;
+    case PAGETYPE_RAM:
+      write_addr = cfg->page_data[page] + (addr & MAP_PAGE_MASK);
+      switch(type) {
+        case OP_TYPE_BYTE:
+          write_addr[0] = (unsigned char)value;
+          return 1;
+        case OP_TYPE_WORD:
+          ((short *)write_addr)[0] = htobe16(value);
+          return 1;
+        case OP_TYPE_LONGWORD:
+          ((int *)write_addr)[0] = htobe32(value);
+          return 1;
+        default:
+          return -1;
+      }
+    case PAGETYPE_REGISTER:
+      if (cfg->platform && cfg->platform->register_write)
+        return cfg->platform->register_write(addr, value, type);
+      return -1;
+    default:
+      return handle_mapped_write_scan(cfg, addr, value, type, mirror);
+  }
+}
+
+// Host memory behind addr, if the whole page is RAM (or ROM, for reads).
+static unsigned char *get_block_host_ptr(struct emulator_config *cfg, unsigned int addr, unsigned char write) {
+  unsigned int page = addr >> MAP_PAGE_SHIFT;
+
+  if (!cfg->page_type)
+    return NULL;
+  if (cfg->page_type[page] == PAGETYPE_RAM || (!write && cfg->page_type[page] == PAGETYPE_ROM))
+    return cfg->page_data[page] + (addr & MAP_PAGE_MASK);
+
+  return NULL;
+}
+
+static unsigned int get_block_chunk(unsigned int addr, unsigned int size) {
+  unsigned int left_in_page = MAP_PAGE_SIZE - (addr & MAP_PAGE_MASK);
+  return (size < left_in_page) ? size : left_in_page;
+}
+
+// Same as get_block_chunk, for a range that ends at end and is walked backwards.
+static unsigned int get_block_chunk_end(unsigned int end, unsigned int size) {
+  unsigned int left_in_page = ((end - 1) & MAP_PAGE_MASK) + 1;
+  return (size < left_in_page) ? size : left_in_page;
+}
+
+static void copy_swap16(unsigned char *dst, const unsigned char *src, unsigned int size) {
+  for (unsigned int i = 0; i < size; i += 2) {
+    uint16_t value;
+    memcpy(&value, src + i, 2);
+    value = be16toh(value);
+    memcpy(dst + i, &value, 2);
+  }
+}
+
+// Read size bytes starting at addr into buf. With OP_TYPE_BYTE and OP_TYPE_MEM, buf receives the data as it
+// is laid out in Amiga memory. With OP_TYPE_WORD, addr and size must be even and buf receives host endian
+// 16-bit words. Host backed pages are copied directly, anything else goes through the regular accesses:
+// byte accesses for OP_TYPE_BYTE, word accesses for OP_TYPE_WORD, and for OP_TYPE_MEM word accesses
+// wherever the address and length allow it, which halves the bus transactions compared to bytes.
+int handle_mapped_block_read(struct emulator_config *cfg, unsigned int addr, unsigned char *buf, unsigned int size, unsigned char type) {
+  if (type != OP_TYPE_BYTE && type != OP_TYPE_MEM && (type != OP_TYPE_WORD || (addr & 1) || (size & 1)))
+    return -1;
+
+  while (size) {
+    unsigned int chunk = get_block_chunk(addr, size);
+    unsigned char *src = get_block_host_ptr(cfg, addr, 0);
+
+    if (src && type != OP_TYPE_WORD) {
+      memcpy(buf, src, chunk);
+    } else if (src) {
+      copy_swap16(buf, src, chunk);
+    } else if (type == OP_TYPE_MEM && !((addr | chunk) & 1)) {
+      for (unsigned int i = 0; i < chunk; i += 2) {
+        uint16_t value = m68k_read_memory_16(addr + i);
+        buf[i] = value >> 8;
+        buf[i + 1] = value;
+      }
+    } else if (type != OP_TYPE_WORD) {
+      for (unsigned int i = 0; i < chunk; i++)
+        buf[i] = m68k_read_memory_8(addr + i);
+    } else {
+      for (unsigned int i = 0; i < chunk; i += 2) {
+        uint16_t value = m68k_read_memory_16(addr + i);
+        memcpy(buf + i, &value, 2);
+      }
+    }
+
+    addr += chunk;
+    buf += chunk;
+    size -= chunk;
+  }
+
+  return 1;
+}
+
+// Write size bytes from buf starting at addr, see handle_mapped_block_read for the buffer formats.
+// Writes to ROM are dropped, as for single accesses.
+int handle_mapped_block_write(struct emulator_config *cfg, unsigned int addr, const unsigned char *buf, unsigned int size, unsigned char type) {
+  unsigned int start = addr, total = size;
+
+  if (type != OP_TYPE_BYTE && type != OP_TYPE_MEM && (type != OP_TYPE_WORD || (addr & 1) || (size & 1)))
+    return -1;
+
+  while (size) {
+    unsigned int chunk = get_block_chunk(addr, size);
+    unsigned char *dst = get_block_host_ptr(cfg, addr, 1);
+
+    if (dst && type != OP_TYPE_WORD) {
+      memcpy(dst, buf, chunk);
+    } else if (dst) {
+      copy_swap16(dst, buf, chunk);
+    } else if (type == OP_TYPE_MEM && !((addr | chunk) & 1)) {
+      for (unsigned int i = 0; i < chunk; i += 2)
+        m68k_write_memory_16(addr + i, (buf[i] << 8) | buf[i + 1]);
+    } else if (type != OP_TYPE_WORD) {
+      for (unsigned int i = 0; i < chunk; i++)
+        m68k_write_memory_8(addr + i, buf[i]);
+    } else {
+      for (unsigned int i = 0; i < chunk; i += 2) {
+        uint16_t value;
+        memcpy(&value, buf + i, 2);
+        m68k_write_memory_16(addr + i, value);
+      }
+    }
+
+    addr += chunk;
+    buf += chunk;
+    size -= chunk;
+  }
+
+  // The CPU doesn't see writes made directly to host memory
+  m68k_invalidate_code(start, total);
+  return 1;
+}
+
+// Copy size bytes from src to dst in emulated memory. type selects the accesses for parts that aren't host
+// backed, as for handle_mapped_block_read; OP_TYPE_WORD needs even addresses and size. Overlapping ranges are handled like memmove:
+// when dst lies inside the source range, the copy walks backwards from the end.
+int handle_mapped_block_copy(struct emulator_config *cfg, unsigned int dst, unsigned int src, unsigned int size, unsigned char type) {
+  unsigned char bounce[256];
+  unsigned int start = dst, total = size;
+  int backwards = dst > src && dst - src < size;
+
+  if (type != OP_TYPE_BYTE && type != OP_TYPE_MEM && (type != OP_TYPE_WORD || (dst & 1) || (src & 1) || (size & 1)))
+    return -1;
+
+  // Walking backwards, src and dst point past the part that is left to copy.
+  if (backwards) {
+    src += size;
+    dst += size;
+  }
+
+  while (size) {
+    unsigned int chunk, from, to;
+
+    if (backwards) {
+      chunk = get_block_chunk_end(src, get_block_chunk_end(dst, size));
+      from = src - chunk;
+      to = dst - chunk;
+    } else {
+      chunk = get_block_chunk(src, get_block_chunk(dst, size));
+      from = src;
+      to = dst;
+    }
+
+    unsigned char *src_ptr = get_block_host_ptr(cfg, from, 0);
+    unsigned char *dst_ptr = get_block_host_ptr(cfg, to, 1);
+
+    if (src_ptr && dst_ptr) {
+      memmove(dst_ptr, src_ptr, chunk);
+    } else {
+      // Each bounce chunk is read completely before it is written, so it may overlap itself.
+      if (chunk > sizeof(bounce)) {
+        if (backwards) {
+          from += chunk - sizeof(bounce);
+          to += chunk - sizeof(bounce);
+        }
+        chunk = sizeof(bounce);
+      }
+      handle_mapped_block_read(cfg, from, bounce, chunk, type);
+      handle_mapped_block_write(cfg, to, bounce, chunk, type);
+    }
+
+    if (backwards) {
+      src -= chunk;
+      dst -= chunk;
+    } else {
+      src += chunk;
+      dst += chunk;
+    }
+    size -= chunk;
+  }
+
+  m68k_invalidate_code(start, total);
+  return 1;
+}
+
+int add_custom_range(struct emulator_config *cfg, unsigned int addr, unsigned int size) {
+  for (int i = 0; i < MAX_NUM_CUSTOM_RANGES; i++) {
+    if (cfg->custom_range_size[i] == 0) {
+      cfg->custom_range_addr[i] = addr;
+      cfg->custom_range_size[i] = size;
+      if (cfg->page_type)
+        build_page_table(cfg);
+      return i;
+    }
+  }
+
+  printf("Unable to add custom range at $%.8X, only %d ranges can be added with current binary.\n", addr, MAX_NUM_CUSTOM_RANGES);
+  return -1;
+}
+
+void remove_custom_range(struct emulator_config *cfg, unsigned int addr) {
+  for (int i = 0; i < MAX_NUM_CUSTOM_RANGES; i++) {
+    if (cfg->custom_range_size[i] != 0 && cfg->custom_range_addr[i] == addr) {
+      cfg->custom_range_size[i] = 0;
+      if (cfg->page_type)
+        build_page_table(cfg);
+      return;
+    }
+  }
+}
@@ -181,8 +181,13 @@ void autoconfig_write_memory_z3_8(struct emulator_config *cfg, unsigned int addr
     printf("Address of Z3 autoconf RAM assigned to $%.8x\n", ac_base[ac_z3_current_pic]);
     cfg->map_offset[index] = ac_base[ac_z3_current_pic];
     ac_z3_current_pic++;
-    if (ac_z3_current_pic == ac_z3_pic_count)
+    if (ac_z3_current_pic == ac_z3_pic_count) {
       ac_z3_done = 1;
+      // Also rebuilds the page table
+      remove_custom_range(cfg, AC_Z3_BASE);
+    } else {
+      build_page_table(cfg);
+    }
   }
 
   return;
@@ -210,8 +215,13 @@ void autoconfig_write_memory_z3_16(struct emulator_config *cfg, unsigned int add
     printf("Address of Z3 autoconf RAM assigned to $%.8x\n", ac_base[ac_z3_current_pic]);
     cfg->map_offset[index] = ac_base[ac_z3_current_pic];
     ac_z3_current_pic++;
-    if (ac_z3_current_pic == ac_z3_pic_count)
+    if (ac_z3_current_pic == ac_z3_pic_count) {
       ac_z3_done = 1;
+      // Also rebuilds the page table
+      remove_custom_range(cfg, AC_Z3_BASE);
+    } else {
+      build_page_table(cfg);
+    }
   }
 
   return;
@@ -294,7 +304,12 @@ void autoconfig_write_memory_8(struct emulator_config *cfg, unsigned int address
     printf("Address of Z2 autoconf RAM assigned to $%.8x\n", ac_base[ac_z2_current_pic]);
     cfg->map_offset[ac_z2_index[ac_z2_current_pic]] = ac_base[ac_z2_current_pic];
     ac_z2_current_pic++;
-    if (ac_z2_current_pic == ac_z2_pic_count)
+    if (ac_z2_current_pic == ac_z2_pic_count) {
       ac_z2_done = 1;
+      // Also rebuilds the page table
+      remove_custom_range(cfg, AC_Z2_BASE);
+    } else {
+      build_page_table(cfg);
+    }
   }
 }
@@ -119,9 +119,9 @@ int setup_platform_amiga(struct emulator_config *cfg) {
             printf("%dMB.\n", resize_data / SIZE_MEGA);
         }
         if (resize_data) {
-            free(cfg->map_data[index]);
+            free_mapping_data(cfg, index);
             cfg->map_size[index] = resize_data;
-            cfg->map_data[index] = (unsigned char *)malloc(cfg->map_size[index]);
+            alloc_mapping_ram(cfg, index);
         }
         printf("%dMB of Z2 Fast RAM configured at $%lx\n", cfg->map_size[index] / SIZE_MEGA, cfg->map_offset[index]);
         ac_z2_type[ac_z2_pic_count] = ACTYPE_MAPFAST_Z2;
@@ -161,7 +161,17 @@ int setup_platform_amiga(struct emulator_config *cfg) {
             cfg->map_id[i][0] = z3_autoconf_id[0];
         }
     }
-    
+
+    // Autoconf is the only thing handled by custom_read/custom_write, and only until it's done.
+    if (ac_z2_pic_count)
+        add_custom_range(cfg, AC_Z2_BASE, AC_SIZE);
+    else
+        ac_z2_done = 1;
+    if (ac_z3_pic_count)
+        add_custom_range(cfg, AC_Z3_BASE, AC_SIZE);
+    else
+        ac_z3_done = 1;
+
     return 0;
 }
 
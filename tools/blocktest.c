@@ -0,0 +1,160 @@
+// Checks handle_mapped_block_copy() against memmove on a flat copy of the emulated memory. Host backed
+// RAM is followed by pages that are only reachable through m68k_read/write_memory_xx, so the copies
+// cross 64KB pages, the boundary between the two kinds of memory and the bounce buffer chunks. Every
+// copy is done with byte, word and memory layout (OP_TYPE_MEM) transfers.
+// Usage: blocktest [thousand random copies]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../config_file/config_file.h"
+
+#define RAM_SIZE 0x30000
+#define MEM_SIZE 0x60000
+
+static unsigned char ram[RAM_SIZE];
+static unsigned char slow[MEM_SIZE - RAM_SIZE];
+static unsigned char ref[MEM_SIZE];
+
+// Only RAM and unmapped pages are used, nothing goes to the bus.
+uint32_t bus_read16(uint32_t address) {
+  (void)address;
+  return 0;
+}
+
+static unsigned char *mem_byte(unsigned int address) {
+  address %= MEM_SIZE;
+  return (address < RAM_SIZE) ? &ram[address] : &slow[address - RAM_SIZE];
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  return *mem_byte(address);
+}
+
+unsigned int m68k_read_memory_16(unsigned int address) {
+  return (*mem_byte(address) << 8) | *mem_byte(address + 1);
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value) {
+  *mem_byte(address) = value;
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value) {
+  *mem_byte(address) = value >> 8;
+  *mem_byte(address + 1) = value;
+}
+
+void m68k_set_host_pages(unsigned int address, unsigned int size, unsigned char *read_data, unsigned char *write_data) {
+  (void)address;
+  (void)size;
+  (void)read_data;
+  (void)write_data;
+}
+
+void m68k_clear_host_pages(void) {
+}
+
+void m68k_invalidate_code(unsigned int address, unsigned int size) {
+  (void)address;
+  (void)size;
+}
+
+static const char *type_names[OP_TYPE_NUM] = { "Byte", "Word", "Longword", "Memory" };
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void fill(void) {
+  for (unsigned int i = 0; i < MEM_SIZE; i++)
+    ref[i] = *mem_byte(i) = next_random();
+}
+
+// Returns the number of bytes that differ from memmove.
+static unsigned int check_copy(struct emulator_config *cfg, unsigned int dst, unsigned int src, unsigned int size,
+                               unsigned char type) {
+  unsigned int errors = 0;
+
+  fill();
+  handle_mapped_block_copy(cfg, dst, src, size, type);
+  memmove(ref + dst, ref + src, size);
+
+  for (unsigned int i = 0; i < MEM_SIZE; i++) {
+    if (*mem_byte(i) != ref[i])
+      errors++;
+  }
+  if (errors)
+    printf("%s copy $%.6X -> $%.6X, %u bytes: %u bytes differ\n", type_names[type], src, dst, size, errors);
+  return errors;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = ((argc > 1) ? atol(argv[1]) : 2) * 1000UL;
+  struct emulator_config *cfg;
+  unsigned long errors = 0, copies = 0;
+  // Forwards and backwards overlaps within a host page, across the 64KB page at $10000, across the
+  // host/bus boundary at $30000, and between bus pages with copies larger than the bounce buffer.
+  static const unsigned int cases[][3] = {
+    { 0x08000, 0x08010, 0x200 },  { 0x08010, 0x08000, 0x200 },
+    { 0x0FE80, 0x0FF00, 0x300 },  { 0x0FF80, 0x0FF00, 0x300 },
+    { 0x2FE00, 0x2FF00, 0x400 },  { 0x2FF40, 0x2FF00, 0x400 },
+    { 0x3FF00, 0x3FF02, 0x1000 }, { 0x3FF02, 0x3FF00, 0x1000 },
+    { 0x42000, 0x42100, 0x180 },  { 0x42100, 0x42000, 0x180 },
+    { 0x20000, 0x30000, 0x8000 }, { 0x30000, 0x20000, 0x8000 },
+  };
+
+  cfg = (struct emulator_config *)calloc(1, sizeof(struct emulator_config));
+  if (!cfg) {
+    printf("Failed to allocate memory for emulator config!\n");
+    return 1;
+  }
+  cfg->map_type[0] = MAPTYPE_RAM;
+  cfg->map_offset[0] = 0;
+  cfg->map_size[0] = RAM_SIZE;
+  cfg->map_data[0] = ram;
+  build_page_table(cfg);
+  if (!cfg->page_type) {
+    printf("No page table, nothing to test.\n");
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    errors += check_copy(cfg, cases[i][0], cases[i][1], cases[i][2], OP_TYPE_BYTE);
+    errors += check_copy(cfg, cases[i][0], cases[i][1], cases[i][2], OP_TYPE_WORD);
+    errors += check_copy(cfg, cases[i][0] + 1, cases[i][1], cases[i][2], OP_TYPE_MEM);
+    errors += check_copy(cfg, cases[i][0], cases[i][1], cases[i][2], OP_TYPE_MEM);
+    copies += 4;
+  }
+
+  // Random copies, mostly overlapping by a few bytes up to a few pages.
+  for (unsigned long i = 0; i < count; i++) {
+    static const unsigned char types[3] = { OP_TYPE_BYTE, OP_TYPE_WORD, OP_TYPE_MEM };
+    unsigned char type = types[next_random() % 3];
+    unsigned int size = next_random() % 0x3000 + 1;
+    unsigned int src = next_random() % (MEM_SIZE - size);
+    unsigned int range = (next_random() & 1) ? 0x20 : 0x4000;
+    int delta = (int)(next_random() % (2 * range + 1)) - (int)range;
+    unsigned int dst = src + delta;
+
+    if (delta < 0 && (unsigned int)-delta > src)
+      dst = 0;
+    if (dst + size > MEM_SIZE)
+      dst = MEM_SIZE - size;
+    if (type == OP_TYPE_WORD) {
+      src &= ~1;
+      dst &= ~1;
+      size = (size + 1) & ~1;
+    }
+    errors += check_copy(cfg, dst, src, size, type);
+    copies++;
+  }
+
+  printf("%lu block copies, %lu bytes differ\n", copies, errors);
+  return errors ? 1 : 0;
+}
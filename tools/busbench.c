@@ -0,0 +1,106 @@
+// Times the host side of the PiStorm bus protocol, from encoding to GPIO
+// register accesses, against a memory-backed fake GPIO block. There is no CPLD
+// behind it, the status pin reads back as done straight away, so this measures
+// the cost of the protocol code and the number of GPIO accesses per transaction.
+// read32/write32 are two word transactions, the way m68k_read/write_memory_32
+// put a longword on the bus.
+// Usage: busbench [million transactions]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static volatile uint32_t fake_gpio[64];
+static uint64_t gpio_writes;
+
+// GPIO0 follows the read strobe: low after a write strobe, high once a read was started.
+#define GPIO_WRITE(reg, value) (gpio_writes++, fake_gpio[reg] = (value))
+#define GPIO_READ(reg) ((reg) == GPLEV0 ? (fake_gpio[GPCLR0] >> PIN_RD) & 1 : fake_gpio[reg])
+
+#include "../bus/pistorm-protocol.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum bench_ops {
+  BENCH_READ8,
+  BENCH_READ16,
+  BENCH_WRITE8,
+  BENCH_WRITE16,
+  BENCH_READ32,
+  BENCH_WRITE32,
+  BENCH_MIXED,
+  BENCH_NUM,
+};
+
+static const char *bench_names[BENCH_NUM] = {
+  "read8",
+  "read16",
+  "write8",
+  "write16",
+  "read32",
+  "write32",
+  "mixed",
+};
+
+static uint32_t run_bench(int op, unsigned long count) {
+  uint32_t sum = 0, address = 0xDFF000;
+
+  for (unsigned long i = 0; i < count; i++) {
+    address = (address + 0x1236) & 0xFFFFFE;
+    switch (op) {
+      case BENCH_READ8: sum += pistorm_read8(address + (i & 1)); break;
+      case BENCH_READ16: sum += pistorm_read16(address); break;
+      case BENCH_WRITE8: pistorm_write8(address + (i & 1), i); break;
+      case BENCH_WRITE16: pistorm_write16(address, i); break;
+      case BENCH_READ32:
+        sum += (pistorm_read16(address) << 16) | pistorm_read16(address + 2);
+        break;
+      case BENCH_WRITE32:
+        pistorm_write16(address, i >> 16);
+        pistorm_write16(address + 2, i);
+        break;
+      case BENCH_MIXED:
+        // Roughly a 68000 running code from RAM: two reads per write.
+        if (i % 3 == 2)
+          pistorm_write16(address, i);
+        else
+          sum += pistorm_read16(address);
+        break;
+    }
+  }
+
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = ((argc > 1) ? atol(argv[1]) : 10) * 1000000UL;
+  uint32_t sum = 0;
+
+  pistorm_setup_pins();
+  pistorm_write_reg(0x02);
+
+  printf("%lu transactions each\n", count);
+  for (int posted = 0; posted <= 1; posted++) {
+    posted_writes = posted;
+    printf("%s writes:\n", posted ? "Posted" : "Synchronous");
+    for (int op = 0; op < BENCH_NUM; op++) {
+      uint64_t start_writes = gpio_writes;
+      double start = now();
+      sum += run_bench(op, count);
+      double elapsed = now() - start;
+      printf("  %-8s %7.2f ns/transaction %6.2f GPIO writes/transaction\n", bench_names[op],
+             elapsed * 1e9 / count, (double)(gpio_writes - start_writes) / count);
+    }
+    pistorm_wait_write();
+  }
+
+  sum += pistorm_read_reg() + pistorm_irq_pending();
+  printf("%u status polls waiting on the CPLD.\n", pistorm_get_wait_spins());
+  printf("(checksum %.8X)\n", sum);
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Shows the per-region bus access statistics of a running emulator with "busstats" in its config,
+// followed by its timeslices and interrupt rate.
+// Without an interval, prints the totals so far. With one, prints what happened in each interval
+// until interrupted.
+// Usage: busstats [interval in seconds] [-h]
+//   -h  Also print the latency histogram of every region
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../bus/bus-stats.h"
+
+static const char *region_names[BUS_REGION_NUM] = BUS_STATS_REGION_NAMES;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_stats(struct bus_stats *cur, struct bus_stats *prev, double elapsed_ns, int histograms) {
+  uint64_t total_count = 0, total_ns = 0;
+
+  for (int i = 0; i < BUS_REGION_NUM; i++) {
+    total_count += (cur->regions[i].reads - prev->regions[i].reads) + (cur->regions[i].writes - prev->regions[i].writes);
+    total_ns += cur->regions[i].time_ns - prev->regions[i].time_ns;
+  }
+
+  printf("%llu bus accesses in %.2f s, %.1f%% of the time spent in them.\n", (unsigned long long)total_count,
+         elapsed_ns / 1e9, total_ns * 100.0 / elapsed_ns);
+  printf("%-12s %12s %12s %12s %10s %10s\n", "Region", "Reads", "Writes", "Per second", "Avg ns", "Time share");
+  for (int i = 0; i < BUS_REGION_NUM; i++) {
+    struct bus_stats_region *c = &cur->regions[i], *p = &prev->regions[i];
+    uint64_t reads = c->reads - p->reads, writes = c->writes - p->writes, ns = c->time_ns - p->time_ns;
+    if (!reads && !writes)
+      continue;
+
+    printf("%-12s %12llu %12llu %12.0f %10.1f %9.1f%%\n", region_names[i], (unsigned long long)reads,
+           (unsigned long long)writes, (reads + writes) * 1e9 / elapsed_ns, (double)ns / (reads + writes),
+           total_ns ? ns * 100.0 / total_ns : 0);
+    if (!histograms)
+      continue;
+    for (int b = 0; b < BUS_STATS_BUCKETS; b++) {
+      uint64_t count = c->hist[b] - p->hist[b];
+      if (count)
+        printf("    <%8llu ns %12llu %6.2f%%\n", 1ULL << b, (unsigned long long)count, count * 100.0 / (reads + writes));
+    }
+  }
+
+  struct bus_stats_loop *cl = &cur->loop, *pl = &prev->loop;
+  uint64_t slices = cl->slices - pl->slices, loop_ns = (cl->exec_ns - pl->exec_ns) + (cl->overhead_ns - pl->overhead_ns);
+  if (slices && loop_ns) {
+    printf("%llu timeslices, %.0f cycles run per slice, loop cycles now %llu, %.1f%% main loop overhead.\n",
+           (unsigned long long)slices, (double)(cl->cycles - pl->cycles) / slices, (unsigned long long)cl->loop_cycles,
+           (cl->overhead_ns - pl->overhead_ns) * 100.0 / loop_ns);
+    printf("%llu interrupts, %.1f per second.\n", (unsigned long long)(cl->irqs - pl->irqs),
+           (cl->irqs - pl->irqs) * 1e9 / elapsed_ns);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  volatile struct bus_stats *shared;
+  struct bus_stats cur, prev;
+  int interval = 0, histograms = 0;
+  double last_ns;
+  int fd;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0)
+      histograms = 1;
+    else
+      interval = atoi(argv[i]);
+  }
+
+  fd = shm_open(BUS_STATS_SHM_NAME, O_RDONLY, 0);
+  if (fd == -1) {
+    printf("No bus statistics found, is the emulator running with busstats in its config?\n");
+    return 1;
+  }
+  shared = mmap(NULL, sizeof(struct bus_stats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shared == MAP_FAILED) {
+    printf("Failed to map bus statistics.\n");
+    return 1;
+  }
+  if (shared->magic != BUS_STATS_MAGIC || shared->version != BUS_STATS_VERSION) {
+    printf("Bus statistics are from an incompatible emulator version.\n");
+    return 1;
+  }
+
+  memcpy(&cur, (void *)shared, sizeof(cur));
+  if (!interval) {
+    memset(&prev, 0x00, sizeof(prev));
+    print_stats(&cur, &prev, now_ns() - cur.start_ns, histograms);
+    return 0;
+  }
+
+  last_ns = now_ns();
+  while (1) {
+    sleep(interval);
+    prev = cur;
+    memcpy(&cur, (void *)shared, sizeof(cur));
+    double t = now_ns();
+    // A restarted emulator starts counting from zero again.
+    if (cur.start_ns != prev.start_ns)
+      memset(&prev, 0x00, sizeof(prev));
+    print_stats(&cur, &prev, t - last_ns, histograms);
+    fflush(stdout);
+    last_ns = t;
+  }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Runs random byte/word/longword bus accesses through the simulated bus backend,
+// checks the data against a plain copy of Chip RAM and prints the bus statistics,
+// including the GPIO register accesses per transaction type.
+// Usage: bustest [thousand accesses] [extra sim options]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bus/bus.h"
+#include "../config_file/config_file.h"
+
+#define TEST_BASE 0x1000
+#define TEST_SIZE 0x100000
+
+extern struct bus_backend sim_bus_backend;
+
+// Only the option parsing helpers from config_file.c are used here.
+struct platform_config *make_platform_config(char *name, char *subsys) {
+  (void)name;
+  (void)subsys;
+  return NULL;
+}
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = ((argc > 1) ? atol(argv[1]) : 1000) * 1000UL;
+  char options[256] = "chipram=2M";
+  struct emulator_config *cfg;
+  struct bus_backend *b = &sim_bus_backend;
+  unsigned char *ref;
+  unsigned long errors = 0;
+
+  if (argc > 2) {
+    strcat(options, " ");
+    strncat(options, argv[2], sizeof(options) - strlen(options) - 1);
+  }
+
+  cfg = (struct emulator_config *)calloc(1, sizeof(struct emulator_config));
+  ref = (unsigned char *)calloc(1, TEST_SIZE);
+  if (!cfg || !ref) {
+    printf("Failed to allocate memory.\n");
+    return 1;
+  }
+
+  if (b->setup(cfg, options) == -1)
+    return 1;
+  b->write_reg(0x02);
+
+  for (unsigned long i = 0; i < count; i++) {
+    uint32_t r = next_random();
+    uint32_t offset = next_random() % (TEST_SIZE - 4);
+    uint32_t address = TEST_BASE + offset;
+    uint32_t value = next_random(), expected = 0, got = 0;
+    int read = r & 1;
+
+    switch ((r >> 1) % 3) {
+      case 0:
+        if (read) {
+          expected = ref[offset];
+          got = b->read8(address);
+        } else {
+          b->write8(address, value & 0xFF);
+          ref[offset] = value;
+        }
+        break;
+      case 1:
+        offset &= ~1;
+        address &= ~1;
+        if (read) {
+          expected = (ref[offset] << 8) | ref[offset + 1];
+          got = b->read16(address);
+        } else {
+          b->write16(address, value & 0xFFFF);
+          ref[offset] = value >> 8;
+          ref[offset + 1] = value;
+        }
+        break;
+      case 2:
+        offset &= ~1;
+        address &= ~1;
+        if (read) {
+          expected = (ref[offset] << 24) | (ref[offset + 1] << 16) | (ref[offset + 2] << 8) | ref[offset + 3];
+          got = (b->read16(address) << 16) | b->read16(address + 2);
+        } else {
+          b->write16(address, value >> 16);
+          b->write16(address + 2, value & 0xFFFF);
+          ref[offset] = value >> 24;
+          ref[offset + 1] = value >> 16;
+          ref[offset + 2] = value >> 8;
+          ref[offset + 3] = value;
+        }
+        break;
+    }
+
+    if (read && got != expected) {
+      if (errors < 10)
+        printf("Mismatch at %.6X: expected %.8X, got %.8X.\n", address, expected, got);
+      errors++;
+    }
+  }
+
+  b->print_stats();
+  b->shutdown();
+  printf("%lu accesses, %lu mismatches.\n", count, errors);
+
+  free(ref);
+  free(cfg);
+  return errors ? 1 : 0;
+}
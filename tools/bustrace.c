@@ -0,0 +1,204 @@
+// Summarizes a bus trace written with the "bustrace" config item: per-region
+// traffic and bandwidth, the hottest addresses and the distribution of
+// transaction times and status polls, to show what is worth moving host-side.
+// Usage: bustrace <trace file> [number of hot addresses]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bus/bus-trace.h"
+
+#define HIST_BUCKETS 24
+#define HOT_TABLE_SIZE (1 << 20)  // Must be a power of two
+
+enum trace_regions {
+  REGION_CHIP,
+  REGION_CIA,
+  REGION_SLOW,
+  REGION_GAYLE,
+  REGION_CUSTOM,
+  REGION_ROM,
+  REGION_OTHER,
+  REGION_STATUS,
+  REGION_NUM,
+};
+
+static const char *region_names[REGION_NUM] = {
+  "Chip RAM",
+  "CIA",
+  "Slow RAM",
+  "Gayle",
+  "Custom",
+  "ROM",
+  "Other",
+  "Status reg",
+};
+
+struct region_stats {
+  uint64_t reads, writes, bytes, time_ns, spins;
+};
+
+struct hot_address {
+  uint32_t address;
+  uint32_t used;
+  uint64_t count, time_ns;
+};
+
+static struct region_stats regions[REGION_NUM];
+static struct hot_address *hot;
+static uint64_t time_hist[HIST_BUCKETS], spin_hist[HIST_BUCKETS];
+static uint64_t thread_counts[16];
+
+static int get_region(struct bus_trace_record *rec) {
+  uint32_t address = rec->address & 0xFFFFFF;
+
+  if (rec->flags & BUS_TRACE_REG)
+    return REGION_STATUS;
+  if (address < 0x200000)
+    return REGION_CHIP;
+  if (address >= 0xA00000 && address < 0xC00000)
+    return REGION_CIA;
+  if (address >= 0xC00000 && address < 0xD80000)
+    return REGION_SLOW;
+  if (address >= 0xD80000 && address < 0xDF0000)
+    return REGION_GAYLE;
+  if (address >= 0xDFF000 && address < 0xE00000)
+    return REGION_CUSTOM;
+  if (address >= 0xF80000)
+    return REGION_ROM;
+  return REGION_OTHER;
+}
+
+static inline int log2_bucket(uint64_t value) {
+  int bucket = value ? 64 - __builtin_clzll(value) : 0;
+  return (bucket < HIST_BUCKETS) ? bucket : HIST_BUCKETS - 1;
+}
+
+static void count_address(uint32_t address, uint32_t time_ns) {
+  uint32_t i = (address * 2654435761U) & (HOT_TABLE_SIZE - 1);
+
+  // Linear probing, addresses past a full table are only counted per region.
+  for (int probes = 0; probes < 64; probes++, i = (i + 1) & (HOT_TABLE_SIZE - 1)) {
+    if (!hot[i].used) {
+      hot[i].used = 1;
+      hot[i].address = address;
+    }
+    if (hot[i].address == address) {
+      hot[i].count++;
+      hot[i].time_ns += time_ns;
+      return;
+    }
+  }
+}
+
+static int compare_hot(const void *a, const void *b) {
+  const struct hot_address *x = a, *y = b;
+  if (x->count != y->count)
+    return (x->count < y->count) ? 1 : -1;
+  return 0;
+}
+
+static void print_hist(const char *name, const char *unit, uint64_t *hist, uint64_t total) {
+  printf("\n%s:\n", name);
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    if (!hist[i])
+      continue;
+    printf("  <%10llu %-5s %12llu %6.2f%%\n", 1ULL << i, unit, (unsigned long long)hist[i], hist[i] * 100.0 / total);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct bus_trace_header header;
+  struct bus_trace_record rec;
+  uint64_t total = 0, total_ns = 0, first_ns = ~0ULL, last_ns = 0;
+  int top = (argc > 2) ? atoi(argv[2]) : 20;
+  FILE *in;
+
+  if (argc < 2) {
+    printf("Usage: %s <trace file> [number of hot addresses]\n", argv[0]);
+    return 1;
+  }
+
+  in = fopen(argv[1], "rb");
+  if (!in) {
+    printf("Failed to open %s.\n", argv[1]);
+    return 1;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, BUS_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != BUS_TRACE_VERSION || header.record_size != sizeof(struct bus_trace_record)) {
+    printf("%s is not a version %d bus trace.\n", argv[1], BUS_TRACE_VERSION);
+    fclose(in);
+    return 1;
+  }
+
+  hot = (struct hot_address *)calloc(HOT_TABLE_SIZE, sizeof(struct hot_address));
+  if (!hot) {
+    printf("Failed to allocate memory.\n");
+    fclose(in);
+    return 1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, in) == 1) {
+    struct region_stats *r = &regions[get_region(&rec)];
+
+    if (rec.flags & BUS_TRACE_WRITE)
+      r->writes++;
+    else
+      r->reads++;
+    r->bytes += rec.size;
+    r->time_ns += rec.duration_ns;
+    r->spins += rec.wait_spins;
+
+    if (!(rec.flags & BUS_TRACE_REG))
+      count_address(rec.address, rec.duration_ns);
+    time_hist[log2_bucket(rec.duration_ns)]++;
+    spin_hist[log2_bucket(rec.wait_spins)]++;
+    thread_counts[rec.flags >> BUS_TRACE_THREAD_SHIFT]++;
+
+    if (rec.time_ns < first_ns)
+      first_ns = rec.time_ns;
+    if (rec.time_ns + rec.duration_ns > last_ns)
+      last_ns = rec.time_ns + rec.duration_ns;
+    total_ns += rec.duration_ns;
+    total++;
+  }
+  fclose(in);
+
+  if (!total) {
+    printf("No transactions in %s.\n", argv[1]);
+    return 0;
+  }
+
+  double span_s = (last_ns - first_ns) / 1e9;
+  printf("%llu transactions over %.3f s, %.1f%% of it spent in bus transactions.\n", (unsigned long long)total,
+         span_s, total_ns * 100.0 / (last_ns - first_ns));
+  for (int i = 0; i < 16; i++) {
+    if (thread_counts[i])
+      printf("  Thread %d: %llu transactions\n", i, (unsigned long long)thread_counts[i]);
+  }
+
+  printf("\n%-10s %12s %12s %10s %10s %12s %10s\n", "Region", "Reads", "Writes", "KB/s", "Avg ns", "Time share", "Avg spins");
+  for (int i = 0; i < REGION_NUM; i++) {
+    struct region_stats *r = &regions[i];
+    uint64_t count = r->reads + r->writes;
+    if (!count)
+      continue;
+    printf("%-10s %12llu %12llu %10.1f %10.1f %11.1f%% %10.2f\n", region_names[i], (unsigned long long)r->reads,
+           (unsigned long long)r->writes, span_s > 0 ? r->bytes / 1024.0 / span_s : 0, (double)r->time_ns / count,
+           r->time_ns * 100.0 / total_ns, (double)r->spins / count);
+  }
+
+  qsort(hot, HOT_TABLE_SIZE, sizeof(struct hot_address), compare_hot);
+  printf("\nHottest addresses:\n%-10s %12s %10s %10s\n", "Address", "Accesses", "Share", "Avg ns");
+  for (int i = 0; i < top && i < HOT_TABLE_SIZE && hot[i].count; i++) {
+    printf("%.8X   %12llu %9.2f%% %10.1f\n", hot[i].address, (unsigned long long)hot[i].count,
+           hot[i].count * 100.0 / total, (double)hot[i].time_ns / hot[i].count);
+  }
+
+  print_hist("Transaction time", "ns", time_hist, total);
+  print_hist("Status polls per transaction", "polls", spin_hist, total);
+
+  free(hot);
+  return 0;
+}
@@ -0,0 +1,263 @@
+// Interpreter speed of the CPU core on a few small 68k loops running from host mapped RAM, so
+// no bus access gets in the way. Built twice by "make tools": tools/cpubench with the dispatch
+// configured in m68kconf.h, tools/cpubench-table with the jump table loop, to compare the two.
+// Each test is run a few times and the fastest run counts, to keep other load out of the numbers.
+// tools/cpubench-profile counts opcode handler pairs instead, see M68K_PAIR_PROFILE in m68kconf.h.
+// tools/cpubench-lazy has lazy condition codes, see M68K_LAZY_FLAGS.
+// Usage: cpubench [million cycles per run] [-b] [-j] [-c cpu] [-p file]
+//   -b  Enable the block cache
+//   -j  Enable the block cache and the JIT, which tools/cpubench is built with
+//   -c  CPU to emulate: 68000, 68010, 68020 (default), 68030 or 68040
+//   -p  Write the opcode pair profile of all runs to a file, needs tools/cpubench-profile
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../m68k.h"
+
+#define RAM_SIZE (1024 * 1024)
+#define CODE_ADDRESS 0x1000
+#define STACK_ADDRESS 0x80000
+#define RUNS 5
+
+static unsigned char ram[RAM_SIZE];
+
+struct workload {
+  const char *name;
+  const uint16_t *code;
+  unsigned int words;
+};
+
+// Copies 4 KB with move.l (a0)+,(a1)+ and dbra, over and over.
+static const uint16_t copy_loop[] = {
+  0x41F9, 0x0001, 0x0000,  // lea $10000,a0
+  0x43F9, 0x0002, 0x0000,  // lea $20000,a1
+  0x303C, 0x03FF,          // move.w #1023,d0
+  0x22D8,                  // .loop: move.l (a0)+,(a1)+
+  0x51C8, 0xFFFC,          // dbra d0,.loop
+  0x60E8,                  // bra start
+};
+
+// Checksums a buffer with word adds, rotates, eor and a data dependent branch.
+static const uint16_t arith_loop[] = {
+  0x7200,                  // moveq #0,d1
+  0x303C, 0x0FFF,          // move.w #4095,d0
+  0x41F9, 0x0001, 0x0000,  // lea $10000,a0
+  0x3418,                  // .loop: move.w (a0)+,d2
+  0xD242,                  // add.w d2,d1
+  0xE759,                  // rol.w #3,d1
+  0xB141,                  // eor.w d0,d1
+  0x0C41, 0x8000,          // cmp.w #$8000,d1
+  0x6502,                  // bcs.s .skip
+  0x5243,                  // addq.w #1,d3
+  0x51C8, 0xFFEE,          // .skip: dbra d0,.loop
+  0x60DE,                  // bra start
+};
+
+// Steps a CRC-32 style LFSR in a subroutine, with hard to predict branches.
+static const uint16_t branch_loop[] = {
+  0x303C, 0x07FF,          // move.w #2047,d0
+  0x283C, 0x1234, 0x5678,  // move.l #$12345678,d4
+  0x2204,                  // .loop: move.l d4,d1
+  0x610C,                  // bsr.s .step
+  0x4A81,                  // tst.l d1
+  0x6702,                  // beq.s .zero
+  0x5385,                  // subq.l #1,d5
+  0x51C8, 0xFFF4,          // .zero: dbra d0,.loop
+  0x60E6,                  // bra start
+  0xE28C,                  // .step: lsr.l #1,d4
+  0x6406,                  // bcc.s .noxor
+  0x0A84, 0xEDB8, 0x8320,  // eori.l #$EDB88320,d4
+  0x0281, 0x0000, 0x00FF,  // .noxor: andi.l #$FF,d1
+  0x4E75,                  // rts
+};
+
+// Table lookups with the indexed addressing modes, whose extension word decoding differs by CPU.
+static const uint16_t index_loop[] = {
+  0x7200,                  // moveq #0,d1
+  0x303C, 0x0FFF,          // move.w #4095,d0
+  0x41F9, 0x0001, 0x0000,  // lea $10000,a0
+  0x1430, 0x1000,          // .loop: move.b (0,a0,d1.w),d2
+  0xD242,                  // add.w d2,d1
+  0x0241, 0x0FFF,          // andi.w #$FFF,d1
+  0x45F0, 0x1800,          // lea (0,a0,d1.l),a2
+  0xD612,                  // add.b (a2),d3
+  0x51C8, 0xFFEE,          // dbra d0,.loop
+  0x60DE,                  // bra start
+};
+
+// Straight-line code of random ALU instructions and short forward branches on d0-d6, so
+// thousands of different opcodes run and the dispatch tables don't all fit in the cache.
+#define MIXED_OPS 4096
+static uint16_t mixed_loop[MIXED_OPS + 8];
+
+static void generate_mixed_loop(void) {
+  static const uint16_t ops[] = {
+    0xD080,  // add.l dx,dy
+    0x9080,  // sub.l dx,dy
+    0xC080,  // and.l dx,dy
+    0x8080,  // or.l dx,dy
+    0xB080,  // cmp.l dx,dy
+  };
+  uint32_t seed = 0x2545F491;
+  unsigned int n = 0, i;
+
+  mixed_loop[n++] = 0x3E3C;  // move.w #255,d7
+  mixed_loop[n++] = 0x00FF;
+  for (i = 0; i < MIXED_OPS; i++) {
+    seed = seed * 1103515245 + 12345;
+    unsigned int r = seed >> 8, x = r % 7, y = (r >> 3) % 7, kind = (r >> 6) % 8;
+
+    if (kind < 5)
+      mixed_loop[n++] = ops[kind] | (y << 9) | x;
+    else if (kind == 5)
+      mixed_loop[n++] = 0x7000 | (y << 9) | ((r >> 9) & 0xFF);  // moveq #imm,dy
+    else if (kind == 6)
+      mixed_loop[n++] = 0xE188 | (((r >> 9) & 7) << 9) | y;  // lsl.l #imm,dy
+    else if (i + 4 < MIXED_OPS)
+      mixed_loop[n++] = 0x6000 | ((2 + (r >> 9) % 14) << 8) | (2 + 2 * ((r >> 13) & 3));  // bcc.s over 1-4 words
+    else
+      mixed_loop[n++] = 0x4E71;  // nop
+  }
+  mixed_loop[n++] = 0x51CF;  // dbra d7,.loop
+  mixed_loop[n] = (uint16_t)(4 - 2 * n);
+  n++;
+  mixed_loop[n++] = 0x6000;  // bra.w start
+  mixed_loop[n] = (uint16_t)(-2 * n);
+}
+
+static const struct {
+  const char *name;
+  unsigned int type;
+} cpus[] = {
+  { "68000", M68K_CPU_TYPE_68000 },
+  { "68010", M68K_CPU_TYPE_68010 },
+  { "68020", M68K_CPU_TYPE_68020 },
+  { "68030", M68K_CPU_TYPE_68030 },
+  { "68040", M68K_CPU_TYPE_68040 },
+};
+
+static const struct workload workloads[] = {
+  { "copy", copy_loop, sizeof(copy_loop) / 2 },
+  { "arith", arith_loop, sizeof(arith_loop) / 2 },
+  { "branch", branch_loop, sizeof(branch_loop) / 2 },
+  { "index", index_loop, sizeof(index_loop) / 2 },
+  { "mixed", mixed_loop, sizeof(mixed_loop) / 2 },
+};
+
+// CPU time, so time the benchmark spends preempted doesn't count.
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline unsigned int get_ram(unsigned int address, int size) {
+  unsigned int value = 0;
+
+  for (int i = 0; i < size; i++)
+    value = (value << 8) | ram[(address + i) & (RAM_SIZE - 1)];
+  return value;
+}
+
+static inline void put_ram(unsigned int address, unsigned int value, int size) {
+  for (int i = size - 1; i >= 0; i--, value >>= 8)
+    ram[(address + i) & (RAM_SIZE - 1)] = value & 0xFF;
+}
+
+// Only used for accesses that straddle host pages, everything else hits RAM directly.
+unsigned int m68k_read_memory_8(unsigned int address) { return get_ram(address, 1); }
+unsigned int m68k_read_memory_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_memory_32(unsigned int address) { return get_ram(address, 4); }
+void m68k_write_memory_8(unsigned int address, unsigned int value) { put_ram(address, value, 1); }
+void m68k_write_memory_16(unsigned int address, unsigned int value) { put_ram(address, value, 2); }
+void m68k_write_memory_32(unsigned int address, unsigned int value) { put_ram(address, value, 4); }
+unsigned int m68k_read_disassembler_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_disassembler_32(unsigned int address) { return get_ram(address, 4); }
+
+void cpu_pulse_reset(void) {
+}
+
+static double run_workload(const struct workload *w, unsigned long cycles) {
+  double start;
+  unsigned long done = 0;
+
+  memset(ram, 0x00, sizeof(ram));
+  put_ram(0, STACK_ADDRESS, 4);
+  put_ram(4, CODE_ADDRESS, 4);
+  for (unsigned int i = 0; i < w->words; i++)
+    put_ram(CODE_ADDRESS + i * 2, w->code[i], 2);
+  for (unsigned int i = 0; i < 0x10000; i += 2)
+    put_ram(0x10000 + i, i * 0x9E37, 2);
+  m68k_invalidate_code(0, RAM_SIZE);
+  m68k_pulse_reset();
+
+  start = now();
+  // Timeslices of the size the emulator runs by default.
+  while (done < cycles)
+    done += m68k_execute(300);
+  return now() - start;
+}
+
+// Both dispatch modes run the same number of cycles, so they have to end up in the same state.
+static uint32_t register_checksum(void) {
+  uint32_t sum = m68k_get_reg(NULL, M68K_REG_PC) ^ m68k_get_reg(NULL, M68K_REG_SR);
+
+  for (int r = M68K_REG_D0; r <= M68K_REG_A7; r++)
+    sum = (sum << 5 | sum >> 27) ^ m68k_get_reg(NULL, r);
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long cycles = 50 * 1000000UL;
+  int block_cache = 0, jit = 0;
+  unsigned int cpu = 2;
+  const char *pair_profile = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0)
+      block_cache = 1;
+    else if (strcmp(argv[i], "-j") == 0)
+      block_cache = jit = 1;
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      for (cpu = 0; cpu < sizeof(cpus) / sizeof(cpus[0]) && strcmp(cpus[cpu].name, argv[i + 1]) != 0; cpu++)
+        ;
+      if (cpu == sizeof(cpus) / sizeof(cpus[0])) {
+        printf("Unknown CPU %s.\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      pair_profile = argv[++i];
+    else
+      cycles = atol(argv[i]) * 1000000UL;
+  }
+
+  generate_mixed_loop();
+  m68k_init();
+  m68k_set_cpu_type(cpus[cpu].type);
+  m68k_set_host_pages(0, RAM_SIZE, ram, ram);
+  m68k_set_block_cache(block_cache);
+  m68k_set_jit(jit);
+
+  printf("%s dispatch%s%s, %s, best of %d runs of %lu million cycles\n",
+         M68K_PAIR_PROFILE ? "Pair profiling" : (M68K_THREADED_DISPATCH ? "Threaded" : "Jump table"),
+         jit ? " with block cache and JIT" : (block_cache ? " with block cache" : ""),
+         M68K_LAZY_FLAGS ? " and lazy flags" : "", cpus[cpu].name, RUNS, cycles / 1000000);
+  for (unsigned int i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    double t = run_workload(&workloads[i], cycles);
+    for (int run = 1; run < RUNS; run++) {
+      double t2 = run_workload(&workloads[i], cycles);
+      if (t2 < t)
+        t = t2;
+    }
+    printf("%-8s %8.3f s %10.1f emulated MHz   registers %.8X\n", workloads[i].name, t, cycles / t / 1e6,
+           register_checksum());
+  }
+
+  if (pair_profile && m68k_write_pair_profile(pair_profile) != 0)
+    return 1;
+  return 0;
+}
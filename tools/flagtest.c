@@ -0,0 +1,282 @@
+// Differential test of the lazy condition codes (M68K_LAZY_FLAGS in m68kconf.h) against the normal
+// flag handling. tools/flagtest runs random streams of flag setting and flag reading instructions and
+// records them with the registers after every instruction. tools/flagtest-lazy, the same program built
+// with lazy flags, replays a recording and stops at the first instruction that ends up different.
+// Usage: flagtest [-n instructions] [-s seed] [-c cpu] [-b] file
+//        flagtest-lazy file
+//   -n  Number of instructions to record (default 200000)
+//   -s  Seed for the random instructions
+//   -c  CPU to emulate: 68000, 68010, 68020 (default), 68030 or 68040
+//   -b  Run with the block cache enabled
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../m68k.h"
+
+#define RAM_SIZE (1024 * 1024)
+#define CODE_ADDRESS 0x1000
+#define HANDLER_ADDRESS 0x800
+#define DATA_ADDRESS 0x10000
+#define STACK_ADDRESS 0x80000
+#define CODE_WORDS 8192
+#define FLAGTEST_MAGIC 0x54474C46  // "FLGT"
+// The SR is only read now and then, reading it works out any pending flags.
+#define SR_INTERVAL 64
+
+static unsigned char ram[RAM_SIZE];
+static uint16_t code[CODE_WORDS];
+
+struct header {
+  uint32_t magic;
+  uint32_t cpu;
+  uint32_t block_cache;
+  uint32_t code_words;
+  uint32_t steps;
+};
+
+// Registers after an instruction, sr is 0 unless the step is a multiple of SR_INTERVAL.
+struct record {
+  uint32_t pc, sr;
+  uint32_t regs[16];
+};
+
+static const struct {
+  const char *name;
+  unsigned int type;
+} cpus[] = {
+  { "68000", M68K_CPU_TYPE_68000 },
+  { "68010", M68K_CPU_TYPE_68010 },
+  { "68020", M68K_CPU_TYPE_68020 },
+  { "68030", M68K_CPU_TYPE_68030 },
+  { "68040", M68K_CPU_TYPE_68040 },
+};
+
+static const char *reg_names[16] = { "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+                                     "A0", "A1", "A2", "A3", "A4", "A5", "A6", "A7" };
+
+static inline unsigned int get_ram(unsigned int address, int size) {
+  unsigned int value = 0;
+
+  for (int i = 0; i < size; i++)
+    value = (value << 8) | ram[(address + i) & (RAM_SIZE - 1)];
+  return value;
+}
+
+static inline void put_ram(unsigned int address, unsigned int value, int size) {
+  for (int i = size - 1; i >= 0; i--, value >>= 8)
+    ram[(address + i) & (RAM_SIZE - 1)] = value & 0xFF;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) { return get_ram(address, 1); }
+unsigned int m68k_read_memory_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_memory_32(unsigned int address) { return get_ram(address, 4); }
+void m68k_write_memory_8(unsigned int address, unsigned int value) { put_ram(address, value, 1); }
+void m68k_write_memory_16(unsigned int address, unsigned int value) { put_ram(address, value, 2); }
+void m68k_write_memory_32(unsigned int address, unsigned int value) { put_ram(address, value, 4); }
+unsigned int m68k_read_disassembler_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_disassembler_32(unsigned int address) { return get_ram(address, 4); }
+
+void cpu_pulse_reset(void) {
+}
+
+static uint32_t seed = 0x2545F491;
+
+static unsigned int rnd(unsigned int n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+// One instruction of a single word that sets or reads flags, on data registers or (a0)/(a1).
+static uint16_t random_short_instruction(void) {
+  unsigned int x = rnd(8), y = rnd(8), size = rnd(3);
+
+  switch (rnd(20)) {
+    case 0: return 0xD000 | (x << 9) | (size << 6) | y;         // add.s dy,dx
+    case 1: return 0x9000 | (x << 9) | (size << 6) | y;         // sub.s dy,dx
+    case 2: return 0xB000 | (x << 9) | (size << 6) | y;         // cmp.s dy,dx
+    case 3: return 0x5000 | (x << 9) | (size << 6) | y;         // addq.s #x,dy
+    case 4: return 0x5100 | (x << 9) | (size << 6) | y;         // subq.s #x,dy
+    case 5: return 0xD100 | (x << 9) | (size << 6) | y;         // addx.s dy,dx
+    case 6: return 0x9100 | (x << 9) | (size << 6) | y;         // subx.s dy,dx
+    case 7: return 0x4000 | (size << 6) | y;                    // negx.s dy
+    case 8: return 0x4400 | (size << 6) | y;                    // neg.s dy
+    case 9: return 0xE010 | (x << 9) | (rnd(2) << 8) | (size << 6) | y;  // roxr/roxl.s #x,dy
+    case 10: return 0x2000 | (x << 9) | y;                      // move.l dy,dx
+    case 11: return 0x4A00 | (size << 6) | y;                   // tst.s dy
+    case 12: return 0x50C0 | (rnd(16) << 8) | y;                // scc dy
+    case 13: return 0x40C0 | y;                                 // move sr,dy
+    case 14: return 0x44C0 | y;                                 // move dy,ccr
+    case 15: return 0x7000 | (x << 9) | rnd(256);               // moveq #imm,dx
+    case 16: return 0xD010 | (x << 9) | (size << 6) | rnd(2);   // add.s (a0/a1),dx
+    case 17: return 0x9110 | (x << 9) | (size << 6) | rnd(2);   // sub.s dx,(a0/a1)
+    case 18: return 0xB1C8 | (x << 9) | rnd(8);                 // cmpa.l ay,ax
+    default: return rnd(8) ? 0x80C0 | (x << 9) | y : 0x4E40;    // divu.w dy,dx or trap #0
+  }
+}
+
+// Fills the code with random instructions, ending in a jump back to the start.
+static void generate_code(void) {
+  unsigned int n = 0;
+
+  while (n < CODE_WORDS - 8) {
+    unsigned int kind = rnd(8), size = rnd(3), y = rnd(8);
+
+    if (kind == 0) {
+      // addi/subi/cmpi.s #imm,dy
+      static const uint16_t ops[] = { 0x0600, 0x0400, 0x0C00 };
+      code[n++] = ops[rnd(3)] | (size << 6) | y;
+      if (size == 2)
+        code[n++] = rnd(0x10000);
+      code[n++] = rnd(0x10000);
+    } else if (kind == 1) {
+      // bcc.s over the next instruction
+      code[n++] = 0x6002 | (rnd(16) << 8);
+      code[n++] = random_short_instruction();
+    } else
+      code[n++] = random_short_instruction();
+  }
+  code[n++] = 0x4EF9;  // jmp start
+  code[n++] = CODE_ADDRESS >> 16;
+  code[n++] = CODE_ADDRESS & 0xFFFF;
+  while (n < CODE_WORDS)
+    code[n++] = 0x4E71;  // nop
+}
+
+static void setup(void) {
+  memset(ram, 0x00, sizeof(ram));
+  put_ram(0, STACK_ADDRESS, 4);
+  put_ram(4, CODE_ADDRESS, 4);
+  // Division by zero, traps and everything else return right away.
+  for (unsigned int v = 2; v < 256; v++)
+    put_ram(v * 4, HANDLER_ADDRESS, 4);
+  put_ram(HANDLER_ADDRESS, 0x4E73, 2);  // rte
+  for (unsigned int i = 0; i < CODE_WORDS; i++)
+    put_ram(CODE_ADDRESS + i * 2, code[i], 2);
+  for (unsigned int i = 0; i < 0x10000; i += 2)
+    put_ram(DATA_ADDRESS + i, i * 0x9E37, 2);
+  m68k_invalidate_code(0, RAM_SIZE);
+  m68k_pulse_reset();
+  m68k_set_reg(M68K_REG_A0, DATA_ADDRESS + 0x100);
+  m68k_set_reg(M68K_REG_A1, DATA_ADDRESS + 0x2002);
+  for (int r = M68K_REG_D0; r <= M68K_REG_D7; r++)
+    m68k_set_reg(r, (r - M68K_REG_D0 + 1) * 0x9E3779B9);
+}
+
+static void step(struct record *rec, uint32_t n) {
+  m68k_execute(1);
+  rec->pc = m68k_get_reg(NULL, M68K_REG_PC);
+  rec->sr = n % SR_INTERVAL == 0 ? m68k_get_reg(NULL, M68K_REG_SR) : 0;
+  for (int r = 0; r < 16; r++)
+    rec->regs[r] = m68k_get_reg(NULL, M68K_REG_D0 + r);
+}
+
+static int record(const char *filename, uint32_t steps, unsigned int cpu, int block_cache) {
+  struct header h = { FLAGTEST_MAGIC, cpu, block_cache, CODE_WORDS, steps };
+  struct record rec;
+  FILE *f = fopen(filename, "wb");
+
+  if (!f) {
+    printf("Failed to create %s.\n", filename);
+    return 1;
+  }
+  generate_code();
+  setup();
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(code, sizeof(code), 1, f);
+  for (uint32_t n = 1; n <= steps; n++) {
+    step(&rec, n);
+    fwrite(&rec, sizeof(rec), 1, f);
+  }
+  fclose(f);
+  printf("Recorded %u instructions on the %s to %s.\n", steps, cpus[cpu].name, filename);
+  return 0;
+}
+
+static int replay(const char *filename) {
+  struct header h;
+  struct record expected, rec;
+  uint32_t prev_pc = CODE_ADDRESS;
+  char dasm[100];
+  FILE *f = fopen(filename, "rb");
+
+  if (!f) {
+    printf("Failed to open %s.\n", filename);
+    return 1;
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != FLAGTEST_MAGIC || h.code_words != CODE_WORDS ||
+      h.cpu >= sizeof(cpus) / sizeof(cpus[0]) || fread(code, sizeof(code), 1, f) != 1) {
+    printf("%s is not a flagtest recording.\n", filename);
+    fclose(f);
+    return 1;
+  }
+  m68k_set_cpu_type(cpus[h.cpu].type);
+  m68k_set_block_cache(h.block_cache);
+  setup();
+
+  for (uint32_t n = 1; n <= h.steps; n++) {
+    if (fread(&expected, sizeof(expected), 1, f) != 1) {
+      printf("%s ends after %u instructions.\n", filename, n - 1);
+      fclose(f);
+      return 1;
+    }
+    step(&rec, n);
+    if (memcmp(&rec, &expected, sizeof(rec)) != 0) {
+      m68k_disassemble(dasm, prev_pc, cpus[h.cpu].type);
+      printf("Instruction %u differs: %08X  %s\n", n, prev_pc, dasm);
+      if (rec.pc != expected.pc)
+        printf("  PC %08X, expected %08X\n", rec.pc, expected.pc);
+      if (rec.sr != expected.sr)
+        printf("  SR %04X, expected %04X\n", rec.sr, expected.sr);
+      for (int r = 0; r < 16; r++)
+        if (rec.regs[r] != expected.regs[r])
+          printf("  %s %08X, expected %08X\n", reg_names[r], rec.regs[r], expected.regs[r]);
+      fclose(f);
+      return 1;
+    }
+    prev_pc = rec.pc;
+  }
+  fclose(f);
+  printf("All %u instructions on the %s match.\n", h.steps, cpus[h.cpu].name);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t steps = 200000;
+  unsigned int cpu = 2;
+  int block_cache = 0;
+  const char *filename = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      steps = atol(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      seed = atol(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0)
+      block_cache = 1;
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      for (cpu = 0; cpu < sizeof(cpus) / sizeof(cpus[0]) && strcmp(cpus[cpu].name, argv[i + 1]) != 0; cpu++)
+        ;
+      if (cpu == sizeof(cpus) / sizeof(cpus[0])) {
+        printf("Unknown CPU %s.\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+    } else
+      filename = argv[i];
+  }
+  if (!filename) {
+    printf("Usage: %s [-n instructions] [-s seed] [-c cpu] [-b] file\n", argv[0]);
+    return 1;
+  }
+
+  m68k_init();
+  m68k_set_cpu_type(cpus[cpu].type);
+  m68k_set_host_pages(0, RAM_SIZE, ram, ram);
+  m68k_set_block_cache(block_cache);
+
+  if (M68K_LAZY_FLAGS)
+    return replay(filename);
+  return record(filename, steps, cpu, block_cache);
+}
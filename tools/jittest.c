@@ -0,0 +1,263 @@
+// Differential test of the JIT in m68kjit.c against the block cache interpreter. Generates random
+// 68k loops out of the instructions the JIT translates natively (moveq, move, movea, lea, addq/subq
+// to An, and, or, eor) plus a few it threads, with operands in and out of host mapped RAM and
+// across page ends, runs each of them once with the block cache only and once with the JIT, and
+// compares the registers, SR, PC, a hash of RAM and the cycles run. Loops that write over their own
+// code are skipped, since the two only agree on those up to the next check. Built with M68K_JIT on
+// by "make tools", whatever m68kconf.h has.
+// Usage: jittest [iterations] [first iteration]
+//   Exits with 1 and prints the loop and the differing state on the first mismatch.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../m68k.h"
+
+#define RAM_SIZE (1024 * 1024)
+#define HOST_SIZE 0x80000
+#define CODE_ADDRESS 0x1000
+#define RUN_CYCLES 20000
+
+enum { MODE_BLOCK_CACHE = 1, MODE_JIT = 2 };
+
+static unsigned char ram[RAM_SIZE];
+static unsigned char init_ram[RAM_SIZE];
+
+static unsigned int get_ram(unsigned int address, int size) {
+  unsigned int value = 0;
+  for (int i = 0; i < size; i++)
+    value = (value << 8) | ram[(address + i) & (RAM_SIZE - 1)];
+  return value;
+}
+
+static void put_ram(unsigned int address, unsigned int value, int size) {
+  for (int i = size - 1; i >= 0; i--, value >>= 8)
+    ram[(address + i) & (RAM_SIZE - 1)] = value;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) { return get_ram(address, 1); }
+unsigned int m68k_read_memory_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_memory_32(unsigned int address) { return get_ram(address, 4); }
+void m68k_write_memory_8(unsigned int address, unsigned int value) { put_ram(address, value, 1); }
+void m68k_write_memory_16(unsigned int address, unsigned int value) { put_ram(address, value, 2); }
+void m68k_write_memory_32(unsigned int address, unsigned int value) { put_ram(address, value, 4); }
+unsigned int m68k_read_disassembler_16(unsigned int address) { return get_ram(address, 2); }
+unsigned int m68k_read_disassembler_32(unsigned int address) { return get_ram(address, 4); }
+void cpu_pulse_reset(void) {}
+
+static uint16_t code[4096];
+static int words;
+
+static unsigned int rnd(unsigned int range) { return (unsigned int)random() % range; }
+
+// Operand addresses: in host mapped RAM, at and across the end of it, across 4 KB pages, odd
+// (faulting on word and longword accesses) and far outside of RAM.
+static const unsigned int addresses[] = {
+  0x40000, 0x40100, 0x7FFFE, 0x7FFF0, 0x80010, 0x41FFE, 0x42FFF, 0x1F00, 0x1FFE, 0x4FFFD, 0xFFF000,
+};
+
+static unsigned int random_address(void) {
+  return addresses[rnd(sizeof(addresses) / sizeof(addresses[0]))] + rnd(8);
+}
+
+// Returns a random effective address mode/register field and appends its extension words.
+static unsigned int random_ea(int source, int size, int allow_areg) {
+  for (;;) {
+    unsigned int mode = rnd(9);
+    unsigned int reg = rnd(8);
+    switch (mode) {
+      case 0:
+        return reg;
+      case 1:
+        if (!allow_areg || size == 1)
+          continue;
+        return (1 << 3) | reg;
+      case 2:
+      case 3:
+      case 4:
+        return (mode << 3) | reg;
+      case 5:
+        code[words++] = rnd(2) ? rnd(0x40) : (uint16_t) - (int)rnd(0x40);
+        return (5 << 3) | reg;
+      case 6:
+        code[words++] = rnd(2) ? 0x4000 + rnd(0x4000) : 0xFFF0;
+        return (7 << 3) | 0;
+      case 7: {
+        unsigned int address = random_address();
+        code[words++] = address >> 16;
+        code[words++] = address;
+        return (7 << 3) | 1;
+      }
+      default:
+        if (!source)
+          continue;
+        if (size == 4)
+          code[words++] = rnd(65536);
+        code[words++] = rnd(65536);
+        return (7 << 3) | 4;
+    }
+  }
+}
+
+// Fills code[] with a random loop of up to 24 instructions, closed by a bra back to its start.
+static void generate_loop(void) {
+  static const int sizes[3] = { 1, 2, 4 };
+  static const int move_sizes[3] = { 1, 3, 2 };
+  int count = 1 + rnd(24);
+
+  words = 0;
+  for (int i = 0; i < count; i++) {
+    int kind = rnd(10);
+    if (kind == 0) {
+      code[words++] = 0x7000 | rnd(8) << 9 | rnd(256);  // moveq
+    } else if (kind == 1) {
+      code[words++] = 0x5008 | rnd(8) << 9 | rnd(2) << 8 | (1 + rnd(2)) << 6 | rnd(7);  // addq/subq An
+    } else if (kind == 2) {
+      int at = words++;
+      unsigned int ea;
+      switch (rnd(4)) {
+        case 0: {
+          unsigned int address = random_address();
+          code[words++] = address >> 16;
+          code[words++] = address;
+          ea = 071;
+          break;
+        }
+        case 1:
+          code[words++] = rnd(65536);
+          ea = 050 | rnd(8);
+          break;
+        case 2:
+          ea = 020 | rnd(8);
+          break;
+        default:
+          code[words++] = 0x4000 + rnd(0x4000);
+          ea = 070;
+          break;
+      }
+      code[at] = 0x41C0 | rnd(7) << 9 | ea;  // lea
+    } else if (kind <= 6) {
+      int size = rnd(3);
+      int at = words++;
+      unsigned int source = random_ea(1, sizes[size], 1);
+      unsigned int dest = random_ea(0, sizes[size], 1);
+      code[at] = move_sizes[size] << 12 | (dest & 7) << 9 | (dest >> 3) << 6 | source;  // move/movea
+    } else if (kind <= 8) {
+      int size = rnd(3);
+      int at = words++;
+      unsigned int source = random_ea(1, 1 << size, 0);
+      code[at] = (rnd(2) ? 0xC000 : 0x8000) | rnd(8) << 9 | size << 6 | source;  // and/or <ea>,Dn
+    } else if (rnd(2)) {
+      code[words++] = 0xB100 | rnd(8) << 9 | rnd(3) << 6 | rnd(8);  // eor Dn,Dn
+    } else {
+      code[words++] = 0xD040 | rnd(8) << 9 | rnd(8);  // add.w Dn,Dn, threaded
+    }
+  }
+  code[words++] = 0x6000;  // bra start
+  code[words] = (uint16_t)(-(2 * words));
+  words++;
+}
+
+#define STATE_SR 16
+#define STATE_PC 17
+#define STATE_RAM 18
+#define STATE_CYCLES 19
+#define STATE_SIZE 20
+
+static const char *state_names[STATE_SIZE] = {
+  "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+  "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+  "sr", "pc", "ram", "cycles",
+};
+
+static uint32_t hash_ram(void) {
+  uint32_t hash = 0;
+  for (int i = 0; i < RAM_SIZE; i++)
+    hash = hash * 31 + ram[i];
+  return hash;
+}
+
+// Runs the loop in init_ram for at least the given number of cycles, with timeslices of random
+// length drawn from the seed, and stores the final CPU state.
+static void run(int mode, unsigned int cpu_type, unsigned long seed, unsigned long cycles,
+                uint32_t *state) {
+  unsigned long done = 0;
+
+  srandom(seed);
+  memcpy(ram, init_ram, RAM_SIZE);
+  m68k_set_cpu_type(cpu_type);
+  m68k_set_block_cache(1);
+  m68k_set_jit(mode == MODE_JIT);
+  m68k_invalidate_code(0, RAM_SIZE);
+  m68k_pulse_reset();
+  for (int r = 0; r < 8; r++)
+    m68k_set_reg(M68K_REG_A0 + r, random_address());
+  for (int r = 0; r < 8; r++)
+    m68k_set_reg(M68K_REG_D0 + r, 0x11111111u * r + 0x80);
+  while (done < cycles)
+    done += m68k_execute(rnd(2) ? 300 : 37);
+
+  for (int r = 0; r < 16; r++)
+    state[r] = m68k_get_reg(NULL, M68K_REG_D0 + r);
+  state[STATE_SR] = m68k_get_reg(NULL, M68K_REG_SR);
+  state[STATE_PC] = m68k_get_reg(NULL, M68K_REG_PC);
+  state[STATE_RAM] = hash_ram();
+  state[STATE_CYCLES] = done;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  int first = argc > 2 ? atoi(argv[2]) : 0;
+  int skipped = 0;
+
+  m68k_init();
+  m68k_set_host_pages(0, HOST_SIZE, ram, ram);
+
+  for (int it = first; it < iterations; it++) {
+    unsigned int cpu_type = it & 1 ? M68K_CPU_TYPE_68020 : M68K_CPU_TYPE_68000;
+    unsigned long seed = 1000 + it;
+    uint32_t interpreted[STATE_SIZE], translated[STATE_SIZE];
+
+    srandom(it);
+    generate_loop();
+    for (int i = 0; i < RAM_SIZE; i++)
+      init_ram[i] = rnd(256);
+    // Reset vectors: SSP 0x40000 and PC at the loop
+    memset(init_ram, 0, 8);
+    init_ram[1] = 0x04;
+    init_ram[6] = CODE_ADDRESS >> 8;
+    for (int i = 0; i < words; i++) {
+      init_ram[CODE_ADDRESS + i * 2] = code[i] >> 8;
+      init_ram[CODE_ADDRESS + i * 2 + 1] = code[i];
+    }
+
+    // A short run first, so the JIT run starts with blocks translated by an earlier run
+    run(MODE_BLOCK_CACHE, cpu_type, seed, 100, interpreted);
+    run(MODE_BLOCK_CACHE, cpu_type, seed, RUN_CYCLES, interpreted);
+    if (memcmp(ram + CODE_ADDRESS, init_ram + CODE_ADDRESS, 2 * words)) {
+      skipped++;
+      continue;
+    }
+    run(MODE_JIT, cpu_type, seed, RUN_CYCLES, translated);
+    if (memcmp(interpreted, translated, sizeof(interpreted)) == 0)
+      continue;
+
+    printf("Mismatch in iteration %d, %s, %d words:\n", it, it & 1 ? "68020" : "68000", words);
+    for (int i = 0; i < STATE_SIZE; i++) {
+      if (interpreted[i] != translated[i])
+        printf("  %-6s interpreted %08X jit %08X\n", state_names[i], interpreted[i], translated[i]);
+    }
+    memcpy(ram, init_ram, RAM_SIZE);
+    for (unsigned int pc = CODE_ADDRESS; pc < CODE_ADDRESS + 2 * (unsigned int)words;) {
+      char text[100];
+      unsigned int length = m68k_disassemble(text, pc, cpu_type);
+      printf("%06X  %s\n", pc, text);
+      pc += length;
+    }
+    return 1;
+  }
+
+  printf("%d loops ok, %d skipped for self-modifying code\n", iterations - first - skipped, skipped);
+  return 0;
+}
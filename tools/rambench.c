@@ -0,0 +1,80 @@
+// Random access throughput of RAM mappings with 4K pages, transparent hugepages and hugetlb pages.
+// Usage: rambench [size in MB] [million accesses]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../config_file/config_file.h"
+
+// Only the RAM allocation code from config_file.c is used here.
+struct platform_config *make_platform_config(char *name, char *subsys) {
+  (void)name;
+  (void)subsys;
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Longword read-modify-write at random aligned offsets, like 68k code hammering a large heap.
+// Each address depends on the previous read, so TLB misses can't be overlapped.
+static uint32_t random_access(unsigned char *data, unsigned int size, unsigned long count) {
+  uint32_t seed = 0x12345678, sum = 0;
+  unsigned int mask = size - 1;
+
+  for (unsigned long i = 0; i < count; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    uint32_t *p = (uint32_t *)(data + ((seed ^ sum) & mask & ~3));
+    sum += *p + 1;
+    *p = sum;
+  }
+
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int size_mb = (argc > 1) ? atoi(argv[1]) : 256;
+  unsigned long count = ((argc > 2) ? atol(argv[2]) : 50) * 1000000UL;
+  unsigned char modes[] = { MAPHUGE_NONE, MAPHUGE_THP, MAPHUGE_HUGETLB };
+  struct emulator_config *cfg;
+
+  if (size_mb == 0 || (size_mb & (size_mb - 1))) {
+    printf("Size must be a power of two number of megabytes.\n");
+    return 1;
+  }
+
+  cfg = (struct emulator_config *)calloc(1, sizeof(struct emulator_config));
+  if (!cfg) {
+    printf("Failed to allocate memory for emulator config!\n");
+    return 1;
+  }
+
+  printf("%u MB, %lu million random longword read/write accesses\n", size_mb, count / 1000000);
+  for (unsigned int i = 0; i < sizeof(modes); i++) {
+    cfg->map_type[0] = MAPTYPE_RAM;
+    cfg->map_size[0] = size_mb * 1024 * 1024;
+    cfg->map_policy[0] = MAPPOLICY_PREFAULT;
+    cfg->map_hugepages[0] = modes[i];
+    if (alloc_mapping_ram(cfg, 0) == -1) {
+      printf("Failed to allocate %u MB of RAM.\n", size_mb);
+      return 1;
+    }
+
+    double start = now();
+    uint32_t sum = random_access(cfg->map_data[0], cfg->map_size[0], count);
+    double elapsed = now() - start;
+
+    printf("%-22s %8.1f M accesses/s (%.3fs, sum %.8X)\n", get_mapping_backing_name(cfg, 0), count / elapsed / 1e6, elapsed, sum);
+    free_mapping_data(cfg, 0);
+  }
+
+  free(cfg);
+  return 0;
+}